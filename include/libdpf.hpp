@@ -1,3 +1,4 @@
 #pragma once
 
 #include "libdpf/dpf.hpp"
+#include "libdpf/dpf_writer.hpp"
\ No newline at end of file
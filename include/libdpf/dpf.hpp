@@ -3,6 +3,9 @@
 #include "libdpf/dpf_context.hpp"
 #include "libdpf/misc/dpf_result.hpp"
 #include "libdpf/misc/dpf_inputs.hpp"
+#include "libdpf/misc/dpf_output.hpp"
+#include "libdpf/misc/dpf_file_info.hpp"
+#include "libdpf/misc/dpf_format_info.hpp"
 
 #include <filesystem>
 #include <vector>
@@ -30,11 +33,40 @@ namespace libdpf {
         */
         bool is_dpf_file(const FILE_PATH& file);
 
+        /*
+            Fill input_files with the changes that turn old_dir into new_dir.
+
+            Files are matched by relative path. Files with the same size and
+            modification time are unchanged, others with the same size are compared
+            by content. Added files with the content of a file in old_dir are moved
+            from it when it was removed, copied otherwise.
+            base_path is set to new_dir and original_path to old_dir.
+            Uses context thread_count and cancel.
+        */
+        dpf_result diff(const DIR_PATH& old_dir, const DIR_PATH& new_dir, dpf_inputs& input_files,
+            dpf_context* context = nullptr);
+
         /*
             Synchronously create a DPF file containing input files.
         */
         dpf_result create(dpf_inputs& input_files, const FILE_PATH& dpf_file, dpf_context* context = nullptr);
 
+        /*
+            Synchronously create a DPF file containing input files, written to output in a single forward pass.
+            The checksum is kept in a trailer after the last entry.
+        */
+        dpf_result create(dpf_inputs& input_files, dpf_output& output, dpf_context* context = nullptr);
+
+        /*
+            Synchronously append input files to an existing DPF file.
+
+            Only the new entries are hashed, earlier ones are neither rewritten nor read.
+            Files without a segment table are hashed once to get one.
+            The patch version, format and dictionary of the DPF file are kept,
+            input_files version, format and dictionary are ignored.
+        */
+        dpf_result append(dpf_inputs& input_files, const FILE_PATH& dpf_file, dpf_context* context = nullptr);
+
         /*
             Asynchronously create a DPF file containing input files.
         */
@@ -55,6 +87,18 @@ namespace libdpf {
         */
         dpf_result get_files(const FILE_PATH& dpf_file, std::vector<std::string>& files);
 
+        /*
+            Get entries packed inside a DPF file, in patch order.
+            Files with an index are listed with a single read.
+        */
+        dpf_result get_files(const FILE_PATH& dpf_file, std::vector<dpf_file_info>& files);
+
+        /*
+            Find the last entry for path inside a DPF file.
+            Files with an index are searched without listing all entries.
+        */
+        dpf_result find_file(const FILE_PATH& dpf_file, const std::string& path, dpf_file_info& info);
+
         /*
             Get packed patch version.
         */
@@ -65,9 +109,24 @@ namespace libdpf {
         */
         dpf_result get_patch_version(const FILE_PATH& dpf_file, uint16_t& version_major, uint16_t& version_minor, uint16_t& version_rev);
 
+        /*
+            Get the format version and features of a DPF file.
+        */
+        dpf_result get_format(const FILE_PATH& dpf_file, dpf_format_info& format);
+
         /*
             Check DPF file checksum.
+            Files with entry checksums are checked entry by entry, in parallel.
         */
         bool check_checksum(const FILE_PATH& dpf_file);
+
+        /*
+            Build a preset dictionary for input_files.dictionary from a sample of
+            input files no larger than input_files.dictionary_max_file_size.
+
+            @param max_size -> dictionary size limit, at most 32 KB
+        */
+        dpf_result train_dictionary(const dpf_inputs& input_files, std::vector<uint8_t>& dictionary,
+            size_t max_size = 32768U);
     };
 }
\ No newline at end of file
@@ -2,7 +2,9 @@
 
 #include "libdpf/misc/dpf_result.hpp"
 #include "libdpf/misc/dpf_file_mod.hpp"
+#include "libdpf/misc/dpf_progress.hpp"
 
+#include <filesystem>
 #include <functional>
 #include <vector>
 #include <atomic>
@@ -16,7 +18,8 @@ namespace libdpf {
     struct dpf_context {
         using start_callback_t  = std::function<void()>;
         using finish_callback_t = std::function<void(dpf_result)>;
-        using update_callback_t = std::function<void(float)>;
+        using update_callback_t   = std::function<void(float)>;
+        using progress_callback_t = std::function<void(const dpf_progress&)>;
         using buf_process_fn_t  = std::function<dpf_result(const dpf_file_mod& file, std::vector<uint8_t>& buffer)>;
 
         /*
@@ -35,14 +38,32 @@ namespace libdpf {
 
         /*
             Update callback.
+            Changes are weighted by content size and add up to 100.
 
-            @param void(float) -> progress change
+            @param void(float) -> progress change in percent
         */
         update_callback_t update_callback = nullptr;
 
+        /*
+            Progress callback with byte and entry counts, throughput and ETA.
+            Large streamed files report progress while they're processed.
+            Can be called from worker threads, but never concurrently.
+
+            @param void(const dpf_progress&)
+        */
+        progress_callback_t progress_callback = nullptr;
+
+        /*
+            Minimum time between update and progress callbacks in milliseconds.
+            0 reports every change. Final progress is always reported.
+        */
+        uint32_t progress_interval = 100U;
+
         /*
             Buffer processing before compression / after decompression.
             Considered successful if return status is finished.
+            Called from worker threads when thread_count isn't 1.
+            Delta entries aren't created while set, and aren't passed to it when patching.
 
             @param dpf_result(const dpf_file_mod&, std::vector<uint8_t>&)
         */
@@ -52,5 +73,56 @@ namespace libdpf {
             Cancel token.
         */
         std::atomic_bool* cancel = nullptr;
+
+        /*
+            Number of worker threads used for compression, and for decompression of split files.
+            0 uses all hardware threads, 1 does all work on the calling thread.
+            Output is identical regardless of the thread count.
+        */
+        unsigned int thread_count = 1U;
+
+        /*
+            Files larger than this (in bytes) are compressed / decompressed in fixed-size blocks
+            straight to and from disk instead of being loaded into memory.
+            Not used for files that go through buf_process_fn, which needs the whole buffer.
+        */
+        uint64_t streaming_threshold = 64U * 1024U * 1024U;
+
+        /*
+            Streamed files larger than this (in bytes) are deflated in independent blocks of
+            this size, which are decompressed in parallel when patching.
+            0 disables splitting, sizes over 256 MB are clamped.
+        */
+        uint64_t split_size = 4U * 1024U * 1024U;
+
+        /*
+            Approximate limit in bytes for content held in memory at once, 0 for no limit.
+            Files that would need more than the budget are streamed, and fewer entries are
+            prepared, read ahead or written behind at the same time rather than exceeding it.
+            Entries that can't be streamed (delta entries, files going through buf_process_fn)
+            are processed on their own when they don't fit.
+        */
+        uint64_t memory_budget = 0U;
+
+        /*
+            Overlap reading, compression / decompression and writing on separate threads.
+            Inputs are read ahead and output is written behind the entry being processed,
+            through queues of a few entries each. Helps most on slow or high latency storage.
+        */
+        bool pipelined = false;
+
+        /*
+            Directory of the compressed content cache, empty to disable.
+            Deflated entries are looked up by content and compression settings, so
+            unchanged files are copied from the cache instead of being compressed again.
+            Can be shared by concurrent creates.
+        */
+        std::filesystem::path cache_path = "";
+
+        /*
+            Cache size limit in bytes.
+            Least recently used content is removed at the end of each create.
+        */
+        uint64_t cache_max_size = 1024U * 1024U * 1024U;
     };
 }
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "libdpf/dpf_context.hpp"
+#include "libdpf/misc/dpf_result.hpp"
+#include "libdpf/misc/dpf_compression.hpp"
+
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <cstdint>
+
+namespace libdpf {
+    /*
+        Incremental DPF file builder for content that isn't on disk.
+
+        Entries are compressed and written as they're added, in the order they're added.
+        Buffers up to context streaming_threshold are compressed in memory, larger buffers
+        and reader content are compressed in fixed-size blocks straight to the DPF file.
+        Content that doesn't compress is stored.
+
+        The file is only valid once closed. Closing reads it back once to compute the checksum.
+        After any failure the writer can only be closed, which removes the file.
+    */
+    class dpf_writer {
+    public:
+        using FILE_PATH = std::filesystem::path;
+
+        /*
+            Fill buffer with up to size bytes of content.
+
+            @returns number of bytes written to buffer, 0 once there's no more content
+        */
+        using reader_fn_t = std::function<size_t(uint8_t* buffer, size_t size)>;
+
+    public:
+        dpf_writer();
+        dpf_writer(const dpf_writer&) = delete;
+        dpf_writer(dpf_writer&&) noexcept;
+
+        /*
+            Closes the file if still open.
+        */
+        ~dpf_writer();
+
+        dpf_writer& operator=(const dpf_writer&) = delete;
+        dpf_writer& operator=(dpf_writer&&) noexcept;
+
+    public:
+        /*
+            Start writing a DPF file.
+            Uses context streaming_threshold and memory_budget.
+
+            @param compression -> default compression of added entries
+        */
+        dpf_result open(const FILE_PATH& dpf_file, uint64_t version = 0U, const dpf_compression& compression = {},
+            dpf_context* context = nullptr);
+
+        /*
+            Add or modify a file with content from a buffer.
+
+            @param op -> dpf_op::add or dpf_op::modify
+        */
+        dpf_result add(const FILE_PATH& path, std::span<const uint8_t> content, dpf_op op = dpf_op::add,
+            std::optional<dpf_compression> compression = std::nullopt);
+
+        /*
+            Add or modify a file with content pulled from reader until it returns 0.
+            Exceptions thrown by reader fail the entry.
+
+            @param op -> dpf_op::add or dpf_op::modify
+        */
+        dpf_result add(const FILE_PATH& path, const reader_fn_t& reader, dpf_op op = dpf_op::add,
+            std::optional<dpf_compression> compression = std::nullopt);
+
+        /*
+            Remove a file.
+        */
+        dpf_result remove(const FILE_PATH& path);
+
+        /*
+            Finish the DPF file.
+        */
+        dpf_result close();
+
+        bool is_open() const;
+
+    private:
+        struct state;
+
+        std::unique_ptr<state> m_state;
+    };
+}
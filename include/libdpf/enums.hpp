@@ -8,7 +8,29 @@ namespace libdpf {
         undefined,
         add,
         remove,
-        modify
+        modify,
+        move,   // Rename source to path
+        copy    // Copy source to path
+    };
+
+    /*
+        Deflate match finding strategy.
+    */
+    enum class dpf_deflate_strategy : unsigned char {
+        normal,
+        filtered,
+        huffman_only,
+        rle,
+        fixed
+    };
+
+    /*
+        How small files are grouped into solid blocks.
+    */
+    enum class dpf_solid_group : unsigned char {
+        none,
+        extension,
+        directory
     };
 
     /*
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "libdpf/enums.hpp"
+
+namespace libdpf {
+    /*
+        Deflate compression settings.
+    */
+    struct dpf_compression {
+        /*
+            0 (no compression) to 10 (uber compression), -1 for the default level (6).
+        */
+        int                  level    = -1;
+        dpf_deflate_strategy strategy = dpf_deflate_strategy::normal;
+    };
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "libdpf/enums.hpp"
+
+#include <string>
+#include <cstdint>
+
+namespace libdpf {
+    /*
+        Entry of a DPF file.
+
+        Size is the uncompressed content size of added and modified files.
+        Offset is where the entry starts in the DPF file.
+    */
+    struct dpf_file_info {
+        std::string path   = "";
+        dpf_op      op     = dpf_op::undefined;
+        uint64_t    size   = 0U;
+        uint64_t    offset = 0U;
+    };
+}
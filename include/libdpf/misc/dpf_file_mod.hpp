@@ -1,16 +1,24 @@
 #pragma once
 
 #include "libdpf/enums.hpp"
+#include "libdpf/misc/dpf_compression.hpp"
 
 #include <vector>
+#include <optional>
 #include <filesystem>
 
 namespace libdpf {
     /*
         File modification.
+
+        When set, compression overrides dpf_inputs::compression for this file.
+        Move and copy take an existing file at source in the patched tree,
+        source is made relative to dpf_inputs::base_path like path.
     */
     struct dpf_file_mod {
-        std::filesystem::path path = "";
-        dpf_op                op   = dpf_op::undefined;
+        std::filesystem::path          path        = "";
+        dpf_op                         op          = dpf_op::undefined;
+        std::optional<dpf_compression> compression = std::nullopt;
+        std::filesystem::path          source      = "";
     };
 }
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+
+namespace libdpf {
+    /*
+        Format version and features of a DPF file.
+
+        Features are only used by V2+ files:
+            dictionary -> preset deflate dictionary in the header
+            trailer    -> checksum after the last entry, for files written in a single pass
+            segments   -> checksum for every create and append
+            index      -> entry index after the last entry
+            checksums  -> CRC-32 of every entry, in the index
+            path_table -> entry paths front coded in the index, always set with index
+    */
+    struct dpf_format_info {
+        static constexpr uint32_t dictionary = 0x00000001U;
+        static constexpr uint32_t trailer    = 0x00000002U;
+        static constexpr uint32_t segments   = 0x00000004U;
+        static constexpr uint32_t index      = 0x00000008U;
+        static constexpr uint32_t checksums  = 0x00000010U;
+        static constexpr uint32_t path_table = 0x00000020U;
+        static constexpr uint32_t all        = 0x0000003FU;
+
+        uint16_t version  = 0U;
+        uint32_t features = 0U;
+
+        bool has(uint32_t feature) const {
+            return (features & feature) == feature;
+        }
+    };
+}
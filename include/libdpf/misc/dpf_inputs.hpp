@@ -1,16 +1,63 @@
 #pragma once
 
 #include "libdpf/misc/dpf_file_mod.hpp"
+#include "libdpf/misc/dpf_format_info.hpp"
 
 #include <vector>
+#include <string>
 
 namespace libdpf {
     /*
         File modifications.
+
+        Files are stored uncompressed when their extension is in store_extensions,
+        when their compression level is 0, or when store_incompressible is set and 
+        a sample of their content doesn't compress.
+
+        When original_path is set, modified files are diffed against the file at the
+        same relative path under it and stored as a delta if that's smaller.
+        Diffing needs about 10x the file size in memory, so files over
+        delta_max_size bytes are block matched against their original instead,
+        which streams both files and only keeps a small index of the original in memory.
+
+        When deduplicate is set, files with identical content are stored once and
+        later copies reference the first one. Not used when buf_process_fn is set.
+
+        When solid_group isn't none, files up to solid_max_file_size bytes are grouped
+        by extension or directory and compressed together in blocks of about
+        solid_block_size bytes. Solid blocks are written before all other entries.
+
+        When dictionary is set, files up to dictionary_max_file_size bytes are compressed
+        with it as a preset dictionary. The dictionary is stored once in the DPF file.
+        See dpf::train_dictionary.
+
+        Copies are applied before all other entries, followed by moves, each in input order.
+
+        format_version is the DPF format version to write, 0 for the latest.
+        V1 files only hold deflated add, modify and remove entries, so deltas, deduplication,
+        solid blocks, stored and split entries and the dictionary aren't used for them.
+        They can only be created into files.
+        format_features limits the optional V2 features written (index, checksums and path_table,
+        see dpf_format_info), so newer layouts can be rolled out gradually.
+        Checksums and the path table are kept in the index, and are left out without it.
+        The path table is always written with the index.
     */
     struct dpf_inputs {
-        std::filesystem::path     base_path = "";
-        uint64_t                  version   = 0U;
+        std::filesystem::path     base_path                = "";
+        uint64_t                  version                  = 0U;
+        dpf_compression           compression              = {};
+        std::vector<std::string>  store_extensions         = {};
+        bool                      store_incompressible     = true;
+        std::filesystem::path     original_path            = "";
+        uint64_t                  delta_max_size           = 128U * 1024U * 1024U;
+        bool                      deduplicate              = true;
+        dpf_solid_group           solid_group              = dpf_solid_group::none;
+        uint64_t                  solid_max_file_size      = 64U * 1024U;
+        uint64_t                  solid_block_size         = 4U * 1024U * 1024U;
+        std::vector<uint8_t>      dictionary               = {};
+        uint64_t                  dictionary_max_file_size = 64U * 1024U;
+        uint16_t                  format_version           = 0U;
+        uint32_t                  format_features          = dpf_format_info::all;
         std::vector<dpf_file_mod> files;
     };
 }
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <ostream>
+#include <vector>
+#include <cstdint>
+
+namespace libdpf {
+    /*
+        Destination of a DPF file written in a single forward pass,
+        for pipes, sockets, upload spools or memory.
+    */
+    class dpf_output {
+    public:
+        virtual ~dpf_output() = default;
+
+    public:
+        /*
+            Write the next bytes of the DPF file.
+
+            @returns TRUE on success, FALSE to fail the create
+        */
+        virtual bool write(const uint8_t* data, size_t size) = 0;
+    };
+
+    /*
+        Output into a memory buffer.
+    */
+    class dpf_memory_output : public dpf_output {
+    public:
+        std::vector<uint8_t> buffer;
+
+    public:
+        bool write(const uint8_t* data, size_t size) override {
+            buffer.insert(buffer.end(), data, data + size);
+            return true;
+        }
+    };
+
+    /*
+        Output into a standard stream, never seeked.
+    */
+    class dpf_stream_output : public dpf_output {
+    public:
+        dpf_stream_output(std::ostream& stream)
+            : m_stream(stream) {}
+
+    public:
+        bool write(const uint8_t* data, size_t size) override {
+            m_stream.write((const char*)data, size);
+            return m_stream.good();
+        }
+
+    private:
+        std::ostream& m_stream;
+    };
+}
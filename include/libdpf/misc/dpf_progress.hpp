@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+namespace libdpf {
+    /*
+        Progress of a create or patch.
+
+        Bytes are uncompressed content sizes of added and modified files.
+    */
+    struct dpf_progress {
+        uint64_t    bytes_processed   = 0U;
+        uint64_t    bytes_total       = 0U;
+        uint64_t    entries_processed = 0U;
+        uint64_t    entries_total     = 0U;
+
+        // Recent throughput in bytes per second
+        double      bytes_per_second  = 0.0;
+
+        // Estimated seconds left, negative until throughput is known
+        double      eta_seconds       = -1.0;
+
+        // Entry being processed when reported
+        std::string current_entry     = "";
+    };
+}
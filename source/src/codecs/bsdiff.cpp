@@ -0,0 +1,430 @@
+#include "codecs/bsdiff.hpp"
+
+#include <md5\md5.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+using namespace libdpf;
+
+///////////////////////////////////////////////////////////////////////////////
+// SUFFIX ARRAY (SA-IS)
+
+// Byte string with a virtual sentinel appended, shifted so the sentinel is the smallest symbol
+struct sais_bytes {
+    const uint8_t* data;
+    int32_t        size;
+
+    int32_t operator[](int32_t i) const {
+        return i < size ? (int32_t)data[i] + 1 : 0;
+    }
+};
+
+template<typename S>
+static void internal_get_buckets(const S& s, std::vector<int32_t>& bkt, int32_t n, int32_t k, bool end) {
+    std::fill(bkt.begin(), bkt.begin() + k, 0);
+
+    for (int32_t i = 0; i < n; i++)
+        bkt[s[i]]++;
+
+    int32_t sum = 0;
+
+    for (int32_t i = 0; i < k; i++) {
+        sum += bkt[i];
+        bkt[i] = end ? sum : sum - bkt[i];
+    }
+}
+
+template<typename S>
+static void internal_induce(const S& s, const std::vector<bool>& t, int32_t* sa, std::vector<int32_t>& bkt, int32_t n, int32_t k) {
+    internal_get_buckets(s, bkt, n, k, false);
+
+    for (int32_t i = 0; i < n; i++) {
+        int32_t j = sa[i] - 1;
+
+        if (j >= 0 && !t[j])
+            sa[bkt[s[j]]++] = j;
+    }
+
+    internal_get_buckets(s, bkt, n, k, true);
+
+    for (int32_t i = n - 1; i >= 0; i--) {
+        int32_t j = sa[i] - 1;
+
+        if (j >= 0 && t[j])
+            sa[--bkt[s[j]]] = j;
+    }
+}
+
+// s[n - 1] must be the unique smallest symbol
+template<typename S>
+static void internal_sais(const S& s, int32_t* sa, int32_t n, int32_t k) {
+    if (n == 1) {
+        sa[0] = 0;
+        return;
+    }
+
+    // Suffix types, TRUE for S-type, FALSE for L-type
+
+    std::vector<bool> t(n);
+    t[n - 1] = true;
+
+    for (int32_t i = n - 2; i >= 0; i--)
+        t[i] = s[i] < s[i + 1] || (s[i] == s[i + 1] && t[i + 1]);
+
+    auto is_lms = [&](int32_t i) { return i > 0 && t[i] && !t[i - 1]; };
+
+    // Sort LMS substrings
+
+    std::vector<int32_t> bkt(k);
+
+    internal_get_buckets(s, bkt, n, k, true);
+    std::fill(sa, sa + n, -1);
+
+    for (int32_t i = 1; i < n; i++) {
+        if (is_lms(i))
+            sa[--bkt[s[i]]] = i;
+    }
+
+    internal_induce(s, t, sa, bkt, n, k);
+
+    int32_t n1 = 0;
+
+    for (int32_t i = 0; i < n; i++) {
+        if (is_lms(sa[i]))
+            sa[n1++] = sa[i];
+    }
+
+    // Name LMS substrings
+
+    std::fill(sa + n1, sa + n, -1);
+
+    int32_t name = 0;
+    int32_t prev = -1;
+
+    for (int32_t i = 0; i < n1; i++) {
+        int32_t pos  = sa[i];
+        bool    diff = false;
+
+        for (int32_t d = 0; d < n; d++) {
+            if (prev == -1 || s[pos + d] != s[prev + d] || t[pos + d] != t[prev + d]) {
+                diff = true;
+                break;
+            }
+
+            if (d > 0 && (is_lms(pos + d) || is_lms(prev + d)))
+                break;
+        }
+
+        if (diff) {
+            name++;
+            prev = pos;
+        }
+
+        sa[n1 + pos / 2] = name - 1;
+    }
+
+    for (int32_t i = n - 1, j = n - 1; i >= n1; i--) {
+        if (sa[i] >= 0)
+            sa[j--] = sa[i];
+    }
+
+    // Sort LMS suffixes, recursing if names aren't unique
+
+    int32_t* s1  = sa + n - n1;
+    int32_t* sa1 = sa;
+
+    if (name < n1) {
+        internal_sais(s1, sa1, n1, name);
+    }
+    else {
+        for (int32_t i = 0; i < n1; i++)
+            sa1[s1[i]] = i;
+    }
+
+    // Induce the full suffix array from sorted LMS suffixes
+
+    for (int32_t i = 1, j = 0; i < n; i++) {
+        if (is_lms(i))
+            s1[j++] = i;
+    }
+
+    for (int32_t i = 0; i < n1; i++)
+        sa1[i] = s1[sa1[i]];
+
+    std::fill(sa + n1, sa + n, -1);
+    internal_get_buckets(s, bkt, n, k, true);
+
+    for (int32_t i = n1 - 1; i >= 0; i--) {
+        int32_t j = sa[i];
+        sa[i] = -1;
+        sa[--bkt[s[j]]] = j;
+    }
+
+    internal_induce(s, t, sa, bkt, n, k);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// MATCHING
+
+static size_t internal_match_len(const uint8_t* a, size_t a_size, const uint8_t* b, size_t b_size) {
+    size_t len = std::min(a_size, b_size);
+    size_t i   = 0U;
+
+    while (i < len && a[i] == b[i])
+        i++;
+
+    return i;
+}
+
+// Longest match of `data` in old content, binary searching the suffix array
+static size_t internal_search(const std::vector<int32_t>& sa, const uint8_t* old_data, size_t old_size,
+    const uint8_t* data, size_t size, size_t& pos)
+{
+    size_t st = 0U;
+    size_t en = old_size;
+
+    while (en - st >= 2U) {
+        size_t x   = st + (en - st) / 2;
+        size_t off = (size_t)sa[x];
+
+        if (std::memcmp(old_data + off, data, std::min(old_size - off, size)) < 0)
+            st = x;
+        else
+            en = x;
+    }
+
+    size_t x = internal_match_len(old_data + sa[st], old_size - sa[st], data, size);
+    size_t y = internal_match_len(old_data + sa[en], old_size - sa[en], data, size);
+
+    pos = (size_t)(x > y ? sa[st] : sa[en]);
+    return x > y ? x : y;
+}
+
+template<typename T>
+static void internal_put(std::vector<uint8_t>& out, T value) {
+    out.insert(out.end(), (const uint8_t*)&value, (const uint8_t*)&value + sizeof(T));
+}
+
+template<typename T>
+static bool internal_get(const uint8_t* data, size_t size, size_t& pos, T& value) {
+    if (size - pos < sizeof(T))
+        return false;
+
+    std::memcpy(&value, data + pos, sizeof(T));
+    pos += sizeof(T);
+
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// PUBLIC
+
+void bsdiff::create(const uint8_t* old_data, size_t old_size, const uint8_t* new_data, size_t new_size,
+    std::vector<uint8_t>& delta)
+{
+    delta.clear();
+
+    unsigned char old_md5[16];
+
+    MD5 md5;
+    md5.add(old_data, old_size);
+    md5.getHash(old_md5);
+
+    internal_put<uint64_t>(delta, old_size);
+    delta.insert(delta.end(), old_md5, old_md5 + sizeof(old_md5));
+    internal_put<uint64_t>(delta, new_size);
+
+    // Suffix array over old content, sa[0] is the empty suffix
+
+    std::vector<int32_t> sa(old_size + 1);
+    internal_sais(sais_bytes{ old_data, (int32_t)old_size }, sa.data(), (int32_t)old_size + 1, 257);
+
+    auto emit = [&](size_t diff_size, size_t extra_size, int64_t seek, size_t new_pos, size_t old_pos) {
+        internal_put<uint64_t>(delta, diff_size);
+        internal_put<uint64_t>(delta, extra_size);
+        internal_put<int64_t>(delta, seek);
+
+        for (size_t i = 0; i < diff_size; i++)
+            delta.push_back((uint8_t)(new_data[new_pos + i] - old_data[old_pos + i]));
+
+        delta.insert(delta.end(), new_data + new_pos + diff_size, new_data + new_pos + diff_size + extra_size);
+    };
+
+    // Find approximate matches, extending exact matches forwards and backwards
+    // while more than half of the bytes agree
+
+    size_t  scan        = 0U;
+    size_t  len         = 0U;
+    size_t  pos         = 0U;
+    size_t  last_scan   = 0U;
+    size_t  last_pos    = 0U;
+    int64_t last_offset = 0;
+
+    while (scan < new_size) {
+        int64_t old_score = 0;
+        size_t  scsc      = scan += len;
+
+        for (; scan < new_size; scan++) {
+            len = internal_search(sa, old_data, old_size, new_data + scan, new_size - scan, pos);
+
+            for (; scsc < scan + len; scsc++) {
+                int64_t o = (int64_t)scsc + last_offset;
+
+                if (o >= 0 && (size_t)o < old_size && old_data[o] == new_data[scsc])
+                    old_score++;
+            }
+
+            if (((int64_t)len == old_score && len != 0U) || (int64_t)len > old_score + 8)
+                break;
+
+            int64_t o = (int64_t)scan + last_offset;
+
+            if (o >= 0 && (size_t)o < old_size && old_data[o] == new_data[scan])
+                old_score--;
+        }
+
+        if ((int64_t)len == old_score && scan != new_size)
+            continue;
+
+        // Forward extension of the previous match
+
+        int64_t s      = 0;
+        int64_t best_f = 0;
+        size_t  len_f  = 0U;
+
+        for (size_t i = 0; last_scan + i < scan && last_pos + i < old_size;) {
+            if (old_data[last_pos + i] == new_data[last_scan + i])
+                s++;
+
+            i++;
+
+            if (s * 2 - (int64_t)i > best_f * 2 - (int64_t)len_f) {
+                best_f = s;
+                len_f  = i;
+            }
+        }
+
+        // Backward extension of the current match
+
+        size_t len_b = 0U;
+
+        if (scan < new_size) {
+            int64_t best_b = 0;
+            s = 0;
+
+            for (size_t i = 1; scan >= last_scan + i && pos >= i; i++) {
+                if (old_data[pos - i] == new_data[scan - i])
+                    s++;
+
+                if (s * 2 - (int64_t)i > best_b * 2 - (int64_t)len_b) {
+                    best_b = s;
+                    len_b  = i;
+                }
+            }
+        }
+
+        // Resolve overlap between the two extensions
+
+        if (last_scan + len_f > scan - len_b) {
+            size_t  overlap = (last_scan + len_f) - (scan - len_b);
+            int64_t best_s  = 0;
+            size_t  len_s   = 0U;
+            s = 0;
+
+            for (size_t i = 0; i < overlap; i++) {
+                if (new_data[last_scan + len_f - overlap + i] == old_data[last_pos + len_f - overlap + i])
+                    s++;
+
+                if (new_data[scan - len_b + i] == old_data[pos - len_b + i])
+                    s--;
+
+                if (s > best_s) {
+                    best_s = s;
+                    len_s  = i + 1;
+                }
+            }
+
+            len_f += len_s - overlap;
+            len_b -= len_s;
+        }
+
+        emit(len_f, (scan - len_b) - (last_scan + len_f),
+            (int64_t)(pos - len_b) - (int64_t)(last_pos + len_f), last_scan, last_pos);
+
+        last_scan   = scan - len_b;
+        last_pos    = pos - len_b;
+        last_offset = (int64_t)pos - (int64_t)scan;
+    }
+}
+
+bool bsdiff::apply(const uint8_t* old_data, size_t old_size, const uint8_t* delta, size_t delta_size,
+    std::vector<uint8_t>& new_data)
+{
+    size_t   cursor        = 0U;
+    uint64_t expected_size = 0U;
+    uint64_t new_size      = 0U;
+    uint8_t  expected_md5[16];
+    uint8_t  old_md5[16];
+
+    if (!internal_get(delta, delta_size, cursor, expected_size) || expected_size != old_size)
+        return false;
+
+    if (delta_size - cursor < sizeof(expected_md5))
+        return false;
+
+    std::memcpy(expected_md5, delta + cursor, sizeof(expected_md5));
+    cursor += sizeof(expected_md5);
+
+    MD5 md5;
+    md5.add(old_data, old_size);
+    md5.getHash(old_md5);
+
+    if (std::memcmp(expected_md5, old_md5, sizeof(old_md5)) != 0)
+        return false;
+
+    if (!internal_get(delta, delta_size, cursor, new_size))
+        return false;
+
+    new_data.resize((size_t)new_size);
+
+    size_t  new_pos = 0U;
+    int64_t old_pos = 0;
+
+    while (new_pos < new_size) {
+        uint64_t diff_size  = 0U;
+        uint64_t extra_size = 0U;
+        int64_t  seek       = 0;
+
+        if (!internal_get(delta, delta_size, cursor, diff_size) ||
+            !internal_get(delta, delta_size, cursor, extra_size) ||
+            !internal_get(delta, delta_size, cursor, seek))
+        {
+            return false;
+        }
+
+        if (diff_size > new_size - new_pos || extra_size > new_size - new_pos - diff_size ||
+            diff_size + extra_size > delta_size - cursor)
+        {
+            return false;
+        }
+
+        if (old_pos < 0 || (uint64_t)old_pos + diff_size > old_size)
+            return false;
+
+        for (size_t i = 0; i < diff_size; i++)
+            new_data[new_pos + i] = (uint8_t)(delta[cursor + i] + old_data[old_pos + i]);
+
+        cursor  += (size_t)diff_size;
+        new_pos += (size_t)diff_size;
+        old_pos += (int64_t)diff_size;
+
+        std::memcpy(new_data.data() + new_pos, delta + cursor, (size_t)extra_size);
+
+        cursor  += (size_t)extra_size;
+        new_pos += (size_t)extra_size;
+        old_pos += seek;
+    }
+
+    return cursor == delta_size;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace libdpf {
+    /*
+        Suffix array based binary diff in the style of bsdiff.
+
+        Delta layout (uncompressed, all numbers little endian):
+            uint64_t old_size
+            uint8_t  old_md5[16]
+            uint64_t new_size
+            repeated until new_size bytes are produced:
+                uint64_t diff_size   -> bytes added to old content
+                uint64_t extra_size  -> bytes copied as is
+                int64_t  seek        -> old position adjustment after the diff
+                uint8_t  diff[diff_size]
+                uint8_t  extra[extra_size]
+
+        Memory use is about 9x the old size plus both inputs.
+    */
+    class bsdiff {
+    public:
+        /*
+            Create a delta that turns old content into new content.
+        */
+        static void create(const uint8_t* old_data, size_t old_size, const uint8_t* new_data, size_t new_size,
+            std::vector<uint8_t>& delta);
+
+        /*
+            Apply a delta to old content.
+
+            @returns TRUE on success, FALSE if the delta is corrupt or doesn't match the old content
+        */
+        static bool apply(const uint8_t* old_data, size_t old_size, const uint8_t* delta, size_t delta_size,
+            std::vector<uint8_t>& new_data);
+
+        /*
+            Largest old content size a suffix array can be built for.
+        */
+        static constexpr size_t max_size = 0x7FFFFFF0U;
+    };
+}
@@ -0,0 +1,84 @@
+#include "codecs/compressibility.hpp"
+#include "codecs/deflate_stream.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace libdpf;
+
+static std::string internal_to_lower(std::string value);
+
+///////////////////////////////////////////////////////////////////////////////
+// PUBLIC
+
+bool libdpf::is_compressible(const uint8_t* data, size_t size) {
+    size = std::min<size_t>(size, DPF_SAMPLE_SIZE);
+
+    if (size == 0U)
+        return true;
+
+    // Shannon entropy of the byte histogram, in bits per byte
+
+    size_t histogram[256] = {};
+
+    for (size_t i = 0; i < size; i++)
+        histogram[data[i]]++;
+
+    double entropy = 0.0;
+
+    for (size_t count : histogram) {
+        if (!count) continue;
+
+        double p = (double)count / size;
+        entropy -= p * std::log2(p);
+    }
+
+    if (entropy < 7.0)
+        return true;
+
+    // High byte entropy can still hide repeated blocks, so try it
+
+    dpf_compression compression;
+    compression.level = 1;
+
+    deflate_stream compressor(compression);
+    size_t         compressed_size = 0U;
+
+    stream_write_fn_t sink = [&](const uint8_t*, size_t len) {
+        compressed_size += len;
+    };
+
+    if (!compressor.write(data, size, sink) || !compressor.finish(sink))
+        return true;
+
+    return compressed_size * 100U < size * 97U;
+}
+
+bool libdpf::has_extension(const std::filesystem::path& path, const std::vector<std::string>& extensions) {
+    if (extensions.empty() || !path.has_extension())
+        return false;
+
+    // Extensions match with or without the leading dot
+
+    std::string extension = internal_to_lower(path.extension().string().substr(1));
+
+    for (const std::string& ext : extensions) {
+        std::string value = internal_to_lower(ext);
+
+        if (!value.empty() && value[0] == '.')
+            value.erase(0, 1);
+
+        if (value == extension)
+            return true;
+    }
+
+    return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// INTERNAL IMPL
+
+std::string internal_to_lower(std::string value) {
+    std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    return value;
+}
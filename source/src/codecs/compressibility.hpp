@@ -0,0 +1,24 @@
+#pragma once
+
+#include <filesystem>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// Bytes sampled from the start of a file to decide if it's worth compressing
+#define DPF_SAMPLE_SIZE (64U * 1024U)
+
+namespace libdpf {
+    /*
+        Check if a sample of content is worth deflating.
+        Low entropy samples are accepted right away, the rest go through a fast trial compression.
+
+        @returns TRUE if deflate saves at least 3%, FALSE otherwise
+    */
+    bool is_compressible(const uint8_t* data, size_t size);
+
+    /*
+        Check if a file's extension is in a list of extensions, ignoring case.
+    */
+    bool has_extension(const std::filesystem::path& path, const std::vector<std::string>& extensions);
+}
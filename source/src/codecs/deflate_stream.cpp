@@ -0,0 +1,147 @@
+#include "codecs/deflate_stream.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace libdpf;
+
+///////////////////////////////////////////////////////////////////////////////
+// DEFLATE
+
+deflate_stream::deflate_stream(const dpf_compression& compression, const std::vector<uint8_t>& dictionary)
+    : m_compressor(tdefl_compressor_alloc(), [](tdefl_compressor* ptr) { tdefl_compressor_free(ptr); })
+{
+    if (!m_compressor)
+        throw std::bad_alloc();
+
+    reset(compression, dictionary);
+}
+
+deflate_stream::~deflate_stream() {}
+
+void deflate_stream::reset(const dpf_compression& compression, const std::vector<uint8_t>& dictionary) {
+    if (dictionary.empty()) {
+        tdefl_init(m_compressor.get(), &deflate_stream::put_buf, this, get_flags(compression));
+        return;
+    }
+
+    if (dictionary.size() > max_dictionary_size)
+        throw std::invalid_argument("Dictionary is larger than the deflate window.");
+
+    // Compress the dictionary and throw the output away, leaving it in the window
+
+    tdefl_init(m_compressor.get(), &deflate_stream::put_buf, this, get_flags(compression) & ~TDEFL_WRITE_ZLIB_HEADER);
+
+    stream_write_fn_t discard = [](const uint8_t*, size_t) {};
+
+    m_sink = &discard;
+    tdefl_status status = tdefl_compress_buffer(m_compressor.get(), dictionary.data(), dictionary.size(), TDEFL_SYNC_FLUSH);
+    m_sink = nullptr;
+
+    if (status != TDEFL_STATUS_OKAY)
+        throw std::runtime_error("Failed to load dictionary.");
+}
+
+bool deflate_stream::write(const uint8_t* data, size_t size, const stream_write_fn_t& sink) {
+    return compress(data, size, false, sink);
+}
+
+bool deflate_stream::finish(const stream_write_fn_t& sink) {
+    return compress(nullptr, 0U, true, sink);
+}
+
+bool deflate_stream::compress(const uint8_t* data, size_t size, bool finish, const stream_write_fn_t& sink) {
+    m_sink = &sink;
+
+    tdefl_status status = tdefl_compress_buffer(m_compressor.get(), data, size, finish ? TDEFL_FINISH : TDEFL_NO_FLUSH);
+
+    m_sink = nullptr;
+
+    return finish ? status == TDEFL_STATUS_DONE : status == TDEFL_STATUS_OKAY;
+}
+
+int deflate_stream::get_flags(const dpf_compression& compression) {
+    int strategy = MZ_DEFAULT_STRATEGY;
+
+    switch (compression.strategy) {
+        case dpf_deflate_strategy::filtered:     strategy = MZ_FILTERED;     break;
+        case dpf_deflate_strategy::huffman_only: strategy = MZ_HUFFMAN_ONLY; break;
+        case dpf_deflate_strategy::rle:          strategy = MZ_RLE;          break;
+        case dpf_deflate_strategy::fixed:        strategy = MZ_FIXED;        break;
+        default: break;
+    }
+
+    int level = compression.level < 0 ? MZ_DEFAULT_LEVEL : std::min(compression.level, (int)MZ_UBER_COMPRESSION);
+
+    return (int)tdefl_create_comp_flags_from_zip_params(level, MZ_DEFAULT_WINDOW_BITS, strategy);
+}
+
+int deflate_stream::put_buf(const void* buf, int len, void* user) {
+    auto stream = static_cast<deflate_stream*>(user);
+
+    (*stream->m_sink)(static_cast<const uint8_t*>(buf), static_cast<size_t>(len));
+    return MZ_TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// INFLATE
+
+inflate_stream::inflate_stream(const std::vector<uint8_t>& dictionary)
+    : m_decompressor(tinfl_decompressor_alloc(), [](tinfl_decompressor* ptr) { tinfl_decompressor_free(ptr); }),
+      m_dict(TINFL_LZ_DICT_SIZE)
+{
+    if (!m_decompressor)
+        throw std::bad_alloc();
+
+    if (dictionary.size() > m_dict.size())
+        throw std::invalid_argument("Dictionary is larger than the deflate window.");
+
+    tinfl_init(m_decompressor.get());
+
+    // Preset dictionary is placed in the window as if it was already decompressed
+
+    std::copy(dictionary.begin(), dictionary.end(), m_dict.begin());
+
+    m_dict_offset = dictionary.size() & (m_dict.size() - 1);
+    m_raw         = !dictionary.empty();
+}
+
+inflate_stream::~inflate_stream() {}
+
+bool inflate_stream::write(const uint8_t* data, size_t size, bool has_more, const stream_write_fn_t& sink) {
+    if (m_done)
+        return size == 0U;
+
+    mz_uint32 flags  = (m_raw ? 0 : TINFL_FLAG_PARSE_ZLIB_HEADER) | (has_more ? TINFL_FLAG_HAS_MORE_INPUT : 0);
+    size_t    offset = 0U;
+
+    while (true) {
+        size_t in_size  = size - offset;
+        size_t out_size = m_dict.size() - m_dict_offset;
+
+        tinfl_status status = tinfl_decompress(m_decompressor.get(), data + offset, &in_size,
+            m_dict.data(), m_dict.data() + m_dict_offset, &out_size, flags);
+
+        offset += in_size;
+
+        if (out_size)
+            sink(m_dict.data() + m_dict_offset, out_size);
+
+        m_dict_offset = (m_dict_offset + out_size) & (m_dict.size() - 1);
+
+        if (status < TINFL_STATUS_DONE)
+            return false;
+
+        if (status == TINFL_STATUS_DONE) {
+            m_done = true;
+            return offset == size;
+        }
+
+        if (status == TINFL_STATUS_NEEDS_MORE_INPUT)
+            return has_more;
+    }
+}
+
+bool inflate_stream::is_done() const {
+    return m_done;
+}
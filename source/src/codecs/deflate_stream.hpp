@@ -0,0 +1,111 @@
+#pragma once
+
+#include "libdpf/misc/dpf_compression.hpp"
+
+#include <miniz\miniz.h>
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+namespace libdpf {
+    /*
+        Receives a block of output bytes.
+    */
+    using stream_write_fn_t = std::function<void(const uint8_t* data, size_t size)>;
+
+    /*
+        Incremental zlib stream compression on top of miniz tdefl.
+        Output is handed to the sink as it is produced.
+
+        With a preset dictionary the output is a raw deflate stream that starts
+        with the dictionary already in the window. It can only be decompressed
+        by an inflate_stream with the same dictionary.
+    */
+    class deflate_stream {
+    public:
+        deflate_stream(const dpf_compression& compression = {}, const std::vector<uint8_t>& dictionary = {});
+        deflate_stream(const deflate_stream&) = delete;
+        deflate_stream(deflate_stream&&)      = default;
+        ~deflate_stream();
+
+        deflate_stream& operator=(const deflate_stream&) = delete;
+        deflate_stream& operator=(deflate_stream&&)      = default;
+
+    public:
+        /*
+            Start a new stream, keeping the allocated state.
+        */
+        void reset(const dpf_compression& compression = {}, const std::vector<uint8_t>& dictionary = {});
+
+        /*
+            Compress a block of input.
+
+            @returns TRUE on success, FALSE on failure
+        */
+        bool write(const uint8_t* data, size_t size, const stream_write_fn_t& sink);
+
+        /*
+            Flush remaining output and end the stream.
+
+            @returns TRUE on success, FALSE on failure
+        */
+        bool finish(const stream_write_fn_t& sink);
+
+        /*
+            Get tdefl flags for compression settings.
+        */
+        static int get_flags(const dpf_compression& compression);
+
+        /*
+            Largest usable preset dictionary, the size of the deflate window.
+        */
+        static constexpr size_t max_dictionary_size = 32768U;
+
+    private:
+        std::unique_ptr<tdefl_compressor, void(*)(tdefl_compressor*)> m_compressor;
+        const stream_write_fn_t*                                       m_sink = nullptr;
+
+    private:
+        bool compress(const uint8_t* data, size_t size, bool finish, const stream_write_fn_t& sink);
+
+        static int put_buf(const void* buf, int len, void* user);
+    };
+
+    /*
+        Incremental zlib stream decompression on top of miniz tinfl.
+        Memory use is bounded by the 32 KB deflate window.
+    */
+    class inflate_stream {
+    public:
+        inflate_stream(const std::vector<uint8_t>& dictionary = {});
+        inflate_stream(const inflate_stream&) = delete;
+        inflate_stream(inflate_stream&&)      = default;
+        ~inflate_stream();
+
+        inflate_stream& operator=(const inflate_stream&) = delete;
+        inflate_stream& operator=(inflate_stream&&)      = default;
+
+    public:
+        /*
+            Decompress a block of input.
+            `has_more` must be FALSE for the last block of the stream.
+
+            @returns TRUE on success, FALSE on corrupt input
+        */
+        bool write(const uint8_t* data, size_t size, bool has_more, const stream_write_fn_t& sink);
+
+        /*
+            @returns TRUE if the end of the stream was reached
+        */
+        bool is_done() const;
+
+    private:
+        std::unique_ptr<tinfl_decompressor, void(*)(tinfl_decompressor*)> m_decompressor;
+        std::vector<uint8_t>                                             m_dict;
+        size_t                                                           m_dict_offset = 0U;
+        bool                                                             m_done        = false;
+        bool                                                             m_raw         = false;
+    };
+}
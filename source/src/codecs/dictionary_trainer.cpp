@@ -0,0 +1,147 @@
+#include "codecs/dictionary_trainer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <queue>
+
+#define TRAINER_KMER_SIZE    8U
+#define TRAINER_SEGMENT_SIZE 64U
+#define TRAINER_STEP         16U
+#define TRAINER_TABLE_BITS   20U
+
+using namespace libdpf;
+
+///////////////////////////////////////////////////////////////////////////////
+// INTERNAL
+
+static uint32_t internal_kmer_hash(const uint8_t* data) {
+    uint64_t value = 0U;
+    std::memcpy(&value, data, TRAINER_KMER_SIZE);
+
+    return (uint32_t)((value * 0x9E3779B97F4A7C15ULL) >> (64U - TRAINER_TABLE_BITS));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// PUBLIC
+
+void dictionary_trainer::add(const uint8_t* data, size_t size) {
+    m_offsets.push_back(m_samples.size());
+    m_samples.insert(m_samples.end(), data, data + size);
+}
+
+void dictionary_trainer::train(size_t max_size, std::vector<uint8_t>& dictionary) const {
+    dictionary.clear();
+
+    // Count the number of samples each substring appears in.
+    // Substrings are hashed into a fixed-size table, collisions only skew the scores.
+
+    std::vector<uint32_t> counts(1U << TRAINER_TABLE_BITS, 0U);
+    std::vector<uint32_t> last(1U << TRAINER_TABLE_BITS, 0U);
+
+    for (size_t s = 0; s < m_offsets.size(); s++) {
+        size_t begin = m_offsets[s];
+        size_t end   = s + 1 < m_offsets.size() ? m_offsets[s + 1] : m_samples.size();
+
+        for (size_t pos = begin; pos + TRAINER_KMER_SIZE <= end; pos++) {
+            uint32_t hash = internal_kmer_hash(m_samples.data() + pos);
+
+            if (last[hash] != s + 1) {
+                last[hash] = (uint32_t)(s + 1);
+                counts[hash]++;
+            }
+        }
+    }
+
+    // Candidate segments overlap by TRAINER_SEGMENT_SIZE - TRAINER_STEP bytes
+
+    struct segment_t {
+        size_t offset;
+        size_t size;
+    };
+
+    std::vector<segment_t> segments;
+
+    for (size_t s = 0; s < m_offsets.size(); s++) {
+        size_t begin = m_offsets[s];
+        size_t end   = s + 1 < m_offsets.size() ? m_offsets[s + 1] : m_samples.size();
+
+        for (size_t pos = begin; pos + TRAINER_KMER_SIZE <= end; pos += TRAINER_STEP)
+            segments.push_back({ pos, std::min<size_t>(TRAINER_SEGMENT_SIZE, end - pos) });
+    }
+
+    std::vector<bool>     covered(counts.size(), false);
+    std::vector<uint32_t> hashes;
+
+    auto get_hashes = [&](const segment_t& segment) {
+        hashes.clear();
+
+        for (size_t pos = 0; pos + TRAINER_KMER_SIZE <= segment.size; pos++)
+            hashes.push_back(internal_kmer_hash(m_samples.data() + segment.offset + pos));
+
+        std::sort(hashes.begin(), hashes.end());
+        hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+    };
+
+    // Substrings found in a single sample don't help
+    auto get_score = [&](const segment_t& segment) {
+        uint64_t score = 0U;
+
+        get_hashes(segment);
+
+        for (uint32_t hash : hashes) {
+            if (!covered[hash] && counts[hash] > 1U)
+                score += counts[hash];
+        }
+
+        return score;
+    };
+
+    // Lazy greedy selection, scores only go down as substrings get covered
+
+    std::priority_queue<std::pair<uint64_t, size_t>> queue;
+
+    for (size_t i = 0; i < segments.size(); i++) {
+        uint64_t score = get_score(segments[i]);
+
+        if (score)
+            queue.push({ score, i });
+    }
+
+    std::vector<size_t> picked;
+    size_t              picked_size = 0U;
+
+    while (!queue.empty() && picked_size < max_size) {
+        auto [score, index] = queue.top();
+        queue.pop();
+
+        uint64_t current = get_score(segments[index]);
+
+        if (!current)
+            continue;
+
+        if (!queue.empty() && current < queue.top().first) {
+            queue.push({ current, index });
+            continue;
+        }
+
+        for (uint32_t hash : hashes)
+            covered[hash] = true;
+
+        picked.push_back(index);
+        picked_size += segments[index].size;
+    }
+
+    // Best segments last, trimmed from the front
+
+    for (auto it = picked.rbegin(); it != picked.rend(); it++) {
+        const segment_t& segment = segments[*it];
+        dictionary.insert(dictionary.end(), m_samples.begin() + segment.offset, m_samples.begin() + segment.offset + segment.size);
+    }
+
+    if (dictionary.size() > max_size)
+        dictionary.erase(dictionary.begin(), dictionary.begin() + (dictionary.size() - max_size));
+}
+
+size_t dictionary_trainer::size() const {
+    return m_samples.size();
+}
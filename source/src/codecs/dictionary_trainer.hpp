@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace libdpf {
+    /*
+        Builds a preset deflate dictionary from sample content.
+
+        Picks the segments that cover the most substrings shared between samples,
+        in the style of the zstd COVER trainer. The most useful segments are placed
+        at the end of the dictionary, closest to the data.
+    */
+    class dictionary_trainer {
+    public:
+        /*
+            Add a sample.
+        */
+        void add(const uint8_t* data, size_t size);
+
+        /*
+            Build a dictionary of at most `max_size` bytes.
+            Empty if the samples don't share anything.
+        */
+        void train(size_t max_size, std::vector<uint8_t>& dictionary) const;
+
+        /*
+            Total size of all samples.
+        */
+        size_t size() const;
+
+    private:
+        std::vector<uint8_t> m_samples;
+        std::vector<size_t>  m_offsets;
+    };
+}
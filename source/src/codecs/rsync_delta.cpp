@@ -0,0 +1,425 @@
+#include "codecs/rsync_delta.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#define RSYNC_MIN_BLOCK_SIZE  2048U
+#define RSYNC_MAX_BLOCK_SIZE  (64U * 1024U)
+#define RSYNC_MAX_LITERAL     (1024U * 1024U)
+#define RSYNC_READ_SIZE       (1024U * 1024U)
+
+using namespace libdpf;
+
+///////////////////////////////////////////////////////////////////////////////
+// INTERNAL
+
+// Adler-style checksum that can be rolled one byte at a time
+struct rsync_weak {
+    uint32_t a = 0U;
+    uint32_t b = 0U;
+
+    void init(const uint8_t* data, size_t size) {
+        a = b = 0U;
+
+        for (size_t i = 0; i < size; i++) {
+            a += data[i];
+            b += (uint32_t)(size - i) * data[i];
+        }
+
+        a &= 0xFFFFU;
+        b &= 0xFFFFU;
+    }
+
+    void roll(uint8_t out, uint8_t in, size_t size) {
+        a = (a - out + in) & 0xFFFFU;
+        b = (b - (uint32_t)size * out + a) & 0xFFFFU;
+    }
+
+    uint32_t get() const {
+        return a | (b << 16);
+    }
+};
+
+// Weak and strong hashes of every full block of old content, chained by weak hash
+struct rsync_index {
+    std::vector<uint32_t> weak;
+    std::vector<uint64_t> strong;
+    std::vector<uint32_t> next;
+    std::vector<uint32_t> buckets;
+    uint32_t              shift = 0U;
+
+    static constexpr uint32_t none = 0xFFFFFFFFU;
+
+    void build() {
+        size_t count = 1024U;
+        shift        = 22U;
+
+        while (count < weak.size() * 2U) {
+            count <<= 1;
+            shift--;
+        }
+
+        buckets.assign(count, none);
+        next.assign(weak.size(), none);
+
+        // Insert in reverse so chains start at the lowest block
+
+        for (size_t i = weak.size(); i-- > 0;) {
+            uint32_t bucket = get_bucket(weak[i]);
+
+            next[i]         = buckets[bucket];
+            buckets[bucket] = (uint32_t)i;
+        }
+    }
+
+    uint32_t get_bucket(uint32_t value) const {
+        return (value * 2654435761U) >> shift;
+    }
+};
+
+static uint64_t internal_strong_hash(const uint8_t* data, size_t size) {
+    MD5 md5;
+    md5.add(data, size);
+
+    unsigned char hash[16];
+    md5.getHash(hash);
+
+    uint64_t value = 0U;
+    std::memcpy(&value, hash, sizeof(value));
+
+    return value;
+}
+
+template<typename T>
+static void internal_put(const stream_write_fn_t& sink, T value) {
+    sink((const uint8_t*)&value, sizeof(T));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// PUBLIC
+
+size_t rsync_delta::get_block_size(uint64_t old_size) {
+    uint64_t size = (uint64_t)std::sqrt((double)old_size);
+
+    size = std::clamp<uint64_t>(size, RSYNC_MIN_BLOCK_SIZE, RSYNC_MAX_BLOCK_SIZE);
+
+    return (size_t)(size & ~(uint64_t)1023U);
+}
+
+bool rsync_delta::create(std::istream& old_stream, uint64_t old_size, std::istream& new_stream, uint64_t new_size,
+    const stream_write_fn_t& sink)
+{
+    size_t               block_size = get_block_size(old_size);
+    rsync_index          index;
+    std::vector<uint8_t> buffer(std::max<size_t>(block_size, RSYNC_MAX_LITERAL + block_size + RSYNC_READ_SIZE));
+
+    // Index old content
+
+    for (uint64_t offset = 0U; offset + block_size <= old_size; offset += block_size) {
+        old_stream.read((char*)buffer.data(), block_size);
+
+        if ((size_t)old_stream.gcount() != block_size)
+            return false;
+
+        rsync_weak weak;
+        weak.init(buffer.data(), block_size);
+
+        index.weak.push_back(weak.get());
+        index.strong.push_back(internal_strong_hash(buffer.data(), block_size));
+    }
+
+    index.build();
+
+    internal_put(sink, old_size);
+    internal_put(sink, new_size);
+
+    // Scan new content
+
+    MD5      md5;
+    uint64_t copy_offset = 0U;
+    uint64_t copy_size   = 0U;
+    uint64_t total_size  = 0U;
+
+    auto flush_copy = [&] {
+        if (!copy_size)
+            return;
+
+        internal_put(sink, op::copy);
+        internal_put(sink, copy_offset);
+        internal_put(sink, copy_size);
+
+        copy_size = 0U;
+    };
+
+    auto put_literal = [&](const uint8_t* data, size_t size) {
+        if (!size)
+            return;
+
+        flush_copy();
+
+        internal_put(sink, op::literal);
+        internal_put(sink, (uint64_t)size);
+        sink(data, size);
+
+        md5.add(data, size);
+        total_size += size;
+    };
+
+    auto put_copy = [&](uint64_t offset, const uint8_t* data) {
+        if (copy_size && copy_offset + copy_size == offset) {
+            copy_size += block_size;
+        }
+        else {
+            flush_copy();
+
+            copy_offset = offset;
+            copy_size   = block_size;
+        }
+
+        md5.add(data, block_size);
+        total_size += block_size;
+    };
+
+    // Find a block matching the window, preferring one that continues the pending copy
+    auto find_block = [&](uint32_t weak, const uint8_t* data) -> uint32_t {
+        uint32_t match  = rsync_index::none;
+        uint64_t strong = 0U;
+        bool     hashed = false;
+
+        for (uint32_t i = index.buckets[index.get_bucket(weak)]; i != rsync_index::none; i = index.next[i]) {
+            if (index.weak[i] != weak)
+                continue;
+
+            if (!hashed) {
+                strong = internal_strong_hash(data, block_size);
+                hashed = true;
+            }
+
+            if (index.strong[i] != strong)
+                continue;
+
+            if (copy_size && copy_offset + copy_size == (uint64_t)i * block_size)
+                return i;
+
+            if (match == rsync_index::none)
+                match = i;
+        }
+
+        return match;
+    };
+
+    size_t     start  = 0U;
+    size_t     pos    = 0U;
+    size_t     end    = 0U;
+    bool       eof    = false;
+    bool       rolled = false;
+    rsync_weak weak;
+
+    while (true) {
+        if (end - pos < block_size + 1U && !eof) {
+            // Drop consumed bytes and refill
+
+            std::memmove(buffer.data(), buffer.data() + start, end - start);
+
+            pos -= start;
+            end -= start;
+            start = 0U;
+
+            new_stream.read((char*)buffer.data() + end, buffer.size() - end);
+
+            if (new_stream.bad())
+                return false;
+
+            end += (size_t)new_stream.gcount();
+            eof  = !new_stream;
+
+            continue;
+        }
+
+        if (end - pos < block_size)
+            break;
+
+        if (!rolled) {
+            weak.init(buffer.data() + pos, block_size);
+            rolled = true;
+        }
+
+        uint32_t block = find_block(weak.get(), buffer.data() + pos);
+
+        if (block != rsync_index::none) {
+            put_literal(buffer.data() + start, pos - start);
+            put_copy((uint64_t)block * block_size, buffer.data() + pos);
+
+            pos   += block_size;
+            start  = pos;
+            rolled = false;
+
+            continue;
+        }
+
+        if (pos - start >= RSYNC_MAX_LITERAL) {
+            put_literal(buffer.data() + start, pos - start);
+            start = pos;
+        }
+
+        if (end - pos < block_size + 1U)
+            break;
+
+        weak.roll(buffer[pos], buffer[pos + block_size], block_size);
+        pos++;
+    }
+
+    put_literal(buffer.data() + start, end - start);
+    flush_copy();
+
+    if (total_size != new_size)
+        return false;
+
+    unsigned char hash[16];
+    md5.getHash(hash);
+
+    internal_put(sink, op::end);
+    sink(hash, sizeof(hash));
+
+    return true;
+}
+
+rsync_apply::rsync_apply(std::istream& old_stream, uint64_t old_size, std::ostream& new_stream)
+    : m_old(old_stream), m_new(new_stream), m_old_size(old_size) {}
+
+bool rsync_apply::write(const uint8_t* data, size_t size) {
+    while (size && m_state != state::failed) {
+        switch (m_state) {
+            case state::header: {
+                uint64_t field[2];
+
+                if (!get_field(data, size, (uint8_t*)field, sizeof(field)))
+                    break;
+
+                m_new_size = field[1];
+                m_state    = field[0] == m_old_size ? state::op : state::failed;
+                break;
+            }
+            case state::op: {
+                switch ((rsync_delta::op)*data) {
+                    case rsync_delta::op::copy:    m_state = state::copy;         break;
+                    case rsync_delta::op::literal: m_state = state::literal_size; break;
+                    case rsync_delta::op::end:     m_state = state::end;          break;
+                    default:                       m_state = state::failed;       break;
+                }
+
+                data++;
+                size--;
+                break;
+            }
+            case state::copy: {
+                uint64_t field[2];
+
+                if (!get_field(data, size, (uint8_t*)field, sizeof(field)))
+                    break;
+
+                m_state = copy(field[0], field[1]) ? state::op : state::failed;
+                break;
+            }
+            case state::literal_size: {
+                if (!get_field(data, size, (uint8_t*)&m_literal, sizeof(m_literal)))
+                    break;
+
+                if (m_literal > m_new_size - m_written)
+                    m_state = state::failed;
+                else
+                    m_state = m_literal ? state::literal : state::op;
+
+                break;
+            }
+            case state::literal: {
+                size_t count = (size_t)std::min<uint64_t>(m_literal, size);
+
+                put(data, count);
+
+                data      += count;
+                size      -= count;
+                m_literal -= count;
+
+                if (!m_literal)
+                    m_state = state::op;
+
+                break;
+            }
+            case state::end: {
+                unsigned char expected[16];
+                unsigned char hash[16];
+
+                if (!get_field(data, size, expected, sizeof(expected)))
+                    break;
+
+                m_md5.getHash(hash);
+
+                bool match = m_written == m_new_size && std::memcmp(hash, expected, sizeof(hash)) == 0;
+
+                m_state = match ? state::done : state::failed;
+                break;
+            }
+            default:
+                // Trailing bytes after the end
+                m_state = state::failed;
+                break;
+        }
+    }
+
+    return m_state != state::failed && m_new.good();
+}
+
+bool rsync_apply::is_done() const {
+    return m_state == state::done;
+}
+
+uint64_t rsync_apply::size() const {
+    return m_written;
+}
+
+bool rsync_apply::get_field(const uint8_t*& data, size_t& size, uint8_t* field, size_t field_size) {
+    size_t count = std::min(field_size - m_field.size(), size);
+
+    m_field.insert(m_field.end(), data, data + count);
+
+    data += count;
+    size -= count;
+
+    if (m_field.size() < field_size)
+        return false;
+
+    std::memcpy(field, m_field.data(), field_size);
+    m_field.clear();
+
+    return true;
+}
+
+bool rsync_apply::copy(uint64_t offset, uint64_t size) {
+    if (offset > m_old_size || size > m_old_size - offset || size > m_new_size - m_written)
+        return false;
+
+    m_block.resize(RSYNC_READ_SIZE);
+    m_old.seekg(offset, std::ios::beg);
+
+    while (size) {
+        size_t count = (size_t)std::min<uint64_t>(size, m_block.size());
+
+        m_old.read((char*)m_block.data(), count);
+
+        if ((size_t)m_old.gcount() != count)
+            return false;
+
+        put(m_block.data(), count);
+        size -= count;
+    }
+
+    return true;
+}
+
+void rsync_apply::put(const uint8_t* data, size_t size) {
+    m_new.write((const char*)data, size);
+    m_md5.add(data, size);
+    m_written += size;
+}
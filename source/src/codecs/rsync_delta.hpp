@@ -0,0 +1,102 @@
+#pragma once
+
+#include "codecs/deflate_stream.hpp"
+
+#include <md5\md5.hpp>
+
+#include <istream>
+#include <ostream>
+#include <vector>
+#include <cstdint>
+
+namespace libdpf {
+    /*
+        Block matching delta in the style of rsync, for files too large to diff in memory.
+
+        Old content is split into fixed-size blocks indexed by a rolling weak hash and
+        a truncated MD5. New content is scanned a byte at a time and encoded as copies of
+        old content and literals. Memory use is bounded by the block index (~24 bytes per block)
+        and a few MB of buffers.
+
+        Delta layout (uncompressed, all numbers little endian):
+            uint64_t old_size
+            uint64_t new_size
+            repeated:
+                uint8_t op
+                    copy    -> uint64_t offset, uint64_t size
+                    literal -> uint64_t size, uint8_t data[size]
+                    end     -> uint8_t new_md5[16]
+    */
+    class rsync_delta {
+    public:
+        enum class op : uint8_t {
+            copy    = 0,
+            literal = 1,
+            end     = 2
+        };
+
+    public:
+        /*
+            Create a delta that turns old content into new content.
+            Both streams are read sequentially.
+
+            @returns TRUE on success, FALSE if reading failed
+        */
+        static bool create(std::istream& old_stream, uint64_t old_size, std::istream& new_stream, uint64_t new_size,
+            const stream_write_fn_t& sink);
+
+        /*
+            Get the block size used for old content of `old_size` bytes.
+        */
+        static size_t get_block_size(uint64_t old_size);
+    };
+
+    /*
+        Incremental rsync_delta decoder.
+        Copies are read from the old stream, output is written sequentially.
+    */
+    class rsync_apply {
+    public:
+        rsync_apply() = delete;
+        rsync_apply(std::istream& old_stream, uint64_t old_size, std::ostream& new_stream);
+
+    public:
+        /*
+            Decode a block of delta.
+
+            @returns TRUE on success, FALSE if the delta is corrupt or doesn't match the old content
+        */
+        bool write(const uint8_t* data, size_t size);
+
+        /*
+            @returns TRUE if the end of the delta was reached and the output matched
+        */
+        bool is_done() const;
+
+        /*
+            Number of bytes written so far.
+        */
+        uint64_t size() const;
+
+    private:
+        enum class state : uint8_t {
+            header, op, copy, literal_size, literal, end, done, failed
+        };
+
+        std::istream&        m_old;
+        std::ostream&        m_new;
+        uint64_t             m_old_size = 0U;
+        uint64_t             m_new_size = 0U;
+        uint64_t             m_written  = 0U;
+        uint64_t             m_literal  = 0U;
+        state                m_state    = state::header;
+        std::vector<uint8_t> m_field;
+        std::vector<uint8_t> m_block;
+        MD5                  m_md5;
+
+    private:
+        bool get_field(const uint8_t*& data, size_t& size, uint8_t* field, size_t field_size);
+        bool copy(uint64_t offset, uint64_t size);
+        void put(const uint8_t* data, size_t size);
+    };
+}
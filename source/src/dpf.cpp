@@ -1,43 +1,405 @@
 #include "libdpf/dpf.hpp"
+#include "libdpf/dpf_writer.hpp"
 #include "misc/dpf_context_internal.hpp"
+#include "misc/dpf_format.hpp"
 #include "utilities/binread.hpp"
+#include "utilities/binwrite.hpp"
+#include "utilities/parallel.hpp"
+#include "utilities/pipeline.hpp"
+#include "utilities/memory_budget.hpp"
+#include "codecs/deflate_stream.hpp"
+#include "codecs/compressibility.hpp"
+#include "codecs/bsdiff.hpp"
+#include "codecs/rsync_delta.hpp"
+#include "codecs/dictionary_trainer.hpp"
 
 #include <thread>
 #include <fstream>
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <map>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 #include <miniz\miniz.h>
 #include <md5\md5.hpp>
 
-#define DPF_VERSION 0x0001
+#define DPF_STREAM_BLOCK_SIZE (1024U * 1024U)
+#define DPF_NO_REFERENCE      UINT64_MAX
+#define DPF_NO_SIZE           UINT64_MAX
+#define DPF_OUTPUT_BUFFER     (1024U * 1024U)
+#define DPF_PIPELINE_DEPTH    4U
+#define DPF_DELTA_MEMORY      13U
+#define DPF_TRAINER_SAMPLES   (4U * 1024U * 1024U)
 
 using namespace libdpf;
 
 ///////////////////////////////////////////////////////////////////////////////
 // INTERNAL
 
-struct dpf_header {
-    char     magic[4]      = { 0, 0, 0, 0 };
-    uint16_t dpf_version   = DPF_VERSION;
-    char     checksum[16]  = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
-    uint64_t patch_version = 0U;
-    uint64_t file_count    = 0U;
+struct dpf_create_entry {
+    dpf_file_header      header;
+    std::vector<uint8_t> buffer;
+    dpf_result           result;
+    dpf_compression      compression   = {};
+    dpf::FILE_PATH       stream_source = "";
+    dpf::FILE_PATH       original      = "";
+
+    // Compressed content cache key, empty if not cached
+    std::string          cache_key     = "";
+
+    // Bytes acquired from the memory budget, released once written
+    uint64_t             memory        = 0U;
+
+    // Headers of the solid block members that follow this entry
+    std::vector<dpf_file_header> members;
+};
+
+using dpf_md5 = std::array<unsigned char, 16>;
+
+struct dpf_md5_hash {
+    size_t operator()(const dpf_md5& value) const {
+        size_t hash = 0U;
+        std::memcpy(&hash, value.data(), sizeof(hash));
+        return hash;
+    }
+};
+
+struct dpf_create_job {
+    std::vector<size_t> files;
+    bool                solid = false;
+};
+
+struct dpf_tree_entry {
+    std::string                     path;
+    uint64_t                        size = 0U;
+    std::filesystem::file_time_type time;
+};
+
+struct dpf_solid_block {
+    std::vector<uint8_t>  buffer;
+    std::vector<uint64_t> offsets;
+    size_t                next = 0U;
+};
+
+// Paths of a path table, decoded into one buffer
+struct dpf_path_table {
+    std::string         arena;
+    std::vector<size_t> ends;
+
+    size_t size() const {
+        return ends.size();
+    }
+
+    std::string_view get(size_t i) const {
+        size_t start = i ? ends[i - 1U] : 0U;
+        return std::string_view(arena).substr(start, ends[i] - start);
+    }
+};
+
+struct dpf_patch_state {
+    std::vector<uint8_t>        compressed_buffer;
+    std::vector<uint8_t>        decompressed_buffer;
+    std::vector<dpf::FILE_PATH> targets;
+    dpf_solid_block             solid_block;
+
+    // Expected CRC-32 of every entry, empty without DPF_FEATURE_CHECKSUMS
+    std::vector<uint32_t>       checksums;
+    size_t                      entry = 0U;
+
+    // Paths of entries that leave them to the path table
+    dpf_path_table              paths;
+};
+
+// Entry read ahead when patching pipelined, content is only read for buffered entries
+struct dpf_patch_item {
+    dpf_file_header      header;
+    std::vector<uint8_t> content;
+    bool                 buffered = false;
+    bool                 corrupt  = false;
+    uint64_t             memory   = 0U;
+};
+
+struct dpf_patch_output {
+    dpf::FILE_PATH       file;
+    std::vector<uint8_t> content;
+    uint64_t             memory = 0U;
+};
+
+// Input content read ahead when creating pipelined
+using dpf_prefetch = std::optional<std::vector<uint8_t>>;
+
+// Entry content, split in chunks when its size isn't known up front
+struct dpf_content_sink {
+    binwrite&            binw;
+    bool                 chunked = false;
+    uint64_t             size    = 0U;
+    std::vector<uint8_t> chunk;
+
+    dpf_content_sink(binwrite& binw, bool chunked)
+        : binw(binw), chunked(chunked) {}
+
+    void write(const uint8_t* data, size_t length) {
+        size += length;
+
+        if (!chunked) {
+            binw.write_bytes(data, length);
+            return;
+        }
+
+        chunk.insert(chunk.end(), data, data + length);
+
+        if (chunk.size() >= DPF_STREAM_BLOCK_SIZE)
+            write_chunk();
+    }
+
+    void finish() {
+        if (!chunked)
+            return;
+
+        write_chunk();
+        binw.write_num((uint32_t)0U);
+    }
+
+    void write_chunk() {
+        if (chunk.empty())
+            return;
+
+        binw.write_num((uint32_t)chunk.size());
+        binw.write_bytes(chunk.data(), chunk.size());
+        chunk.clear();
+    }
+};
+
+// Entry content of compressed_size bytes, or chunks
+struct dpf_content_source {
+    binread& binr;
+    bool     chunked   = false;
+    uint64_t remaining = 0U;
+    bool     end       = false;
+
+    dpf_content_source(binread& binr, const dpf_file_header& header)
+        : binr(binr), chunked(header.compressed_size == DPF_CHUNKED_SIZE), remaining(chunked ? 0U : header.compressed_size) {}
+
+    bool has_more() {
+        if (chunked && !end && remaining == 0U) {
+            remaining = binr.read_num<uint32_t>();
+            end       = remaining == 0U;
+        }
+
+        return remaining != 0U;
+    }
+
+    size_t read(uint8_t* data, size_t size) {
+        if (!has_more())
+            return 0U;
+
+        size = (size_t)std::min<uint64_t>(size, remaining);
+
+        binr.read_bytes((char*)data, size);
+        remaining -= size;
+
+        return size;
+    }
+
+    void skip() {
+        while (has_more()) {
+            binr.seek((size_t)remaining);
+            remaining = 0U;
+        }
+    }
+};
+
+// Where the entries end and what follows them, see dpf_segment and dpf_index_record
+struct dpf_tail {
+    uint64_t                 content_end = 0U;
+    uint64_t                 index_end   = 0U;
+    std::vector<dpf_segment> segments;
+};
+
+static bool internal_read_path_table(const uint8_t* data, size_t size, uint64_t count, dpf_path_table& paths);
+
+// Index read into memory, records are parsed when needed
+struct dpf_index_view {
+    const std::vector<uint8_t>& data;
+    uint64_t                    count  = 0U;
+    size_t                      sorted = 0U;
+    dpf_path_table              paths;
+
+    dpf_index_view(const std::vector<uint8_t>& data)
+        : data(data) {}
+
+    bool init() {
+        if (data.size() < 2U * sizeof(uint64_t))
+            return false;
+
+        std::memcpy(&count, data.data() + data.size() - sizeof(uint64_t), sizeof(count));
+
+        size_t size = data.size() - 2U * sizeof(uint64_t);
+
+        if (count > size / (dpf_index_record::size + sizeof(uint64_t)))
+            return false;
+
+        size_t records_size = (size_t)count * dpf_index_record::size;
+        sorted              = size - (size_t)count * sizeof(uint64_t);
+
+        return internal_read_path_table(data.data() + records_size, sorted - records_size, count, paths);
+    }
+
+    /*
+        Parse record i.
+    */
+    bool get_record(size_t i, dpf_index_record& record) const {
+        if (i >= count)
+            return false;
+
+        const uint8_t* ptr = data.data() + i * dpf_index_record::size;
+
+        record.op       = (dpf_op)ptr[0];
+        record.encoding = (dpf_encoding)ptr[1];
+
+        std::memcpy(&record.decompressed_size, ptr + 2U, sizeof(uint64_t));
+        std::memcpy(&record.compressed_size, ptr + 2U + sizeof(uint64_t), sizeof(uint64_t));
+        std::memcpy(&record.offset, ptr + 2U + 2U * sizeof(uint64_t), sizeof(uint64_t));
+        std::memcpy(&record.checksum, ptr + 2U + 3U * sizeof(uint64_t), sizeof(uint32_t));
+
+        record.file_path = paths.get(i);
+        return true;
+    }
+
+    /*
+        Number of the record at position i in path order, count if invalid.
+    */
+    size_t get_sorted(size_t i) const {
+        uint64_t number = 0U;
+        std::memcpy(&number, data.data() + sorted + i * sizeof(uint64_t), sizeof(number));
+
+        return (size_t)std::min<uint64_t>(number, count);
+    }
 };
 
-struct dpf_file_header {
-    dpf_op      op                = dpf_op::undefined;
-    uint64_t    file_path_size    = 0U;
-    std::string file_path         = "";
-    uint64_t    decompressed_size = 0U;
-    uint64_t    compressed_size   = 0U;
+// Entries are hashed as they're written, the header is updated on close
+struct dpf_writer::state {
+    std::vector<char>    fout_buffer;
+    std::fstream         fout;
+    binwrite             binw;
+    dpf_context_internal context;
+    dpf::FILE_PATH       file;
+    dpf_header           header;
+    dpf_compression      compression;
+    bool                 failed = false;
+
+    std::vector<dpf_index_record> index;
+
+    state(dpf_context* context)
+        : fout_buffer(DPF_OUTPUT_BUFFER), binw(fout, dpf_header::size(DPF_VERSION)), context(context) {}
 };
 
 static dpf_result internal_create(dpf_inputs input_files, const dpf::FILE_PATH dpf_file, dpf_context_internal& context);
+static dpf_result internal_create(dpf_inputs input_files, dpf_output& output, dpf_context_internal& context);
+static dpf_result internal_append(dpf_inputs input_files, const dpf::FILE_PATH dpf_file, dpf_context_internal& context);
+static dpf_result internal_prepare_header(dpf_inputs& input_files, dpf_header& header);
+static uint32_t internal_get_features(const dpf_inputs& input_files, const dpf_header& header, uint32_t features);
+static dpf_result internal_create_entries(const dpf_inputs& input_files, const dpf_header& header, uint64_t first_entry, binwrite& binw,
+    std::vector<dpf_index_record>& index, dpf_context_internal& context);
+static dpf_result internal_prepare_entry(dpf_file_mod input_file, uint64_t file_size, dpf_prefetch& prefetched,
+    const dpf_inputs& input_files, dpf_context_internal& context, dpf_create_entry& entry);
+static dpf_result internal_prepare_reference(dpf_file_mod input_file, uint64_t file_size, const dpf_inputs& input_files,
+    uint64_t reference, dpf_create_entry& entry);
+static void internal_get_sizes(const dpf_inputs& input_files, std::vector<uint64_t>& sizes);
+static void internal_find_duplicates(const dpf_inputs& input_files, const std::vector<uint64_t>& sizes,
+    dpf_context_internal& context, std::vector<uint64_t>& references);
+static void internal_plan_jobs(const dpf_inputs& input_files, const std::vector<uint64_t>& sizes,
+    const dpf_context_internal& context, std::vector<uint64_t>& references, std::vector<dpf_create_job>& jobs);
+static uint64_t internal_get_memory_cost(const dpf_create_job& job, const dpf_inputs& input_files,
+    const std::vector<uint64_t>& sizes, const std::vector<uint64_t>& references, const dpf_context_internal& context);
+static uint64_t internal_get_delta_max_size(const dpf_inputs& input_files, const dpf_context_internal& context);
+static dpf_result internal_prepare_solid(const std::vector<size_t>& files, const dpf_inputs& input_files,
+    dpf_context_internal& context, dpf_create_entry& entry);
+static void internal_write_header(binwrite& binw, const dpf_header& header);
+static size_t internal_get_header_size(const dpf_header& header);
+static void internal_write_tail(binwrite& binw, dpf_header& header, const std::vector<dpf_index_record>& index,
+    std::vector<dpf_segment>& segments);
+static void internal_write_index(binwrite& binw, const std::vector<dpf_index_record>& index, uint64_t index_offset);
+static dpf_result internal_read_tail(binread& binr, const dpf_header& header, dpf_tail& tail);
+static dpf_result internal_read_index(binread& binr, const dpf_header& header, const dpf_tail& tail,
+    std::vector<uint8_t>& index);
+static dpf_result internal_load_index(const dpf::FILE_PATH& dpf_file, std::vector<uint8_t>& index);
+static bool internal_get_records(const std::vector<uint8_t>& index, std::vector<dpf_index_record>& records);
+static bool internal_find_record(const std::vector<uint8_t>& index, const std::string& path, dpf_index_record& record);
+static void internal_get_checksum(const dpf_header& header, const std::vector<uint8_t>& tail, char* checksum);
+static bool internal_get_entry_checksums(const dpf::FILE_PATH& file, std::vector<dpf_index_record>& records,
+    size_t first, size_t last, uint64_t end);
+static bool internal_check_entries(const dpf::FILE_PATH& file, const dpf_header& header, const dpf_tail& tail,
+    std::vector<dpf_index_record>& records);
+static bool internal_check_entry(binread& binr, const dpf_patch_state& state);
+static void internal_write_path_table(binwrite& binw, const std::vector<dpf_index_record>& index);
+static void internal_set_path(const dpf_path_table& paths, size_t entry, dpf_file_header& header);
+static bool internal_get_segment_md5(const dpf::FILE_PATH& file, uint64_t start, uint64_t end, unsigned char* md5);
+static dpf_result internal_write_entry(binwrite& binw, const dpf_header& header, const dpf_create_entry& entry,
+    std::vector<dpf_index_record>& index, dpf_context_internal& context);
+static void internal_write_path(binwrite& binw, const dpf_header& header, const std::string& path);
+static bool internal_is_chunked(const dpf_header& header, const dpf_create_entry& entry);
+static dpf_result internal_compress_buffer(const uint8_t* data, size_t size, dpf_create_entry& entry);
+static dpf_result internal_write_generated(binwrite& binw, const dpf_header& header, dpf_file_header& file_header,
+    const dpf_writer::reader_fn_t& reader, const dpf_compression& compression, std::vector<dpf_index_record>& index,
+    dpf_context_internal& context);
+static dpf_result internal_write_streamed(binwrite& binw, const dpf_create_entry& entry, bool chunked, uint64_t& compressed_size,
+    dpf_context_internal& context);
+static dpf_result internal_read_streamed(binread& binr, const dpf_file_header& header, const dpf::FILE_PATH& file,
+    dpf_context_internal& context);
+static dpf_result internal_write_split(const dpf_create_entry& entry, const stream_write_fn_t& sink,
+    dpf_context_internal& context);
+static dpf_result internal_read_split(binread& binr, const dpf_file_header& header, const dpf::FILE_PATH& file,
+    dpf_context_internal& context);
+static size_t internal_get_split_window(const dpf_context_internal& context, uint64_t block_size);
+static dpf_result internal_prepare_delta(const dpf::FILE_PATH& original, const std::vector<uint8_t>& buffer, 
+    dpf_create_entry& entry);
+static dpf_result internal_read_delta(binread& binr, const dpf_file_header& header, const dpf::FILE_PATH& file,
+    const dpf::FILE_PATH& output);
+static dpf_result internal_write_rsync(binwrite& binw, const dpf_create_entry& entry, bool chunked,
+    uint64_t& compressed_size);
+static dpf_result internal_read_rsync(binread& binr, const dpf_file_header& header, const dpf::FILE_PATH& file,
+    const dpf::FILE_PATH& output);
+static dpf_result internal_read_reference(binread& binr, const dpf_file_header& header, const dpf::FILE_PATH& file,
+    const dpf::FILE_PATH& output, const std::vector<dpf::FILE_PATH>& targets);
+static dpf_result internal_read_solid(binread& binr, const dpf_file_header& header, dpf_solid_block& block);
+static dpf_result internal_read_member(const dpf_file_header& header, const dpf::FILE_PATH& file,
+    dpf_solid_block& block, dpf_context_internal& context);
+static dpf_result internal_read_transfer(const dpf_file_header& header, const dpf::DIR_PATH& patch_dir,
+    const dpf::FILE_PATH& file);
+static bool internal_read_file(const dpf::FILE_PATH& file, std::vector<uint8_t>& buffer);
 static dpf_result internal_patch(const dpf::FILE_PATH dpf_file, const dpf::DIR_PATH patch_dir, dpf_context_internal& context);
+static dpf_result internal_patch_serial(binread& binr, const dpf_header& header, const dpf::DIR_PATH& patch_dir,
+    dpf_path_table paths, std::vector<uint32_t> checksums, dpf_context_internal& context);
+static dpf_result internal_patch_pipelined(binread& binr, const dpf_header& header, const dpf::DIR_PATH& patch_dir,
+    dpf_path_table paths, std::vector<uint32_t> checksums, dpf_context_internal& context);
+static dpf_result internal_patch_entry(binread& binr, const dpf_header& header, const dpf_file_header& file_header,
+    const dpf::DIR_PATH& patch_dir, dpf_patch_state& state, dpf_context_internal& context);
+static void internal_get_content_size(binread& binr, const dpf_header& header, uint64_t& size);
+static bool internal_is_buffered(const dpf_file_header& file_header, const dpf_context_internal& context);
+static dpf_result internal_decode_entry(const dpf_header& header, const dpf_file_header& file_header,
+    const dpf::FILE_PATH& file, std::vector<uint8_t>& content, std::vector<uint8_t>& scratch,
+    dpf_context_internal& context);
+static dpf_result internal_write_output(const dpf::FILE_PATH& file, const std::vector<uint8_t>& content);
+static void internal_prefetch(const dpf::FILE_PATH& file, uint64_t file_size, dpf_prefetch& content);
+static dpf_result internal_diff(const dpf::DIR_PATH& old_dir, const dpf::DIR_PATH& new_dir, dpf_inputs& input_files,
+    dpf_context_internal& context);
+static dpf_result internal_walk(const dpf::DIR_PATH& dir, std::vector<dpf_tree_entry>& entries);
+static void internal_find_transfers(const dpf::DIR_PATH& old_dir, const dpf::DIR_PATH& new_dir,
+    const std::vector<dpf_tree_entry>& old_entries, const std::vector<size_t>& removed,
+    const std::vector<std::pair<size_t, const dpf_tree_entry*>>& added, std::vector<dpf_file_mod>& files,
+    dpf_context_internal& context);
+static bool internal_compare_content(const dpf::FILE_PATH& file_1, const dpf::FILE_PATH& file_2);
 
 static dpf_result internal_read_header(binread& binr, dpf_header& header);
-static dpf_result internal_read_file_header(binread& binr, dpf_file_header& header);
+static dpf_result internal_read_file_header(binread& binr, uint16_t version, dpf_file_header& header);
 
 static void internal_make_relative(dpf_file_mod& file_mod, const dpf::DIR_PATH& root);
-static bool internal_get_md5(const dpf::FILE_PATH dpf_file, unsigned char* md5);
+static dpf::FILE_PATH internal_get_relative(const dpf::FILE_PATH& path, const dpf::DIR_PATH& root);
+static bool internal_get_md5(const dpf::FILE_PATH file, size_t offset, unsigned char* md5,
+    uint64_t file_size = DPF_NO_SIZE);
 
 ///////////////////////////////////////////////////////////////////////////////
 // PUBLIC
@@ -57,6 +419,27 @@ bool dpf::is_dpf_file(const FILE_PATH& file) {
     return result.status == dpf_status::ok;
 }
 
+dpf_result dpf::diff(const DIR_PATH& old_dir, const DIR_PATH& new_dir, dpf_inputs& input_files, dpf_context* context) {
+    try {
+        dpf_context_internal context_internal(context);
+        return internal_diff(old_dir, new_dir, input_files, context_internal);
+    }
+    catch (const std::exception& e) {
+        dpf_result result;
+        result.status  = dpf_status::failure;
+        result.message = e.what();
+
+        return result;
+    }
+    catch (...) {
+        dpf_result result;
+        result.status  = dpf_status::failure;
+        result.message = "Critical failure.";
+
+        return result;
+    }
+}
+
 dpf_result dpf::create(dpf_inputs& input_files, const FILE_PATH& dpf_file, dpf_context* context) {
     try {
         dpf_context_internal context_internal(context);
@@ -78,6 +461,27 @@ dpf_result dpf::create(dpf_inputs& input_files, const FILE_PATH& dpf_file, dpf_c
     }
 }
 
+dpf_result dpf::create(dpf_inputs& input_files, dpf_output& output, dpf_context* context) {
+    try {
+        dpf_context_internal context_internal(context);
+        return internal_create(input_files, output, context_internal);
+    }
+    catch (const std::exception& e) {
+        dpf_result result;
+        result.status  = dpf_status::failure;
+        result.message = e.what();
+
+        return result;
+    }
+    catch (...) {
+        dpf_result result;
+        result.status  = dpf_status::failure;
+        result.message = "Critical failure.";
+
+        return result;
+    }
+}
+
 void dpf::create_async(dpf_inputs& input_files, const FILE_PATH& dpf_file, dpf_context* context) {
     std::thread t([input_files, dpf_file, context] {
         dpf_context_internal context_internal(context);
@@ -103,6 +507,27 @@ void dpf::create_async(dpf_inputs& input_files, const FILE_PATH& dpf_file, dpf_c
     t.detach();
 }
 
+dpf_result dpf::append(dpf_inputs& input_files, const FILE_PATH& dpf_file, dpf_context* context) {
+    try {
+        dpf_context_internal context_internal(context);
+        return internal_append(input_files, dpf_file, context_internal);
+    }
+    catch (const std::exception& e) {
+        dpf_result result;
+        result.status  = dpf_status::failure;
+        result.message = e.what();
+
+        return result;
+    }
+    catch (...) {
+        dpf_result result;
+        result.status  = dpf_status::failure;
+        result.message = "Critical failure.";
+
+        return result;
+    }
+}
+
 dpf_result dpf::patch(const FILE_PATH& dpf_file, const DIR_PATH& patch_dir, dpf_context* context) {
     try {
         dpf_context_internal context_internal(context);
@@ -171,16 +596,83 @@ dpf_result dpf::get_files(const FILE_PATH& dpf_file, std::vector<std::string>& f
         return result;
     }
 
-    for (size_t i = 0; i < header.file_count; i++) {
-        dpf_file_header file_header;
-        internal_read_file_header(binr, file_header);
+    // Indexed files are listed from the index, others entry by entry
 
-        if (file_header.op == dpf_op::add || file_header.op == dpf_op::modify)
-            binr.seek((size_t)file_header.compressed_size);
+    if (header.features & DPF_FEATURE_INDEX) {
+        fin.close();
+
+        std::vector<dpf_file_info> infos;
+
+        result = get_files(dpf_file, infos);
+        if (result.status != dpf_status::ok)
+            return result;
+
+        for (dpf_file_info& info : infos)
+            files.push_back(std::move(info.path));
+
+        return result;
+    }
+
+    try {
+        for (size_t i = 0; i < header.file_count; i++) {
+            dpf_file_header file_header;
+            internal_read_file_header(binr, header.dpf_version, file_header);
+
+            if (file_header.op == dpf_op::add || file_header.op == dpf_op::modify)
+                dpf_content_source(binr, file_header).skip();
+
+            files.push_back(file_header.file_path);
+        }
+    }
+    catch (const std::exception& e) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to parse `{}` entries. | {}", dpf_file.string(), e.what());
+        return result;
+    }
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
+dpf_result dpf::get_files(const FILE_PATH& dpf_file, std::vector<dpf_file_info>& files) {
+    dpf_result                    result;
+    std::vector<uint8_t>          index;
+    std::vector<dpf_index_record> records;
+
+    result = internal_load_index(dpf_file, index);
+    if (result.status != dpf_status::ok)
+        return result;
+
+    if (!internal_get_records(index, records)) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to parse `{}` index.", dpf_file.string());
+        return result;
+    }
+
+    for (const dpf_index_record& record : records)
+        files.push_back({ record.file_path, record.op, record.decompressed_size, record.offset });
 
-        files.push_back(file_header.file_path);
+    result.status = dpf_status::ok;
+    return result;
+}
+
+dpf_result dpf::find_file(const FILE_PATH& dpf_file, const std::string& path, dpf_file_info& info) {
+    dpf_result           result;
+    std::vector<uint8_t> index;
+    dpf_index_record     record;
+
+    result = internal_load_index(dpf_file, index);
+    if (result.status != dpf_status::ok)
+        return result;
+
+    if (!internal_find_record(index, path, record)) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("`{}` isn't in `{}`.", path, dpf_file.string());
+        return result;
     }
 
+    info = { record.file_path, record.op, record.decompressed_size, record.offset };
+
     result.status = dpf_status::ok;
     return result;
 }
@@ -210,7 +702,7 @@ dpf_result dpf::get_patch_version(const FILE_PATH& dpf_file, uint64_t& version)
     version = header.patch_version;
     
     result.status = dpf_status::ok;
-    return dpf_result();
+    return result;
 }
 
 dpf_result dpf::get_patch_version(const FILE_PATH& dpf_file, uint16_t& version_major,
@@ -230,6 +722,35 @@ dpf_result dpf::get_patch_version(const FILE_PATH& dpf_file, uint16_t& version_m
     return result;
 }
 
+dpf_result dpf::get_format(const FILE_PATH& dpf_file, dpf_format_info& format) {
+    dpf_result result;
+    dpf_header header;
+
+    std::ifstream fin;
+    fin.open(dpf_file, std::ios::binary);
+
+    if (!fin.is_open()) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to open `{}` file.", dpf_file.string());
+        return result;
+    }
+
+    binread binr(fin);
+
+    result = internal_read_header(binr, header);
+    if (result.status != dpf_status::ok) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to parse `{}` header. | {}", dpf_file.string(), result.message);
+        return result;
+    }
+
+    format.version  = header.dpf_version;
+    format.features = header.features;
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
 bool dpf::check_checksum(const FILE_PATH& dpf_file) {
     std::ifstream fin;
     fin.open(dpf_file, std::ios::binary);
@@ -237,21 +758,81 @@ bool dpf::check_checksum(const FILE_PATH& dpf_file) {
     if (!fin.is_open())
         return false;
 
-    dpf_header header;
-    char       checksum[16] = { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    dpf_header        header;
+    dpf_tail          tail;
+    std::vector<char> tail_bytes;
+    char              checksum[16] = { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
 
-    {
+    try {
         binread binr(fin);
 
         auto result = internal_read_header(binr, header);
         if (result.status != dpf_status::ok)
             return false;
 
+        result = internal_read_tail(binr, header, tail);
+        if (result.status != dpf_status::ok)
+            return false;
+
+        if (header.features & DPF_FEATURE_SEGMENTS) {
+            tail_bytes.resize(binr.size() - (size_t)tail.content_end);
+
+            binr.seek((size_t)tail.content_end, std::ios_base::beg);
+            binr.read_bytes(tail_bytes.data(), tail_bytes.size());
+        }
+
         fin.close();
     }
+    catch (...) {
+        return false;
+    }
+
+    // Every segment has its own checksum, the header one covers everything after the entries.
+    // Entry checksums cover the segments too, entries are then checked on their own.
+
+    if (header.features & DPF_FEATURE_SEGMENTS) {
+        uint64_t start = internal_get_header_size(header);
+
+        internal_get_checksum(header, std::vector<uint8_t>(tail_bytes.begin(), tail_bytes.end()), checksum);
+
+        if (std::memcmp(header.checksum, checksum, sizeof(checksum)))
+            return false;
+
+        if (header.features & DPF_FEATURE_CHECKSUMS) {
+            std::vector<uint8_t>          index(tail_bytes.begin(), tail_bytes.begin() + (tail.index_end - tail.content_end));
+            std::vector<dpf_index_record> records;
+
+            return internal_get_records(index, records) && internal_check_entries(dpf_file, header, tail, records);
+        }
+
+        for (const dpf_segment& segment : tail.segments) {
+            unsigned char md5[16];
+
+            if (!internal_get_segment_md5(dpf_file, start, segment.end, md5) || std::memcmp(md5, segment.checksum, sizeof(md5)))
+                return false;
+
+            start = segment.end;
+        }
+    }
+    else if (header.features & DPF_FEATURE_TRAILER) {
+        // Single pass files keep the checksum in a trailer
+
+        std::error_code ec;
+        uint64_t size = std::filesystem::file_size(dpf_file, ec);
 
-    if (!internal_get_md5(dpf_file, (unsigned char*)checksum))
+        if (ec || size < dpf_header::size(header.dpf_version) + DPF_TRAILER_SIZE)
+            return false;
+
+        fin.open(dpf_file, std::ios::binary);
+        fin.seekg(size - DPF_TRAILER_SIZE, std::ios::beg);
+        fin.read(header.checksum, sizeof(header.checksum));
+
+        if (!fin || !internal_get_md5(dpf_file, DPF_CHECKSUM_OFFSET, (unsigned char*)checksum, size - DPF_TRAILER_SIZE))
+            return false;
+    }
+    else if (!internal_get_md5(dpf_file, DPF_CHECKSUM_OFFSET, (unsigned char*)checksum)) {
         return false;
+    }
     
     for (int i = 0; i < 16; i++) {
         if (header.checksum[i] != checksum[i])
@@ -261,22 +842,315 @@ bool dpf::check_checksum(const FILE_PATH& dpf_file) {
     return true;
 }
 
-///////////////////////////////////////////////////////////////////////////////
-// INTERNAL IMPL
-
-dpf_result internal_create(dpf_inputs input_files, const dpf::FILE_PATH dpf_file, dpf_context_internal& context) {
+dpf_result dpf::train_dictionary(const dpf_inputs& input_files, std::vector<uint8_t>& dictionary, size_t max_size) {
     dpf_result result;
-    
-    dpf_header header;
-    header.patch_version = input_files.version;
-    header.file_count    = input_files.files.size();
 
-    float prog_change = 100.0f / header.file_count;
-    
-    context.invoke_start();
+    // Spread samples over all eligible files when there's more than fits
 
-    std::ofstream fout;
-    fout.open(dpf_file, std::ios::binary);
+    std::vector<const dpf_file_mod*> eligible;
+    uint64_t                         total_size = 0U;
+
+    for (const dpf_file_mod& file : input_files.files) {
+        if (file.op != dpf_op::add && file.op != dpf_op::modify)
+            continue;
+
+        std::error_code ec;
+        uint64_t size = std::filesystem::file_size(file.path, ec);
+
+        if (ec || size == 0U || size > input_files.dictionary_max_file_size)
+            continue;
+
+        eligible.push_back(&file);
+        total_size += size;
+    }
+
+    size_t               step = (size_t)(total_size / DPF_TRAINER_SAMPLES) + 1U;
+    dictionary_trainer   trainer;
+    std::vector<uint8_t> buffer;
+
+    for (size_t i = 0; i < eligible.size() && trainer.size() < DPF_TRAINER_SAMPLES; i += step) {
+        if (!internal_read_file(eligible[i]->path, buffer)) {
+            result.status  = dpf_status::failure;
+            result.message = DPF_FORMAT("Failed to read input file `{}`.", eligible[i]->path.string());
+            return result;
+        }
+
+        trainer.add(buffer.data(), buffer.size());
+    }
+
+    trainer.train(std::min<size_t>(max_size, deflate_stream::max_dictionary_size), dictionary);
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
+dpf_writer::dpf_writer() = default;
+
+dpf_writer::dpf_writer(dpf_writer&&) noexcept = default;
+
+dpf_writer::~dpf_writer() {
+    if (m_state)
+        close();
+}
+
+dpf_writer& dpf_writer::operator=(dpf_writer&& other) noexcept {
+    if (this != &other) {
+        if (m_state)
+            close();
+
+        m_state = std::move(other.m_state);
+    }
+
+    return *this;
+}
+
+dpf_result dpf_writer::open(const FILE_PATH& dpf_file, uint64_t version, const dpf_compression& compression,
+    dpf_context* context)
+{
+    dpf_result result;
+
+    if (m_state) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("`{}` file is already open.", m_state->file.string());
+        return result;
+    }
+
+    try {
+        auto state = std::make_unique<dpf_writer::state>(context);
+
+        state->file                 = dpf_file;
+        state->compression          = compression;
+        state->header.patch_version = version;
+        state->header.features      = DPF_FEATURE_SEGMENTS | DPF_FEATURE_INDEX | DPF_FEATURE_CHECKSUMS |
+            DPF_FEATURE_PATH_TABLE;
+
+        state->fout.rdbuf()->pubsetbuf(state->fout_buffer.data(), state->fout_buffer.size());
+        state->fout.open(dpf_file, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
+
+        if (!state->fout.is_open()) {
+            result.status  = dpf_status::failure;
+            result.message = DPF_FORMAT("Failed to open `{}` file.", dpf_file.string());
+            return result;
+        }
+
+        internal_write_header(state->binw, state->header);
+
+        if (!state->binw.good()) {
+            result.status  = dpf_status::failure;
+            result.message = DPF_FORMAT("Failed to write `{}` file.", dpf_file.string());
+            return result;
+        }
+
+        m_state = std::move(state);
+    }
+    catch (const std::exception& e) {
+        result.status  = dpf_status::failure;
+        result.message = e.what();
+        return result;
+    }
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
+dpf_result dpf_writer::add(const FILE_PATH& path, std::span<const uint8_t> content, dpf_op op,
+    std::optional<dpf_compression> compression)
+{
+    dpf_result result;
+
+    if (!is_open() || m_state->failed || (op != dpf_op::add && op != dpf_op::modify)) {
+        result.status  = dpf_status::failure;
+        result.message = !is_open() ? "No DPF file is open." : m_state->failed ?
+            "DPF file is incomplete after an earlier failure." : DPF_FORMAT("Unsupported operation for `{}`.", path.string());
+        return result;
+    }
+
+    dpf_create_entry entry;
+    entry.compression              = compression.value_or(m_state->compression);
+    entry.header.op                = op;
+    entry.header.file_path         = path.string();
+    entry.header.file_path_size    = entry.header.file_path.size();
+    entry.header.decompressed_size = content.size();
+
+    try {
+        if (m_state->context.should_stream(content.size())) {
+            // Large buffers are compressed block by block like reader content
+
+            size_t offset = 0U;
+
+            reader_fn_t reader = [&](uint8_t* buffer, size_t size) {
+                size = std::min(size, content.size() - offset);
+
+                std::memcpy(buffer, content.data() + offset, size);
+                offset += size;
+
+                return size;
+            };
+
+            result = internal_write_generated(m_state->binw, m_state->header, entry.header, reader, entry.compression,
+                m_state->index, m_state->context);
+        }
+        else {
+            result = internal_compress_buffer(content.data(), content.size(), entry);
+
+            if (result.status == dpf_status::ok)
+                result = internal_write_entry(m_state->binw, m_state->header, entry, m_state->index, m_state->context);
+        }
+    }
+    catch (const std::exception& e) {
+        result.status  = dpf_status::failure;
+        result.message = e.what();
+    }
+
+    if (result.status != dpf_status::ok) {
+        m_state->failed = true;
+        return result;
+    }
+
+    m_state->header.file_count++;
+    return result;
+}
+
+dpf_result dpf_writer::add(const FILE_PATH& path, const reader_fn_t& reader, dpf_op op,
+    std::optional<dpf_compression> compression)
+{
+    dpf_result result;
+
+    if (!is_open() || m_state->failed || (op != dpf_op::add && op != dpf_op::modify)) {
+        result.status  = dpf_status::failure;
+        result.message = !is_open() ? "No DPF file is open." : m_state->failed ?
+            "DPF file is incomplete after an earlier failure." : DPF_FORMAT("Unsupported operation for `{}`.", path.string());
+        return result;
+    }
+
+    dpf_file_header file_header;
+    file_header.op             = op;
+    file_header.file_path      = path.string();
+    file_header.file_path_size = file_header.file_path.size();
+
+    try {
+        result = internal_write_generated(m_state->binw, m_state->header, file_header, reader,
+            compression.value_or(m_state->compression), m_state->index, m_state->context);
+    }
+    catch (const std::exception& e) {
+        result.status  = dpf_status::failure;
+        result.message = e.what();
+    }
+
+    if (result.status != dpf_status::ok) {
+        m_state->failed = true;
+        return result;
+    }
+
+    m_state->header.file_count++;
+    return result;
+}
+
+dpf_result dpf_writer::remove(const FILE_PATH& path) {
+    dpf_result result;
+
+    if (!is_open() || m_state->failed) {
+        result.status  = dpf_status::failure;
+        result.message = !is_open() ? "No DPF file is open." : "DPF file is incomplete after an earlier failure.";
+        return result;
+    }
+
+    dpf_create_entry entry;
+    entry.header.op             = dpf_op::remove;
+    entry.header.file_path      = path.string();
+    entry.header.file_path_size = entry.header.file_path.size();
+
+    try {
+        result = internal_write_entry(m_state->binw, m_state->header, entry, m_state->index, m_state->context);
+    }
+    catch (const std::exception& e) {
+        result.status  = dpf_status::failure;
+        result.message = e.what();
+    }
+
+    if (result.status != dpf_status::ok) {
+        m_state->failed = true;
+        return result;
+    }
+
+    m_state->header.file_count++;
+    return result;
+}
+
+dpf_result dpf_writer::close() {
+    dpf_result result;
+
+    if (!is_open()) {
+        result.status  = dpf_status::failure;
+        result.message = "No DPF file is open.";
+        return result;
+    }
+
+    std::unique_ptr<state> state = std::move(m_state);
+    std::error_code        ec;
+
+    if (state->failed) {
+        state->fout.close();
+        std::filesystem::remove(state->file, ec);
+
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Removed incomplete `{}` file.", state->file.string());
+        return result;
+    }
+
+    try {
+        std::vector<dpf_segment> segments;
+        internal_write_tail(state->binw, state->header, state->index, segments);
+
+        state->fout.close();
+    }
+    catch (const std::exception& e) {
+        result.status  = dpf_status::failure;
+        result.message = e.what();
+        return result;
+    }
+
+    if (state->fout.fail()) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to write `{}` file.", state->file.string());
+        return result;
+    }
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
+bool dpf_writer::is_open() const {
+    return m_state != nullptr;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// INTERNAL IMPL
+
+dpf_result internal_create(dpf_inputs input_files, const dpf::FILE_PATH dpf_file, dpf_context_internal& context) {
+    dpf_result result;
+    dpf_header header;
+
+    context.invoke_start();
+
+    result = internal_prepare_header(input_files, header);
+    if (result.status != dpf_status::ok) {
+        context.invoke_finish(result);
+        return result;
+    }
+
+    header.features |= internal_get_features(input_files, header,
+        DPF_FEATURE_SEGMENTS | DPF_FEATURE_INDEX | DPF_FEATURE_CHECKSUMS | DPF_FEATURE_PATH_TABLE);
+
+    // Opened for reading as well, streamed entries are read back for the checksum
+
+    // Many small entries make many small writes, so they're gathered in a larger buffer
+
+    std::vector<char> fout_buffer(DPF_OUTPUT_BUFFER);
+
+    std::fstream fout;
+    fout.rdbuf()->pubsetbuf(fout_buffer.data(), fout_buffer.size());
+    fout.open(dpf_file, std::ios::binary | std::ios::in | std::ios::out | std::ios::trunc);
 
     if (!fout.is_open()) {
         result.status  = dpf_status::failure;
@@ -286,244 +1160,3487 @@ dpf_result internal_create(dpf_inputs input_files, const dpf::FILE_PATH dpf_file
         return result;
     }
 
-    fout.write("DPF ", 4);
-    fout.write((char*)&header.dpf_version, sizeof(header.dpf_version));
-    fout.write(header.checksum, sizeof(header.checksum));
-    fout.write((char*)&header.patch_version, sizeof(header.patch_version));
-    fout.write((char*)&header.file_count, sizeof(header.file_count));
+    // Entries are hashed as the first segment, the header is hashed with the index and segment table.
+    // V1 files are hashed as a whole.
+
+    bool                          segmented = header.features & DPF_FEATURE_SEGMENTS;
+    binwrite                      binw(fout, segmented ? internal_get_header_size(header) : DPF_CHECKSUM_OFFSET);
+    std::vector<dpf_index_record> index;
+
+    internal_write_header(binw, header);
+
+    result = internal_create_entries(input_files, header, 0U, binw, index, context);
+    if (result.status != dpf_status::ok) {
+        context.invoke_finish(result);
+        return result;
+    }
+
+    if (segmented) {
+        std::vector<dpf_segment> segments;
+        internal_write_tail(binw, header, index, segments);
+    }
+    else {
+        binw.get_hash((unsigned char*)header.checksum);
+        binw.overwrite(DPF_CHECKSUM_OFFSET - sizeof(header.checksum), header.checksum, sizeof(header.checksum));
+    }
+
+    fout.close();
+
+    if (fout.fail()) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to write `{}` file.", dpf_file.string());
+
+        context.invoke_finish(result);
+        return result;
+    }
+
+    if (context.get_cache().is_enabled())
+        context.get_cache().trim();
+
+    context.finish_progress();
+
+    result.status = dpf_status::ok;
+    
+    context.invoke_finish(result);
+    return result;
+}
+
+dpf_result internal_create(dpf_inputs input_files, dpf_output& output, dpf_context_internal& context) {
+    dpf_result result;
+    dpf_header header;
+
+    // Nothing is back-patched, the checksum follows the last entry
+
+    context.invoke_start();
+
+    result = internal_prepare_header(input_files, header);
+    if (result.status != dpf_status::ok) {
+        context.invoke_finish(result);
+        return result;
+    }
+
+    if (header.dpf_version < DPF_VERSION_2) {
+        result.status  = dpf_status::failure;
+        result.message = "V1 files can only be created into files.";
+
+        context.invoke_finish(result);
+        return result;
+    }
+
+    header.features |= internal_get_features(input_files, header,
+        DPF_FEATURE_TRAILER | DPF_FEATURE_INDEX | DPF_FEATURE_CHECKSUMS | DPF_FEATURE_PATH_TABLE);
+
+    binwrite                      binw(output, DPF_CHECKSUM_OFFSET);
+    std::vector<dpf_index_record> index;
+
+    internal_write_header(binw, header);
+
+    result = internal_create_entries(input_files, header, 0U, binw, index, context);
+    if (result.status != dpf_status::ok) {
+        context.invoke_finish(result);
+        return result;
+    }
+
+    if (header.features & DPF_FEATURE_INDEX)
+        internal_write_index(binw, index, binw.pos());
+
+    unsigned char checksum[DPF_TRAILER_SIZE];
+    binw.get_hash(checksum);
+    binw.write_bytes(checksum, sizeof(checksum));
+
+    if (!binw.flush()) {
+        result.status  = dpf_status::failure;
+        result.message = "Failed to write DPF output.";
+
+        context.invoke_finish(result);
+        return result;
+    }
+
+    if (context.get_cache().is_enabled())
+        context.get_cache().trim();
+
+    context.finish_progress();
+
+    result.status = dpf_status::ok;
+
+    context.invoke_finish(result);
+    return result;
+}
+
+dpf_result internal_append(dpf_inputs input_files, const dpf::FILE_PATH dpf_file, dpf_context_internal& context) {
+    dpf_result                    result;
+    dpf_header                    header;
+    dpf_tail                      tail;
+    std::vector<char>             tail_bytes;
+    std::vector<uint8_t>          index_bytes;
+    std::vector<dpf_index_record> index;
+    uint64_t                      content_end = 0U;
+
+    context.invoke_start();
+
+    // Everything after the entries is kept aside and put back if appending fails.
+    // The index is rewritten with the new entries, files without one are scanned.
+
+    {
+        std::ifstream fin(dpf_file, std::ios::binary);
+
+        if (!fin.is_open()) {
+            result.status  = dpf_status::failure;
+            result.message = DPF_FORMAT("Failed to open `{}` file.", dpf_file.string());
+
+            context.invoke_finish(result);
+            return result;
+        }
+
+        binread binr(fin);
+
+        result = internal_read_header(binr, header);
+
+        if (result.status == dpf_status::ok && header.dpf_version < DPF_VERSION_2) {
+            result.status  = dpf_status::failure;
+            result.message = "V1 files can't be appended to.";
+        }
+
+        if (result.status == dpf_status::ok)
+            result = internal_read_tail(binr, header, tail);
+
+        if (result.status == dpf_status::ok)
+            result = internal_read_index(binr, header, tail, index_bytes);
+
+        if (result.status == dpf_status::ok && !internal_get_records(index_bytes, index)) {
+            result.status  = dpf_status::failure;
+            result.message = "Invalid index.";
+        }
+
+        if (result.status != dpf_status::ok) {
+            result.status  = dpf_status::failure;
+            result.message = DPF_FORMAT("Failed to parse `{}` header. | {}", dpf_file.string(), result.message);
+
+            context.invoke_finish(result);
+            return result;
+        }
+
+        content_end = tail.content_end;
+
+        tail_bytes.resize(binr.size() - (size_t)content_end);
+
+        binr.seek((size_t)content_end, std::ios_base::beg);
+        binr.read_bytes(tail_bytes.data(), tail_bytes.size());
+    }
+
+    std::vector<dpf_segment>& segments = tail.segments;
+
+    // Files without a segment table are hashed once, as a single segment
+
+    if (!(header.features & DPF_FEATURE_SEGMENTS)) {
+        dpf_segment segment;
+        segment.end = content_end;
+
+        if (!internal_get_segment_md5(dpf_file, internal_get_header_size(header), content_end, (unsigned char*)segment.checksum)) {
+            result.status  = dpf_status::failure;
+            result.message = DPF_FORMAT("Failed to read `{}` file.", dpf_file.string());
+
+            context.invoke_finish(result);
+            return result;
+        }
+
+        segments.push_back(segment);
+
+        header.features &= ~DPF_FEATURE_TRAILER;
+        header.features |= DPF_FEATURE_SEGMENTS;
+    }
+
+    // Files without entry checksums get them for their existing entries
+
+    if (!(header.features & DPF_FEATURE_CHECKSUMS) &&
+        !internal_get_entry_checksums(dpf_file, index, 0U, index.size(), content_end))
+    {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to read `{}` file.", dpf_file.string());
+
+        context.invoke_finish(result);
+        return result;
+    }
+
+    header.features |= DPF_FEATURE_INDEX | DPF_FEATURE_CHECKSUMS | DPF_FEATURE_PATH_TABLE;
+
+    // New entries use the dictionary already in the file and follow its entries
+
+    input_files.dictionary = header.dictionary;
+
+    uint64_t first_entry = header.file_count;
+    header.file_count   += input_files.files.size();
+
+    std::filesystem::resize_file(dpf_file, content_end);
+
+    std::vector<char> fout_buffer(DPF_OUTPUT_BUFFER);
+
+    std::fstream fout;
+    fout.rdbuf()->pubsetbuf(fout_buffer.data(), fout_buffer.size());
+    fout.open(dpf_file, std::ios::binary | std::ios::in | std::ios::out);
+    fout.seekp(content_end, std::ios::beg);
+
+    binwrite binw(fout, (size_t)content_end, (size_t)content_end);
+
+    if (fout.is_open())
+        result = internal_create_entries(input_files, header, first_entry, binw, index, context);
+    else
+        result.status = dpf_status::failure;
+
+    if (result.status == dpf_status::ok) {
+        internal_write_tail(binw, header, index, segments);
+        fout.close();
+
+        if (fout.fail()) {
+            result.status  = dpf_status::failure;
+            result.message = DPF_FORMAT("Failed to write `{}` file.", dpf_file.string());
+        }
+    }
+
+    if (result.status != dpf_status::ok) {
+        // Header is only updated once everything else is written, so restoring the tail is enough
+
+        fout.close();
+
+        std::error_code ec;
+        std::filesystem::resize_file(dpf_file, content_end, ec);
+
+        std::ofstream tail_out(dpf_file, std::ios::binary | std::ios::app);
+        tail_out.write(tail_bytes.data(), tail_bytes.size());
+
+        if (result.status == dpf_status::failure && result.message == "")
+            result.message = DPF_FORMAT("Failed to open `{}` file.", dpf_file.string());
+
+        context.invoke_finish(result);
+        return result;
+    }
+
+    if (context.get_cache().is_enabled())
+        context.get_cache().trim();
+
+    context.finish_progress();
+
+    result.status = dpf_status::ok;
+
+    context.invoke_finish(result);
+    return result;
+}
+
+dpf_result internal_prepare_header(dpf_inputs& input_files, dpf_header& header) {
+    dpf_result result;
+
+    header.dpf_version   = input_files.format_version ? input_files.format_version : DPF_VERSION;
+    header.patch_version = input_files.version;
+    header.file_count    = input_files.files.size();
+
+    if (header.dpf_version != DPF_VERSION_1 && header.dpf_version != DPF_VERSION_2) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Unsupported DPF version {}.", header.dpf_version);
+        return result;
+    }
+
+    // V1 files only hold deflated entries, everything newer is turned off
+
+    if (header.dpf_version == DPF_VERSION_1) {
+        for (const dpf_file_mod& file : input_files.files) {
+            if (file.op == dpf_op::move || file.op == dpf_op::copy) {
+                result.status  = dpf_status::failure;
+                result.message = "V1 files can't hold moves or copies.";
+                return result;
+            }
+        }
+
+        input_files.original_path        = "";
+        input_files.deduplicate          = false;
+        input_files.solid_group          = dpf_solid_group::none;
+        input_files.store_extensions     = {};
+        input_files.store_incompressible = false;
+        input_files.dictionary           = {};
+    }
+
+    if (!input_files.dictionary.empty()) {
+        header.features  |= DPF_FEATURE_DICTIONARY;
+        header.dictionary = input_files.dictionary;
+    }
+
+    if (input_files.dictionary.size() > deflate_stream::max_dictionary_size) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Dictionary is larger than {} bytes.", deflate_stream::max_dictionary_size);
+        return result;
+    }
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
+uint32_t internal_get_features(const dpf_inputs& input_files, const dpf_header& header, uint32_t features) {
+    if (header.dpf_version < DPF_VERSION_2)
+        return 0U;
+
+    features &= input_files.format_features | ~DPF_OPTIONAL_FEATURES;
+
+    // Checksums and paths are kept in the index, paths are always written with it
+
+    if (features & DPF_FEATURE_INDEX)
+        features |= DPF_FEATURE_PATH_TABLE;
+    else
+        features &= ~(DPF_FEATURE_CHECKSUMS | DPF_FEATURE_PATH_TABLE);
+
+    return features;
+}
+
+dpf_result internal_create_entries(const dpf_inputs& input_files, const dpf_header& header, uint64_t first_entry,
+    binwrite& binw, std::vector<dpf_index_record>& index, dpf_context_internal& context)
+{
+    dpf_result result;
+
+    size_t thread_count = context.get_thread_count();
+    bool   cancelled    = false;
+
+    // Input sizes are looked up once and shared by all steps
+
+    std::vector<uint64_t> sizes;
+    internal_get_sizes(input_files, sizes);
+
+    uint64_t bytes_total = 0U;
+
+    for (uint64_t size : sizes) {
+        if (size != DPF_NO_SIZE)
+            bytes_total += size;
+    }
+
+    context.start_progress(input_files.files.size(), bytes_total);
+
+    // Identical files are stored once, later copies reference the first one
+
+    std::vector<uint64_t> references(input_files.files.size(), DPF_NO_REFERENCE);
+
+    if (input_files.deduplicate && !context.has_buf_process())
+        internal_find_duplicates(input_files, sizes, context, references);
+
+    std::vector<dpf_create_job> jobs;
+    internal_plan_jobs(input_files, sizes, context, references, jobs);
+
+    result.status = dpf_status::ok;
+
+    // Memory is acquired in job order by whatever reads inputs first and released once
+    // the entry is written, so fewer entries are in flight when they're large.
+
+    memory_budget         budget(context.get_memory_budget());
+    std::vector<uint64_t> costs(jobs.size(), 0U);
+
+    if (budget.is_enabled()) {
+        for (size_t i = 0; i < jobs.size(); i++)
+            costs[i] = internal_get_memory_cost(jobs[i], input_files, sizes, references, context);
+    }
+
+    // Pipelined, inputs of single file entries are read ahead and entries are
+    // written behind on their own threads.
+
+    dpf_result                                      write_result;
+    std::optional<ordered_prefetch<dpf_prefetch>>   prefetch;
+    std::optional<pipeline_stage<dpf_create_entry>> writer;
+
+    write_result.status = dpf_status::ok;
+
+    if (context.is_pipelined()) {
+        prefetch.emplace(jobs.size(), thread_count + DPF_PIPELINE_DEPTH, [&](size_t index, dpf_prefetch& content) {
+            if (!budget.acquire(index, costs[index]))
+                return;
+
+            const dpf_create_job& job  = jobs[index];
+            size_t                file = job.files.front();
+            dpf_op                op   = input_files.files[file].op;
+
+            if (job.solid || references[file] != DPF_NO_REFERENCE || (op != dpf_op::add && op != dpf_op::modify) ||
+                sizes[file] == DPF_NO_SIZE || context.should_stream(sizes[file]))
+            {
+                return;
+            }
+
+            internal_prefetch(input_files.files[file].path, sizes[file], content);
+        });
+
+        writer.emplace(DPF_PIPELINE_DEPTH, [&](dpf_create_entry& entry) {
+            write_result = internal_write_entry(binw, header, entry, index, context);
+
+            entry.buffer = {};
+            budget.release(entry.memory);
+
+            return write_result.status == dpf_status::ok;
+        });
+    }
+
+    auto consume = [&](dpf_create_entry& entry) {
+        if (context.is_cancelled()) {
+            cancelled = true;
+            return false;
+        }
+
+        if (entry.result.status != dpf_status::ok) {
+            result = entry.result;
+            return false;
+        }
+
+        if (writer) {
+            if (!writer->push(std::move(entry))) {
+                result = write_result;
+                return false;
+            }
+        }
+        else {
+            result = internal_write_entry(binw, header, entry, index, context);
+
+            entry.buffer = {};
+            budget.release(entry.memory);
+
+            if (result.status != dpf_status::ok)
+                return false;
+        }
+
+        return true;
+    };
+
+    // Entries are prepared on worker threads, but always written in input order
+    // so the output doesn't depend on the thread count.
+    // Threads waiting for memory are released whenever this stops early.
+
+    parallel_ordered<dpf_create_entry>(jobs.size(), thread_count, thread_count * 2,
+        [&](size_t index, dpf_create_entry& entry) {
+            try {
+                if (!prefetch && !budget.acquire(index, costs[index]))
+                    return;
+
+                entry.memory = costs[index];
+
+                if (context.is_cancelled())
+                    return;
+
+                const dpf_create_job& job  = jobs[index];
+                size_t                file = job.files.front();
+                dpf_prefetch          content;
+
+                if (prefetch)
+                    content = prefetch->take(index);
+
+                if (job.solid)
+                    entry.result = internal_prepare_solid(job.files, input_files, context, entry);
+                else if (references[file] != DPF_NO_REFERENCE)
+                    entry.result = internal_prepare_reference(input_files.files[file], sizes[file], input_files,
+                        first_entry + references[file], entry);
+                else
+                    entry.result = internal_prepare_entry(input_files.files[file], sizes[file], content, input_files, context, entry);
+            }
+            catch (...) {
+                budget.stop();
+                throw;
+            }
+        },
+        [&](size_t, dpf_create_entry& entry) {
+            bool keep = false;
+
+            try {
+                keep = consume(entry);
+            }
+            catch (...) {
+                budget.stop();
+                throw;
+            }
+
+            if (!keep)
+                budget.stop();
+
+            return keep;
+        }
+    );
+
+    if (writer) {
+        writer->finish();
+
+        if (writer->get_error())
+            std::rethrow_exception(writer->get_error());
+
+        if (!cancelled && result.status == dpf_status::ok)
+            result = write_result;
+    }
+
+    if (cancelled) {
+        result.status  = dpf_status::cancelled;
+        result.message = "";
+    }
+
+    return result;
+}
+
+dpf_result internal_prepare_entry(dpf_file_mod input_file, uint64_t file_size, dpf_prefetch& prefetched,
+    const dpf_inputs& input_files, dpf_context_internal& context, dpf_create_entry& entry)
+{
+    dpf_result result;
+
+    dpf_file_header& file_header = entry.header;
+    file_header.op = input_file.op;
+
+    // Moves and copies only carry paths
+
+    if (file_header.op == dpf_op::move || file_header.op == dpf_op::copy) {
+        if (input_files.base_path != "")
+            internal_make_relative(input_file, input_files.base_path);
+
+        file_header.file_path        = input_file.path.string();
+        file_header.file_path_size   = file_header.file_path.size();
+        file_header.source_path      = input_file.source.string();
+        file_header.source_path_size = file_header.source_path.size();
+
+        if (file_header.source_path.empty()) {
+            result.status  = dpf_status::failure;
+            result.message = DPF_FORMAT("Missing source of `{}`.", file_header.file_path);
+            return result;
+        }
+
+        result.status = dpf_status::ok;
+        return result;
+    }
+
+    entry.compression = input_file.compression.value_or(input_files.compression);
+
+    // Files picked by policy are stored without trying to compress them, V1 files can't store
+
+    bool legacy = input_files.format_version == DPF_VERSION_1;
+    bool store  = !legacy && (entry.compression.level == 0 || has_extension(input_file.path, input_files.store_extensions));
+    bool probe  = !store && input_files.store_incompressible;
+
+    // Small files reuse a read buffer kept per thread
+
+    thread_local std::vector<uint8_t> small_buffer;
+    std::vector<uint8_t>              large_buffer;
+    dpf::FILE_PATH                    original;
+
+    std::vector<uint8_t>& buffer = file_size <= DPF_STREAM_BLOCK_SIZE ? small_buffer : large_buffer;
+
+    if (file_header.op == dpf_op::add || file_header.op == dpf_op::modify) {
+        std::ifstream fin;
+        
+        if (file_size != DPF_NO_SIZE && !prefetched)
+            fin.open(input_file.path, std::ios::binary);
+
+        if (!prefetched && !fin.is_open()) {
+            result.status  = dpf_status::failure;
+            result.message = DPF_FORMAT("Failed to open input file `{}`.", input_file.path.string());
+            return result;
+        }
+
+        file_header.decompressed_size = file_size;
+
+        // Modified files are diffed against their original when one exists
+
+        if (file_header.op == dpf_op::modify && input_files.original_path != "" && input_files.base_path != "" &&
+            !context.has_buf_process()) 
+        {
+            uint64_t max_size = internal_get_delta_max_size(input_files, context);
+
+            original = input_files.original_path / internal_get_relative(input_file.path, input_files.base_path);
+
+            std::error_code ec;
+            uint64_t original_size = std::filesystem::file_size(original, ec);
+
+            if (ec) {
+                original.clear();
+            }
+            else if (original_size > max_size || file_header.decompressed_size > max_size) {
+                // Too large to diff in memory, block matched by the writer instead
+
+                file_header.encoding = dpf_encoding::rsync;
+                entry.stream_source  = input_file.path;
+                entry.original       = original;
+
+                internal_make_relative(input_file, input_files.base_path);
+
+                file_header.file_path      = input_file.path.string();
+                file_header.file_path_size = file_header.file_path.size();
+
+                result.status = dpf_status::ok;
+                return result;
+            }
+        }
+
+        // Large files are compressed by the writer straight from disk
+
+        if (original.empty() && context.should_stream(file_header.decompressed_size)) {
+            entry.stream_source = input_file.path;
+
+            if (probe) {
+                buffer.resize((size_t)std::min<uint64_t>(file_header.decompressed_size, DPF_SAMPLE_SIZE));
+                fin.read((char*)buffer.data(), buffer.size());
+
+                store = !is_compressible(buffer.data(), (size_t)fin.gcount());
+            }
+
+            if (store)
+                file_header.encoding = dpf_encoding::stored;
+            else if (!legacy && context.should_split(file_header.decompressed_size))
+                file_header.encoding = dpf_encoding::split;
+            else
+                file_header.encoding = dpf_encoding::deflated;
+
+            // Hashing is much cheaper than compressing, the writer checks the cache with this key
+
+            unsigned char md5[16];
+
+            if (!store && context.get_cache().is_enabled() && internal_get_md5(input_file.path, 0U, md5))
+                entry.cache_key = blob_cache::get_key(md5, (uint8_t)file_header.encoding, entry.compression, {});
+
+            if (input_files.base_path != "")
+                internal_make_relative(input_file, input_files.base_path);
+
+            file_header.file_path      = input_file.path.string();
+            file_header.file_path_size = file_header.file_path.size();
+
+            result.status = dpf_status::ok;
+            return result;
+        }
+
+        if (prefetched) {
+            buffer.swap(*prefetched);
+        }
+        else {
+            buffer.resize((size_t)file_header.decompressed_size);
+            fin.read((char*)buffer.data(), (size_t)file_header.decompressed_size);
+        }
+
+        if (fin.bad()) {
+            result.status  = dpf_status::failure;
+            result.message = DPF_FORMAT("Failed to read input file `{}`.", input_file.path.string());
+            return result;
+        }
+
+        if (!prefetched && ((uint64_t)fin.gcount() != file_header.decompressed_size || 
+            fin.peek() != std::ifstream::traits_type::eof())) 
+        {
+            result.status  = dpf_status::failure;
+            result.message = DPF_FORMAT("Input file `{}` changed while reading.", input_file.path.string());
+            return result;
+        }
+    }
+    else {
+        buffer.clear();
+    }
+
+    auto res = context.invoke_buf_process(input_file, buffer);
+    if (res.status != dpf_status::ok) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to process buffer of `{}`. | {}", input_file.path.string(), res.message);
+        return result;
+    }
+
+    if (input_files.base_path != "")
+        internal_make_relative(input_file, input_files.base_path);
+
+    file_header.file_path      = input_file.path.string();
+    file_header.file_path_size = file_header.file_path.size();
+
+    if (probe)
+        store = !is_compressible(buffer.data(), buffer.size());
+
+    if ((file_header.op == dpf_op::add || file_header.op == dpf_op::modify) && store) {
+        file_header.encoding        = dpf_encoding::stored;
+        file_header.compressed_size = buffer.size();
+
+        entry.buffer = std::move(buffer);
+    }
+    else if (file_header.op == dpf_op::add || file_header.op == dpf_op::modify) {
+        // Small files are compressed with the preset dictionary
+
+        bool use_dictionary = !input_files.dictionary.empty() && buffer.size() <= input_files.dictionary_max_file_size;
+
+        if (use_dictionary)
+            file_header.encoding = dpf_encoding::dictionary;
+
+        const blob_cache& cache = context.get_cache();
+
+        if (cache.is_enabled()) {
+            unsigned char md5[16];
+
+            MD5 md5_digest;
+            md5_digest.add(buffer.data(), buffer.size());
+            md5_digest.getHash(md5);
+
+            entry.cache_key = blob_cache::get_key(md5, (uint8_t)file_header.encoding, entry.compression,
+                use_dictionary ? input_files.dictionary : std::vector<uint8_t>());
+        }
+
+        if (entry.cache_key == "" || !cache.load(entry.cache_key, entry.buffer)) {
+            // Compressor state is large, so it's kept per thread and reset for each file
+
+            thread_local deflate_stream compressor;
+            compressor.reset(entry.compression, use_dictionary ? input_files.dictionary : std::vector<uint8_t>());
+
+            stream_write_fn_t sink = [&](const uint8_t* data, size_t size) {
+                entry.buffer.insert(entry.buffer.end(), data, data + size);
+            };
+
+            entry.buffer.reserve(buffer.size() / 2U + 64U);
+
+            if (!compressor.write(buffer.data(), buffer.size(), sink) || !compressor.finish(sink)) {
+                result.status  = dpf_status::failure;
+                result.message = DPF_FORMAT("Failed to compress input file `{}`.", input_file.path.string());
+                return result;
+            }
+
+            if (entry.cache_key != "")
+                cache.store(entry.cache_key, entry.buffer.data(), entry.buffer.size());
+        }
+
+        file_header.compressed_size = entry.buffer.size();
+    }
+
+    if (!original.empty()) {
+        // Stored content was already moved into the entry
+
+        const std::vector<uint8_t>& content = file_header.encoding == dpf_encoding::stored ? entry.buffer : buffer;
+
+        result = internal_prepare_delta(original, content, entry);
+        if (result.status != dpf_status::ok)
+            return result;
+    }
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
+dpf_result internal_prepare_reference(dpf_file_mod input_file, uint64_t file_size, const dpf_inputs& input_files,
+    uint64_t reference, dpf_create_entry& entry)
+{
+    dpf_result       result;
+    dpf_file_header& file_header = entry.header;
+
+    file_header.op                = input_file.op;
+    file_header.encoding          = dpf_encoding::reference;
+    file_header.decompressed_size = file_size;
+    file_header.compressed_size   = sizeof(reference);
+
+    if (file_size == DPF_NO_SIZE) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to open input file `{}`.", input_file.path.string());
+        return result;
+    }
+
+    entry.buffer.resize(sizeof(reference));
+    std::memcpy(entry.buffer.data(), &reference, sizeof(reference));
+
+    if (input_files.base_path != "")
+        internal_make_relative(input_file, input_files.base_path);
+
+    file_header.file_path      = input_file.path.string();
+    file_header.file_path_size = file_header.file_path.size();
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
+void internal_get_sizes(const dpf_inputs& input_files, std::vector<uint64_t>& sizes) {
+    sizes.assign(input_files.files.size(), DPF_NO_SIZE);
+
+    for (size_t i = 0; i < input_files.files.size(); i++) {
+        const dpf_file_mod& file = input_files.files[i];
+
+        if (file.op != dpf_op::add && file.op != dpf_op::modify)
+            continue;
+
+        std::error_code ec;
+        uint64_t size = std::filesystem::file_size(file.path, ec);
+
+        if (!ec)
+            sizes[i] = size;
+    }
+}
+
+void internal_find_duplicates(const dpf_inputs& input_files, const std::vector<uint64_t>& sizes,
+    dpf_context_internal& context, std::vector<uint64_t>& references)
+{
+    // Only files that share their size with another file can be duplicates
+
+    std::unordered_map<uint64_t, size_t> size_counts;
+
+    for (uint64_t size : sizes) {
+        if (size && size != DPF_NO_SIZE)
+            size_counts[size]++;
+    }
+
+    std::vector<size_t> candidates;
+
+    for (size_t i = 0; i < sizes.size(); i++) {
+        if (sizes[i] && sizes[i] != DPF_NO_SIZE && size_counts[sizes[i]] > 1U)
+            candidates.push_back(i);
+    }
+
+    // Hash candidates in parallel, the first occurrence in input order is kept
+
+    std::unordered_map<dpf_md5, uint64_t, dpf_md5_hash> first;
+    size_t                                              thread_count = context.get_thread_count();
+
+    parallel_ordered<std::optional<dpf_md5>>(candidates.size(), thread_count, thread_count * 2,
+        [&](size_t index, std::optional<dpf_md5>& hash) {
+            dpf_md5 value;
+
+            size_t file = candidates[index];
+
+            if (!context.is_cancelled() && internal_get_md5(input_files.files[file].path, 0U, value.data(), sizes[file]))
+                hash = value;
+        },
+        [&](size_t index, std::optional<dpf_md5>& hash) {
+            if (!hash)
+                return true;
+
+            size_t file  = candidates[index];
+            auto   found = first.find(*hash);
+
+            if (found == first.end())
+                first.emplace(*hash, file);
+            else if (sizes[found->second] == sizes[file])
+                references[file] = found->second;
+
+            return true;
+        }
+    );
+}
+
+void internal_plan_jobs(const dpf_inputs& input_files, const std::vector<uint64_t>& sizes,
+    const dpf_context_internal& context, std::vector<uint64_t>& references, std::vector<dpf_create_job>& jobs)
+{
+    const std::vector<dpf_file_mod>& files = input_files.files;
+
+    // Solid blocks are held whole along with their compressed content
+
+    uint64_t block_limit = input_files.solid_block_size;
+
+    if (context.get_memory_budget())
+        block_limit = std::min<uint64_t>(block_limit, context.get_memory_budget() / 2U);
+
+    std::vector<bool>                          solid(files.size(), false);
+    std::map<std::string, std::vector<size_t>> groups;
+    std::unordered_map<std::string, size_t>    path_counts;
+
+    if (input_files.solid_group != dpf_solid_group::none) {
+        // Solid blocks are written first, so files whose path appears more than once keep their order
+
+        for (const dpf_file_mod& file : files)
+            path_counts[file.path.lexically_normal().string()]++;
+
+        for (size_t i = 0; i < files.size(); i++) {
+            const dpf_file_mod& file = files[i];
+
+            if (file.op != dpf_op::add && file.op != dpf_op::modify)
+                continue;
+
+            if (references[i] != DPF_NO_REFERENCE || file.compression || input_files.compression.level == 0 ||
+                has_extension(file.path, input_files.store_extensions) ||
+                path_counts[file.path.lexically_normal().string()] > 1U)
+            {
+                continue;
+            }
+
+            // Modified files are left to delta encoding
+
+            if (file.op == dpf_op::modify && input_files.original_path != "")
+                continue;
+
+            if (sizes[i] == DPF_NO_SIZE || sizes[i] > input_files.solid_max_file_size)
+                continue;
+
+            std::string key = input_files.solid_group == dpf_solid_group::extension ?
+                file.path.extension().string() : file.path.parent_path().lexically_normal().string();
+
+            if (input_files.solid_group == dpf_solid_group::extension)
+                std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+
+            groups[key].push_back(i);
+        }
+    }
+
+    std::vector<uint64_t> positions(files.size(), 0U);
+    uint64_t              position = 0U;
+
+    // Copies come first, then moves, so sources are still in place
+
+    for (dpf_op op : { dpf_op::copy, dpf_op::move }) {
+        for (size_t i = 0; i < files.size(); i++) {
+            if (files[i].op != op)
+                continue;
+
+            jobs.push_back({ { i }, false });
+            positions[i] = position++;
+        }
+    }
+
+    for (auto& [key, group] : groups) {
+        if (group.size() < 2U)
+            continue;
+
+        uint64_t block_size = 0U;
+
+        for (size_t file : group) {
+            uint64_t size = sizes[file];
+
+            if (jobs.empty() || !jobs.back().solid || (block_size && block_size + size > block_limit)) {
+                jobs.push_back({ {}, true });
+                block_size = 0U;
+            }
+
+            jobs.back().files.push_back(file);
+            block_size += size;
+
+            solid[file]     = true;
+            positions[file] = position++;
+        }
+
+        // Blocks don't span groups
+        jobs.push_back({ {}, true });
+    }
+
+    if (!jobs.empty() && jobs.back().files.empty())
+        jobs.pop_back();
+
+    for (size_t i = 0; i < files.size(); i++) {
+        if (solid[i] || files[i].op == dpf_op::copy || files[i].op == dpf_op::move)
+            continue;
+
+        jobs.push_back({ { i }, false });
+        positions[i] = position++;
+    }
+
+    // References point at entry positions in the written file
+
+    for (uint64_t& reference : references) {
+        if (reference != DPF_NO_REFERENCE)
+            reference = positions[reference];
+    }
+}
+
+uint64_t internal_get_memory_cost(const dpf_create_job& job, const dpf_inputs& input_files,
+    const std::vector<uint64_t>& sizes, const std::vector<uint64_t>& references, const dpf_context_internal& context)
+{
+    if (job.solid) {
+        uint64_t cost = 0U;
+
+        for (size_t file : job.files)
+            cost += sizes[file] * 2U;
+
+        return cost;
+    }
+
+    size_t              file       = job.files.front();
+    const dpf_file_mod& input_file = input_files.files[file];
+    uint64_t            size       = sizes[file];
+
+    if ((input_file.op != dpf_op::add && input_file.op != dpf_op::modify) || references[file] != DPF_NO_REFERENCE ||
+        size == DPF_NO_SIZE)
+    {
+        return 0U;
+    }
+
+    // Same choice as internal_prepare_entry, diffing also holds the original and its suffix array
+
+    if (input_file.op == dpf_op::modify && input_files.original_path != "" && input_files.base_path != "" &&
+        !context.has_buf_process())
+    {
+        dpf::FILE_PATH original = input_files.original_path / internal_get_relative(input_file.path, input_files.base_path);
+
+        std::error_code ec;
+        uint64_t original_size = std::filesystem::file_size(original, ec);
+        uint64_t max_size      = internal_get_delta_max_size(input_files, context);
+
+        if (!ec && original_size <= max_size && size <= max_size)
+            return std::max(original_size, size) * DPF_DELTA_MEMORY;
+
+        if (!ec)
+            return DPF_STREAM_BLOCK_SIZE * 2U;
+    }
+
+    // Streamed entries only hold a block at a time, split entries a window of blocks
+
+    if (context.should_stream(size) && input_files.format_version != DPF_VERSION_1 && context.should_split(size)) {
+        uint64_t split_size = context.get_split_size();
+        return internal_get_split_window(context, split_size) * split_size * 2U;
+    }
+
+    if (context.should_stream(size))
+        return DPF_STREAM_BLOCK_SIZE * 2U;
+
+    return size * 2U;
+}
+
+uint64_t internal_get_delta_max_size(const dpf_inputs& input_files, const dpf_context_internal& context) {
+    uint64_t max_size = std::min<uint64_t>(input_files.delta_max_size, bsdiff::max_size);
+
+    if (context.get_memory_budget())
+        max_size = std::min<uint64_t>(max_size, context.get_memory_budget() / DPF_DELTA_MEMORY);
+
+    return max_size;
+}
+
+dpf_result internal_prepare_solid(const std::vector<size_t>& files, const dpf_inputs& input_files,
+    dpf_context_internal& context, dpf_create_entry& entry)
+{
+    dpf_result            result;
+    std::vector<uint8_t>  block;
+    std::vector<uint64_t> offsets;
+
+    entry.compression = input_files.compression;
+
+    for (size_t i = 0; i < files.size(); i++) {
+        dpf_file_mod         input_file = input_files.files[files[i]];
+        std::vector<uint8_t> buffer;
+
+        if (!internal_read_file(input_file.path, buffer)) {
+            result.status  = dpf_status::failure;
+            result.message = DPF_FORMAT("Failed to read input file `{}`.", input_file.path.string());
+            return result;
+        }
+
+        auto res = context.invoke_buf_process(input_file, buffer);
+        if (res.status != dpf_status::ok) {
+            result.status  = dpf_status::failure;
+            result.message = DPF_FORMAT("Failed to process buffer of `{}`. | {}", input_file.path.string(), res.message);
+            return result;
+        }
+
+        if (input_files.base_path != "")
+            internal_make_relative(input_file, input_files.base_path);
+
+        dpf_file_header& file_header = i == 0U ? entry.header : entry.members.emplace_back();
+
+        file_header.op                = input_file.op;
+        file_header.file_path         = input_file.path.string();
+        file_header.file_path_size    = file_header.file_path.size();
+        file_header.encoding          = i == 0U ? dpf_encoding::solid : dpf_encoding::member;
+        file_header.decompressed_size = buffer.size();
+
+        offsets.push_back(block.size());
+        block.insert(block.end(), buffer.begin(), buffer.end());
+    }
+
+    // Member table followed by the compressed block
+
+    uint64_t member_count = offsets.size();
+
+    entry.buffer.resize(sizeof(uint64_t) * (1U + offsets.size()));
+    std::memcpy(entry.buffer.data(), &member_count, sizeof(member_count));
+    std::memcpy(entry.buffer.data() + sizeof(member_count), offsets.data(), sizeof(uint64_t) * offsets.size());
+
+    deflate_stream compressor(entry.compression);
+
+    stream_write_fn_t sink = [&](const uint8_t* data, size_t size) {
+        entry.buffer.insert(entry.buffer.end(), data, data + size);
+    };
+
+    if (!compressor.write(block.data(), block.size(), sink) || !compressor.finish(sink)) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to compress solid block of `{}`.", entry.header.file_path);
+        return result;
+    }
+
+    entry.header.compressed_size = entry.buffer.size();
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
+dpf_result internal_prepare_delta(const dpf::FILE_PATH& original, const std::vector<uint8_t>& buffer, 
+    dpf_create_entry& entry)
+{
+    dpf_result           result;
+    std::vector<uint8_t> original_buffer;
+
+    if (!internal_read_file(original, original_buffer)) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to read original file `{}`.", original.string());
+        return result;
+    }
+
+    std::vector<uint8_t> delta;
+    std::vector<uint8_t> compressed;
+
+    bsdiff::create(original_buffer.data(), original_buffer.size(), buffer.data(), buffer.size(), delta);
+    original_buffer = {};
+
+    deflate_stream compressor(entry.compression);
+
+    stream_write_fn_t sink = [&](const uint8_t* data, size_t size) {
+        compressed.insert(compressed.end(), data, data + size);
+    };
+
+    if (!compressor.write(delta.data(), delta.size(), sink) || !compressor.finish(sink)) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to compress delta of `{}`.", entry.header.file_path);
+        return result;
+    }
+
+    // Keep whichever is smaller
+
+    if (compressed.size() < entry.header.compressed_size) {
+        entry.header.encoding        = dpf_encoding::bsdiff;
+        entry.header.compressed_size = compressed.size();
+
+        entry.buffer = std::move(compressed);
+    }
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
+void internal_write_header(binwrite& binw, const dpf_header& header) {
+    binw.write_bytes("DPF ", 4);
+    binw.write_num(header.dpf_version);
+    binw.write_bytes(header.checksum, sizeof(header.checksum));
+    binw.write_num(header.patch_version);
+    binw.write_num(header.file_count);
+
+    if (header.dpf_version >= DPF_VERSION_2)
+        binw.write_num(header.features);
+
+    if (header.features & DPF_FEATURE_DICTIONARY) {
+        binw.write_num((uint32_t)header.dictionary.size());
+        binw.write_bytes(header.dictionary.data(), header.dictionary.size());
+    }
+}
+
+size_t internal_get_header_size(const dpf_header& header) {
+    size_t size = dpf_header::size(header.dpf_version);
+
+    if (header.features & DPF_FEATURE_DICTIONARY)
+        size += sizeof(uint32_t) + header.dictionary.size();
+
+    return size;
+}
+
+void internal_write_tail(binwrite& binw, dpf_header& header, const std::vector<dpf_index_record>& index,
+    std::vector<dpf_segment>& segments)
+{
+    // Everything written since the last segment is the new one
+
+    dpf_segment segment;
+    segment.end = binw.pos();
+    binw.get_hash((unsigned char*)segment.checksum);
+
+    segments.push_back(segment);
+
+    binw.suspend_hash();
+
+    // Index and segment table are laid out in memory, they're hashed with the header
+
+    dpf_memory_output tail;
+    binwrite          tail_binw(tail);
+
+    if (header.features & DPF_FEATURE_INDEX)
+        internal_write_index(tail_binw, index, segment.end);
+
+    for (const dpf_segment& value : segments) {
+        tail_binw.write_num(value.end);
+        tail_binw.write_bytes(value.checksum, sizeof(value.checksum));
+    }
+
+    tail_binw.write_num((uint64_t)segments.size());
+    tail_binw.flush();
+
+    binw.write_bytes(tail.buffer.data(), tail.buffer.size());
+
+    // File count and features may have changed since the header was written
+
+    internal_get_checksum(header, tail.buffer, header.checksum);
+
+    binw.overwrite(DPF_CHECKSUM_OFFSET - sizeof(header.checksum), header.checksum, sizeof(header.checksum));
+    binw.overwrite(DPF_CHECKSUM_OFFSET + sizeof(header.patch_version), &header.file_count, sizeof(header.file_count));
+    binw.overwrite(DPF_CHECKSUM_OFFSET + sizeof(header.patch_version) + sizeof(header.file_count), &header.features,
+        sizeof(header.features));
+}
+
+void internal_write_index(binwrite& binw, const std::vector<dpf_index_record>& index, uint64_t index_offset) {
+    for (const dpf_index_record& record : index) {
+        binw.write_num(record.op);
+        binw.write_num(record.encoding);
+        binw.write_num(record.decompressed_size);
+        binw.write_num(record.compressed_size);
+        binw.write_num(record.offset);
+        binw.write_num(record.checksum);
+    }
+
+    internal_write_path_table(binw, index);
+
+    // Lookups binary search by path, later entries for the same path sort last
+
+    std::vector<size_t> order(index.size());
+
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return index[a].file_path < index[b].file_path;
+    });
+
+    for (size_t i : order)
+        binw.write_num((uint64_t)i);
+
+    binw.write_num(index_offset);
+    binw.write_num((uint64_t)index.size());
+}
+
+void internal_write_path_table(binwrite& binw, const std::vector<dpf_index_record>& index) {
+    dpf_memory_output table;
+    binwrite          table_binw(table);
+
+    // Paths only store what differs from the path before them
+
+    const std::string* previous = nullptr;
+
+    for (const dpf_index_record& record : index) {
+        const std::string& path   = record.file_path;
+        size_t             prefix = 0U;
+
+        if (previous)
+            prefix = (size_t)(std::mismatch(path.begin(), path.begin() + std::min(path.size(), previous->size()),
+                previous->begin()).first - path.begin());
+
+        table_binw.write_num((uint32_t)prefix);
+        table_binw.write_num((uint32_t)(path.size() - prefix));
+        table_binw.write_bytes(path.data() + prefix, path.size() - prefix);
+
+        previous = &path;
+    }
+
+    table_binw.flush();
+
+    // The table is deflated as one block when that makes it smaller
+
+    deflate_stream       compressor;
+    std::vector<uint8_t> deflated;
+
+    stream_write_fn_t sink = [&](const uint8_t* data, size_t size) {
+        deflated.insert(deflated.end(), data, data + size);
+    };
+
+    bool compressed = compressor.write(table.buffer.data(), table.buffer.size(), sink) && compressor.finish(sink) &&
+        deflated.size() < table.buffer.size();
+
+    const std::vector<uint8_t>& stored = compressed ? deflated : table.buffer;
+
+    binw.write_num((uint64_t)table.buffer.size());
+    binw.write_num((uint64_t)stored.size());
+    binw.write_bytes(stored.data(), stored.size());
+}
+
+bool internal_read_path_table(const uint8_t* data, size_t size, uint64_t count, dpf_path_table& paths) {
+    uint64_t table_size  = 0U;
+    uint64_t stored_size = 0U;
+
+    if (size < 2U * sizeof(uint64_t))
+        return false;
+
+    std::memcpy(&table_size, data, sizeof(table_size));
+    std::memcpy(&stored_size, data + sizeof(table_size), sizeof(stored_size));
+
+    // Deflate doesn't shrink data much more than 1000 times
+
+    if (stored_size != size - 2U * sizeof(uint64_t) || stored_size > table_size || table_size / 1032U > stored_size)
+        return false;
+
+    const uint8_t*       table = data + 2U * sizeof(uint64_t);
+    std::vector<uint8_t> inflated;
+
+    if (stored_size < table_size) {
+        mz_ulong real_size = (mz_ulong)table_size;
+
+        inflated.resize((size_t)table_size);
+
+        if (mz_uncompress(inflated.data(), &real_size, table, (mz_ulong)stored_size) != MZ_OK || real_size != table_size)
+            return false;
+
+        table = inflated.data();
+    }
+
+    // Sized up front, so prefixes can be copied from the arena while it grows
+
+    size_t pos         = 0U;
+    size_t path_size   = 0U;
+    size_t arena_size  = 0U;
+    auto   read_sizes = [&](uint32_t& prefix, uint32_t& suffix) {
+        if (table_size - pos < 2U * sizeof(uint32_t))
+            return false;
+
+        std::memcpy(&prefix, table + pos, sizeof(prefix));
+        std::memcpy(&suffix, table + pos + sizeof(prefix), sizeof(suffix));
+
+        pos += 2U * sizeof(uint32_t);
+        return prefix <= path_size && suffix <= table_size - pos;
+    };
+
+    for (uint64_t i = 0; i < count; i++) {
+        uint32_t prefix = 0U;
+        uint32_t suffix = 0U;
+
+        if (!read_sizes(prefix, suffix))
+            return false;
+
+        pos        += suffix;
+        path_size   = (size_t)prefix + suffix;
+        arena_size += path_size;
+    }
+
+    if (pos != table_size)
+        return false;
+
+    paths.arena.clear();
+    paths.ends.clear();
+    paths.arena.reserve(arena_size);
+    paths.ends.reserve((size_t)count);
+
+    pos       = 0U;
+    path_size = 0U;
+
+    for (uint64_t i = 0; i < count; i++) {
+        uint32_t prefix = 0U;
+        uint32_t suffix = 0U;
+
+        read_sizes(prefix, suffix);
+
+        paths.arena.append(paths.arena.data() + paths.arena.size() - path_size, prefix);
+        paths.arena.append((const char*)table + pos, suffix);
+        paths.ends.push_back(paths.arena.size());
+
+        pos      += suffix;
+        path_size = (size_t)prefix + suffix;
+    }
+
+    return true;
+}
+
+dpf_result internal_read_tail(binread& binr, const dpf_header& header, dpf_tail& tail) {
+    dpf_result result;
+    result.status = dpf_status::failure;
+
+    // Read back to front, the trailer is last and the index is first
+
+    size_t header_size = internal_get_header_size(header);
+    size_t end         = binr.size();
+
+    if (header.features & DPF_FEATURE_TRAILER) {
+        if (end < header_size + DPF_TRAILER_SIZE) {
+            result.message = "Missing checksum trailer.";
+            return result;
+        }
+
+        end -= DPF_TRAILER_SIZE;
+    }
+
+    if (header.features & DPF_FEATURE_SEGMENTS) {
+        if (end < header_size + sizeof(uint64_t)) {
+            result.message = "Invalid segment table.";
+            return result;
+        }
+
+        binr.seek(end - sizeof(uint64_t), std::ios_base::beg);
+
+        uint64_t count = binr.read_num<uint64_t>();
+
+        if (count == 0U || count > (end - header_size - sizeof(uint64_t)) / dpf_segment::size) {
+            result.message = "Invalid segment table.";
+            return result;
+        }
+
+        end -= sizeof(uint64_t) + (size_t)count * dpf_segment::size;
+
+        binr.seek(end, std::ios_base::beg);
+
+        uint64_t start = header_size;
+
+        tail.segments.resize((size_t)count);
+
+        for (dpf_segment& segment : tail.segments) {
+            segment.end = binr.read_num<uint64_t>();
+            binr.read_bytes(segment.checksum, sizeof(segment.checksum));
+
+            if (segment.end < start || segment.end > end) {
+                result.message = "Invalid segment table.";
+                return result;
+            }
+
+            start = segment.end;
+        }
+    }
+
+    tail.index_end = end;
+
+    if (header.features & DPF_FEATURE_INDEX) {
+        if (end < header_size + 2U * sizeof(uint64_t)) {
+            result.message = "Invalid index.";
+            return result;
+        }
+
+        binr.seek(end - 2U * sizeof(uint64_t), std::ios_base::beg);
+
+        uint64_t index_offset = binr.read_num<uint64_t>();
+        uint64_t count        = binr.read_num<uint64_t>();
+
+        if (index_offset < header_size || index_offset > end - 2U * sizeof(uint64_t) || count != header.file_count) {
+            result.message = "Invalid index.";
+            return result;
+        }
+
+        end = (size_t)index_offset;
+    }
+
+    tail.content_end = end;
+
+    if (!tail.segments.empty() && tail.segments.back().end != tail.content_end) {
+        result.message = "Invalid segment table.";
+        return result;
+    }
+
+    binr.seek(header_size, std::ios_base::beg);
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
+dpf_result internal_read_index(binread& binr, const dpf_header& header, const dpf_tail& tail,
+    std::vector<uint8_t>& index)
+{
+    dpf_result result;
+
+    if (header.features & DPF_FEATURE_INDEX) {
+        index.resize((size_t)(tail.index_end - tail.content_end));
+
+        binr.seek((size_t)tail.content_end, std::ios_base::beg);
+        binr.read_bytes((char*)index.data(), index.size());
+
+        result.status = dpf_status::ok;
+        return result;
+    }
+
+    // Files without an index are scanned.
+    // Their index is only built in memory.
+
+    std::vector<dpf_index_record> records;
+
+    binr.seek(internal_get_header_size(header), std::ios_base::beg);
+
+    for (size_t i = 0; i < header.file_count; i++) {
+        dpf_index_record record;
+        dpf_file_header  file_header;
+
+        record.offset = binr.pos();
+
+        internal_read_file_header(binr, header.dpf_version, file_header);
+
+        if (file_header.op == dpf_op::add || file_header.op == dpf_op::modify)
+            dpf_content_source(binr, file_header).skip();
+
+        record.op                = file_header.op;
+        record.encoding          = file_header.encoding;
+        record.decompressed_size = file_header.decompressed_size;
+        record.compressed_size   = file_header.compressed_size;
+        record.file_path         = std::move(file_header.file_path);
+
+        records.push_back(std::move(record));
+    }
+
+    dpf_memory_output output;
+    binwrite          binw(output);
+
+    internal_write_index(binw, records, tail.content_end);
+    binw.flush();
+
+    index = std::move(output.buffer);
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
+dpf_result internal_load_index(const dpf::FILE_PATH& dpf_file, std::vector<uint8_t>& index) {
+    dpf_result result;
+    dpf_header header;
+    dpf_tail   tail;
+
+    std::ifstream fin;
+    fin.open(dpf_file, std::ios::binary);
+
+    if (!fin.is_open()) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to open `{}` file.", dpf_file.string());
+        return result;
+    }
+
+    try {
+        binread binr(fin);
+
+        result = internal_read_header(binr, header);
+
+        if (result.status == dpf_status::ok)
+            result = internal_read_tail(binr, header, tail);
+
+        if (result.status == dpf_status::ok)
+            result = internal_read_index(binr, header, tail, index);
+    }
+    catch (const std::exception& e) {
+        result.status  = dpf_status::failure;
+        result.message = e.what();
+    }
+
+    if (result.status != dpf_status::ok) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to parse `{}` header. | {}", dpf_file.string(), result.message);
+        return result;
+    }
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
+bool internal_get_records(const std::vector<uint8_t>& index, std::vector<dpf_index_record>& records) {
+    dpf_index_view view(index);
+
+    if (!view.init())
+        return false;
+
+    records.resize((size_t)view.count);
+
+    for (size_t i = 0; i < records.size(); i++)
+        view.get_record(i, records[i]);
+
+    return true;
+}
+
+bool internal_find_record(const std::vector<uint8_t>& index, const std::string& path, dpf_index_record& record) {
+    dpf_index_view view(index);
+
+    if (!view.init())
+        return false;
+
+    // Last record with a path not greater than path
+
+    size_t low  = 0U;
+    size_t high = (size_t)view.count;
+
+    while (low < high) {
+        size_t mid    = low + (high - low) / 2U;
+        size_t number = view.get_sorted(mid);
+
+        if (number >= view.count)
+            return false;
+
+        if (path < view.paths.get(number))
+            high = mid;
+        else
+            low = mid + 1U;
+    }
+
+    if (low == 0U)
+        return false;
+
+    size_t number = view.get_sorted(low - 1U);
+
+    return view.get_record(number, record) && record.file_path == path;
+}
+
+void internal_get_checksum(const dpf_header& header, const std::vector<uint8_t>& tail, char* checksum) {
+    // Header is small, so it's laid out in memory and hashed there
+
+    dpf_memory_output output;
+    binwrite          binw(output, DPF_CHECKSUM_OFFSET);
+
+    internal_write_header(binw, header);
+    binw.write_bytes(tail.data(), tail.size());
+
+    binw.get_hash((unsigned char*)checksum);
+}
+
+bool internal_get_entry_checksums(const dpf::FILE_PATH& file, std::vector<dpf_index_record>& records,
+    size_t first, size_t last, uint64_t end)
+{
+    if (first >= last)
+        return true;
+
+    std::ifstream fin(file, std::ios::binary);
+
+    if (!fin.is_open())
+        return false;
+
+    // Entries are contiguous, each ends where the next one starts
+
+    std::vector<char> block(DPF_STREAM_BLOCK_SIZE);
+
+    fin.seekg(records[first].offset, std::ios::beg);
+
+    for (size_t i = first; i < last; i++) {
+        uint64_t entry_end = i + 1U < records.size() ? records[i + 1U].offset : end;
+        uint64_t remaining = entry_end - records[i].offset;
+        uint32_t crc       = (uint32_t)MZ_CRC32_INIT;
+
+        while (remaining) {
+            size_t size = (size_t)std::min<uint64_t>(remaining, block.size());
+
+            fin.read(block.data(), size);
+            if (!fin)
+                return false;
+
+            crc        = (uint32_t)mz_crc32(crc, (const uint8_t*)block.data(), size);
+            remaining -= size;
+        }
+
+        records[i].checksum = crc;
+    }
+
+    return true;
+}
+
+bool internal_check_entries(const dpf::FILE_PATH& file, const dpf_header& header, const dpf_tail& tail,
+    std::vector<dpf_index_record>& records)
+{
+    std::vector<uint32_t> expected(records.size());
+    uint64_t              offset = internal_get_header_size(header);
+
+    for (size_t i = 0; i < records.size(); i++) {
+        if ((i == 0U && records[i].offset != offset) || records[i].offset < offset || records[i].offset > tail.content_end)
+            return false;
+
+        expected[i] = records[i].checksum;
+        offset      = records[i].offset;
+    }
+
+    if (records.empty() && offset != tail.content_end)
+        return false;
+
+    // Entries are checked in batches of about a stream block, each with its own file handle
+
+    std::vector<size_t> batches;
+    uint64_t            batch_size = 0U;
+
+    for (size_t i = 0; i < records.size(); i++) {
+        uint64_t entry_end = i + 1U < records.size() ? records[i + 1U].offset : tail.content_end;
+
+        if (i == 0U || batch_size >= DPF_STREAM_BLOCK_SIZE) {
+            batches.push_back(i);
+            batch_size = 0U;
+        }
+
+        batch_size += entry_end - records[i].offset;
+    }
+
+    batches.push_back(records.size());
+
+    size_t thread_count = std::max(1U, std::thread::hardware_concurrency());
+    bool   valid        = true;
+
+    parallel_ordered<uint8_t>(batches.size() - 1U, thread_count, thread_count * 2,
+        [&](size_t index, uint8_t& ok) {
+            ok = internal_get_entry_checksums(file, records, batches[index], batches[index + 1U], tail.content_end) ? 1U : 0U;
+        },
+        [&](size_t index, uint8_t& ok) {
+            for (size_t i = batches[index]; ok && i < batches[index + 1U]; i++)
+                ok = records[i].checksum == expected[i] ? 1U : 0U;
+
+            valid = ok != 0U;
+            return valid;
+        }
+    );
+
+    return valid;
+}
+
+bool internal_check_entry(binread& binr, const dpf_patch_state& state) {
+    return state.checksums.empty() || binr.get_crc() == state.checksums[state.entry];
+}
+
+void internal_set_path(const dpf_path_table& paths, size_t entry, dpf_file_header& header) {
+    if (!header.file_path.empty())
+        return;
+
+    if (entry >= paths.size())
+        throw std::runtime_error("Missing entry path.");
+
+    header.file_path      = paths.get(entry);
+    header.file_path_size = header.file_path.size();
+}
+
+bool internal_get_segment_md5(const dpf::FILE_PATH& file, uint64_t start, uint64_t end, unsigned char* md5) {
+    if (end == start) {
+        MD5().getHash(md5);
+        return true;
+    }
+
+    return end > start && internal_get_md5(file, (size_t)start, md5, end);
+}
+
+dpf_result internal_write_entry(binwrite& binw, const dpf_header& header, const dpf_create_entry& entry,
+    std::vector<dpf_index_record>& index, dpf_context_internal& context)
+{
+    dpf_result             result;
+    const dpf_file_header& file_header = entry.header;
+    dpf_index_record       record;
+
+    record.op                = file_header.op;
+    record.encoding          = file_header.encoding;
+    record.decompressed_size = file_header.decompressed_size;
+    record.compressed_size   = file_header.compressed_size;
+    record.offset            = binw.pos();
+    record.file_path         = file_header.file_path;
+
+    binw.reset_crc();
+
+    // Streamed content is chunked, so it's hashed as it's written. V1 files can't hold chunks,
+    // their streamed entry headers are back-patched and hashed once complete.
+
+    bool chunked   = internal_is_chunked(header, entry);
+    bool backpatch = entry.stream_source != "" && file_header.encoding != dpf_encoding::stored && !chunked;
+
+    if (backpatch)
+        binw.suspend_hash();
+
+    binw.write_num(file_header.op);
+    internal_write_path(binw, header, file_header.file_path);
+
+    if (file_header.op == dpf_op::move || file_header.op == dpf_op::copy) {
+        binw.write_num(file_header.source_path_size);
+        binw.write_str(file_header.source_path);
+    }
+    
+    if (file_header.op == dpf_op::add || file_header.op == dpf_op::modify) {
+        // Write encoding, V1 entries are always deflated
+
+        if (header.dpf_version >= DPF_VERSION_2)
+            binw.write_num(file_header.encoding);
+
+        // Write decompressed size
+
+        binw.write_num(file_header.decompressed_size);
+
+        if (entry.stream_source != "") {
+            // Compressed size isn't known until the content is written, unless stored
+
+            size_t   size_pos        = binw.pos();
+            uint64_t compressed_size = chunked ? DPF_CHUNKED_SIZE : backpatch ? 0U : file_header.decompressed_size;
+
+            binw.write_num(compressed_size);
+
+            uint64_t written_size = 0U;
+
+            result = internal_write_streamed(binw, entry, chunked, written_size, context);
+            if (result.status != dpf_status::ok)
+                return result;
+
+            if (!backpatch && !chunked && written_size != compressed_size) {
+                result.status  = dpf_status::failure;
+                result.message = DPF_FORMAT("Input file `{}` changed while writing.", entry.stream_source.string());
+                return result;
+            }
+
+            if (backpatch) {
+                binw.overwrite(size_pos, &written_size, sizeof(written_size));
+                binw.resume_hash();
+            }
+
+            record.compressed_size = compressed_size == DPF_CHUNKED_SIZE ? DPF_CHUNKED_SIZE : written_size;
+        }
+        else {
+            // Write compressed size
+
+            binw.write_num(file_header.compressed_size);
+
+            // Write content
+
+            binw.write_bytes(entry.buffer.data(), (size_t)file_header.compressed_size);
+        }
+    }
+
+    record.checksum = binw.get_crc();
+    index.push_back(std::move(record));
+
+    // Solid block members have no content of their own
+
+    for (const dpf_file_header& member : entry.members) {
+        uint64_t offset = binw.pos();
+
+        binw.reset_crc();
+
+        binw.write_num(member.op);
+        internal_write_path(binw, header, member.file_path);
+        binw.write_num(member.encoding);
+        binw.write_num(member.decompressed_size);
+        binw.write_num(member.compressed_size);
+
+        index.push_back({ member.op, member.encoding, member.decompressed_size, member.compressed_size, offset,
+            binw.get_crc(), member.file_path });
+    }
+
+    if (!binw.good()) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to write `{}`.", file_header.file_path);
+        return result;
+    }
+
+    // Streamed content was counted while it was written
+
+    uint64_t bytes = 0U;
+
+    if ((file_header.op == dpf_op::add || file_header.op == dpf_op::modify) && entry.stream_source == "")
+        bytes += file_header.decompressed_size;
+
+    for (const dpf_file_header& member : entry.members)
+        bytes += member.decompressed_size;
+
+    context.add_progress(bytes, 1U + entry.members.size(), file_header.file_path);
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
+void internal_write_path(binwrite& binw, const dpf_header& header, const std::string& path) {
+    // Files with a path table keep paths there
+
+    if (header.features & DPF_FEATURE_PATH_TABLE) {
+        binw.write_num((uint64_t)0U);
+        return;
+    }
+
+    binw.write_num((uint64_t)path.size());
+    binw.write_str(path);
+}
+
+bool internal_is_chunked(const dpf_header& header, const dpf_create_entry& entry) {
+    return header.dpf_version >= DPF_VERSION_2 && entry.stream_source != "" && entry.header.encoding != dpf_encoding::stored;
+}
+
+dpf_result internal_compress_buffer(const uint8_t* data, size_t size, dpf_create_entry& entry) {
+    dpf_result       result;
+    dpf_file_header& file_header = entry.header;
+
+    file_header.encoding = dpf_encoding::deflated;
+
+    if (entry.compression.level != 0) {
+        thread_local deflate_stream compressor;
+        compressor.reset(entry.compression);
+
+        stream_write_fn_t sink = [&](const uint8_t* data, size_t size) {
+            entry.buffer.insert(entry.buffer.end(), data, data + size);
+        };
+
+        entry.buffer.reserve(size / 2U + 64U);
+
+        if (!compressor.write(data, size, sink) || !compressor.finish(sink)) {
+            result.status  = dpf_status::failure;
+            result.message = DPF_FORMAT("Failed to compress `{}`.", file_header.file_path);
+            return result;
+        }
+    }
+
+    // Content that doesn't shrink is stored
+
+    if (entry.compression.level == 0 || entry.buffer.size() >= size) {
+        file_header.encoding = dpf_encoding::stored;
+        entry.buffer.assign(data, data + size);
+    }
+
+    file_header.compressed_size = entry.buffer.size();
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
+dpf_result internal_write_generated(binwrite& binw, const dpf_header& header, dpf_file_header& file_header,
+    const dpf_writer::reader_fn_t& reader, const dpf_compression& compression, std::vector<dpf_index_record>& index,
+    dpf_context_internal& context)
+{
+    dpf_result result;
+    uint64_t   offset = binw.pos();
+
+    binw.reset_crc();
+
+    // Encoding and sizes are only known once all content is read, they're back-patched
+    // and the entry is hashed once complete
+
+    binw.suspend_hash();
+
+    binw.write_num(file_header.op);
+    internal_write_path(binw, header, file_header.file_path);
+
+    size_t sizes_pos = binw.pos();
+
+    binw.write_num(file_header.encoding);
+    binw.write_num(file_header.decompressed_size);
+    binw.write_num(file_header.compressed_size);
+
+    std::vector<uint8_t> block(DPF_STREAM_BLOCK_SIZE);
+
+    auto fill = [&] {
+        size_t size = 0U;
+
+        while (size < block.size()) {
+            size_t read = reader(block.data() + size, block.size() - size);
+            if (read == 0U)
+                break;
+
+            size += std::min(read, block.size() - size);
+        }
+
+        return size;
+    };
+
+    // The first block decides if content is worth compressing
+
+    size_t size   = fill();
+    bool   stored = compression.level == 0 || size == 0U ||
+        !is_compressible(block.data(), std::min<size_t>(size, DPF_SAMPLE_SIZE));
+
+    deflate_stream compressor(compression);
+
+    file_header.decompressed_size = 0U;
+    file_header.compressed_size   = 0U;
+
+    stream_write_fn_t sink = [&](const uint8_t* data, size_t size) {
+        binw.write_bytes(data, size);
+        file_header.compressed_size += size;
+    };
+
+    while (size) {
+        file_header.decompressed_size += size;
+
+        if (stored) {
+            sink(block.data(), size);
+        }
+        else if (!compressor.write(block.data(), size, sink)) {
+            result.status  = dpf_status::failure;
+            result.message = DPF_FORMAT("Failed to compress `{}`.", file_header.file_path);
+            return result;
+        }
+
+        context.add_progress(size, 0U, file_header.file_path);
+
+        size = size < block.size() ? 0U : fill();
+    }
+
+    if (!stored && !compressor.finish(sink)) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to compress `{}`.", file_header.file_path);
+        return result;
+    }
+
+    file_header.encoding = stored ? dpf_encoding::stored : dpf_encoding::deflated;
+
+    binw.overwrite(sizes_pos, &file_header.encoding, sizeof(file_header.encoding));
+    binw.overwrite(sizes_pos + sizeof(file_header.encoding), &file_header.decompressed_size, sizeof(uint64_t));
+    binw.overwrite(sizes_pos + sizeof(file_header.encoding) + sizeof(uint64_t), &file_header.compressed_size, sizeof(uint64_t));
+    binw.resume_hash();
+
+    if (!binw.good()) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to write `{}`.", file_header.file_path);
+        return result;
+    }
+
+    index.push_back({ file_header.op, file_header.encoding, file_header.decompressed_size, file_header.compressed_size,
+        offset, binw.get_crc(), file_header.file_path });
+
+    context.add_progress(0U, 1U, file_header.file_path);
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
+dpf_result internal_write_streamed(binwrite& binw, const dpf_create_entry& entry, bool chunked, uint64_t& compressed_size,
+    dpf_context_internal& context)
+{
+    dpf_result            result;
+    const dpf::FILE_PATH& file = entry.stream_source;
+
+    if (entry.header.encoding == dpf_encoding::rsync) {
+        result = internal_write_rsync(binw, entry, chunked, compressed_size);
+
+        if (result.status == dpf_status::ok)
+            context.add_progress(entry.header.decompressed_size, 0U, entry.header.file_path);
+
+        return result;
+    }
+
+    // Cached content is copied as is. The blob is opened and verified before anything is
+    // written, blobs evicted or damaged in the meantime are compressed again.
+
+    const blob_cache& cache = context.get_cache();
+    std::ifstream     cached;
+    uint64_t          cached_size = 0U;
+
+    dpf_content_sink content(binw, chunked);
+
+    if (entry.cache_key != "" && cache.open(entry.cache_key, cached, cached_size)) {
+        std::vector<uint8_t> block(DPF_STREAM_BLOCK_SIZE);
+        uint64_t             remaining = cached_size;
+
+        while (remaining) {
+            size_t size = (size_t)std::min<uint64_t>(remaining, block.size());
+
+            cached.read((char*)block.data(), size);
+
+            if ((size_t)cached.gcount() != size)
+                break;
+
+            content.write(block.data(), size);
+            remaining -= size;
+        }
+
+        content.finish();
+        compressed_size = content.size;
+
+        if (remaining == 0U) {
+            context.add_progress(entry.header.decompressed_size, 0U, entry.header.file_path);
+
+            result.status = dpf_status::ok;
+            return result;
+        }
+
+        // Content was partially written, the entry can't be recovered
+
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to read cached content of `{}`.", file.string());
+        return result;
+    }
+
+    std::ifstream fin(file, std::ios::binary);
+
+    if (!fin.is_open()) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to open input file `{}`.", file.string());
+        return result;
+    }
+
+    deflate_stream       compressor(entry.compression);
+    std::vector<uint8_t> block(DPF_STREAM_BLOCK_SIZE);
+
+    // Compressed content is also written to the cache
+
+    std::filesystem::path cache_temp_path;
+    std::ofstream         cache_out;
+    uint64_t              cache_size = 0U;
+    uint32_t              cache_crc  = 0U;
+
+    if (entry.cache_key != "") {
+        cache_temp_path = cache.get_temp_path(entry.cache_key);
+        cache_out.open(cache_temp_path, std::ios::binary);
+    }
+
+    stream_write_fn_t sink = [&](const uint8_t* data, size_t size) {
+        content.write(data, size);
+
+        if (cache_out.is_open()) {
+            cache_out.write((const char*)data, size);
+
+            cache_size += size;
+            cache_crc   = blob_cache::get_crc(cache_crc, data, size);
+        }
+    };
+
+    bool stored = entry.header.encoding == dpf_encoding::stored;
+    bool split  = entry.header.encoding == dpf_encoding::split;
+
+    if (split) {
+        result = internal_write_split(entry, sink, context);
+        if (result.status != dpf_status::ok)
+            return result;
+    }
+
+    while (!split && fin) {
+        fin.read((char*)block.data(), block.size());
+
+        if (fin.bad()) {
+            result.status  = dpf_status::failure;
+            result.message = DPF_FORMAT("Failed to read input file `{}`.", file.string());
+            return result;
+        }
+
+        if (stored) {
+            sink(block.data(), (size_t)fin.gcount());
+        }
+        else if (!compressor.write(block.data(), (size_t)fin.gcount(), sink)) {
+            result.status  = dpf_status::failure;
+            result.message = DPF_FORMAT("Failed to compress input file `{}`.", file.string());
+            return result;
+        }
+
+        context.add_progress((uint64_t)fin.gcount(), 0U, entry.header.file_path);
+    }
+
+    if (!stored && !split && !compressor.finish(sink)) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to compress input file `{}`.", file.string());
+        return result;
+    }
+
+    content.finish();
+    compressed_size = content.size;
+
+    if (cache_out.is_open()) {
+        bool cached = cache_out.good();
+        cache_out.close();
+
+        std::error_code ec;
+
+        if (cached)
+            cache.commit(cache_temp_path, entry.cache_key, cache_size, cache_crc);
+        else
+            std::filesystem::remove(cache_temp_path, ec);
+    }
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
+dpf_result internal_write_split(const dpf_create_entry& entry, const stream_write_fn_t& sink,
+    dpf_context_internal& context)
+{
+    dpf_result            result;
+    const dpf::FILE_PATH& file       = entry.stream_source;
+    uint64_t              size       = entry.header.decompressed_size;
+    uint64_t              block_size = context.get_split_size();
+    uint64_t              count      = (size + block_size - 1U) / block_size;
+    uint64_t              offset     = sizeof(block_size);
+    std::vector<uint64_t> offsets;
+    bool                  failed     = false;
+
+    sink((const uint8_t*)&block_size, sizeof(block_size));
+
+    // Blocks are read and compressed on worker threads, then written in order
+
+    size_t thread_count = context.get_thread_count();
+
+    parallel_ordered<std::vector<uint8_t>>((size_t)count, thread_count, internal_get_split_window(context, block_size),
+        [&](size_t index, std::vector<uint8_t>& compressed) {
+            thread_local deflate_stream compressor;
+
+            // Blocks can be up to 256 MB, so they aren't kept around between entries
+
+            std::vector<uint8_t> block((size_t)std::min<uint64_t>(block_size, size - index * block_size));
+            std::ifstream        fin(file, std::ios::binary);
+
+            fin.seekg(index * block_size, std::ios::beg);
+            fin.read((char*)block.data(), block.size());
+
+            if (!fin || (uint64_t)fin.gcount() != block.size())
+                return;
+
+            stream_write_fn_t block_sink = [&](const uint8_t* data, size_t size) {
+                compressed.insert(compressed.end(), data, data + size);
+            };
+
+            compressor.reset(entry.compression);
+
+            if (!compressor.write(block.data(), block.size(), block_sink) || !compressor.finish(block_sink))
+                compressed.clear();
+        },
+        [&](size_t index, std::vector<uint8_t>& compressed) {
+            // Compressed blocks are never empty, so empty ones failed
+
+            if (compressed.empty()) {
+                failed = true;
+                return false;
+            }
+
+            uint32_t compressed_size = (uint32_t)compressed.size();
+
+            offsets.push_back(offset);
+
+            sink((const uint8_t*)&compressed_size, sizeof(compressed_size));
+            sink(compressed.data(), compressed.size());
+
+            offset += sizeof(compressed_size) + compressed.size();
+
+            context.add_progress(std::min<uint64_t>(block_size, size - index * block_size), 0U, entry.header.file_path);
+            return true;
+        }
+    );
+
+    if (failed) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to read or compress input file `{}`.", file.string());
+        return result;
+    }
+
+    sink((const uint8_t*)offsets.data(), offsets.size() * sizeof(uint64_t));
+    sink((const uint8_t*)&count, sizeof(count));
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
+size_t internal_get_split_window(const dpf_context_internal& context, uint64_t block_size) {
+    size_t window = context.get_thread_count() * 2U;
+
+    // Every block in flight holds its compressed and decompressed content
+
+    if (context.get_memory_budget() && block_size)
+        window = (size_t)std::min<uint64_t>(window, context.get_memory_budget() / (2U * block_size));
+
+    return std::max<size_t>(window, 1U);
+}
+
+dpf_result internal_write_rsync(binwrite& binw, const dpf_create_entry& entry, bool chunked, uint64_t& compressed_size) {
+    dpf_result result;
+
+    std::ifstream fin(entry.stream_source, std::ios::binary);
+    std::ifstream fin_original(entry.original, std::ios::binary);
+
+    if (!fin.is_open() || !fin_original.is_open()) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to open input file `{}`.", entry.stream_source.string());
+        return result;
+    }
+
+    deflate_stream   compressor(entry.compression);
+    dpf_content_sink content(binw, chunked);
+    bool             compressed = true;
+
+    stream_write_fn_t sink = [&](const uint8_t* data, size_t size) {
+        content.write(data, size);
+    };
+
+    stream_write_fn_t delta_sink = [&](const uint8_t* data, size_t size) {
+        compressed = compressed && compressor.write(data, size, sink);
+    };
+
+    uint64_t original_size = std::filesystem::file_size(entry.original);
+
+    if (!rsync_delta::create(fin_original, original_size, fin, entry.header.decompressed_size, delta_sink)) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to read input file `{}` or its original.", entry.stream_source.string());
+        return result;
+    }
+
+    if (!compressed || !compressor.finish(sink)) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to compress delta of `{}`.", entry.stream_source.string());
+        return result;
+    }
+
+    content.finish();
+    compressed_size = content.size;
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
+dpf_result internal_read_streamed(binread& binr, const dpf_file_header& header, const dpf::FILE_PATH& file,
+    dpf_context_internal& context)
+{
+    dpf_result result;
+
+    std::ofstream fout(file, std::ios::binary);
+    if (!fout.is_open()) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to open `{}`.", file.string());
+        return result;
+    }
+
+    inflate_stream       decompressor;
+    std::vector<uint8_t> block(DPF_STREAM_BLOCK_SIZE);
+    dpf_content_source   content(binr, header);
+    uint64_t             decompressed_size = 0U;
+
+    stream_write_fn_t sink = [&](const uint8_t* data, size_t size) {
+        fout.write((const char*)data, size);
+        decompressed_size += size;
+    };
+
+    bool stored = header.encoding == dpf_encoding::stored;
+
+    while (size_t size = content.read(block.data(), block.size())) {
+        uint64_t previous = decompressed_size;
+
+        if (stored)
+            sink(block.data(), size);
+        else if (!decompressor.write(block.data(), size, content.has_more(), sink))
+            break;
+
+        context.add_progress(decompressed_size - previous, 0U, header.file_path);
+    }
+
+    if ((!stored && !decompressor.is_done()) || decompressed_size != header.decompressed_size) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to decompress `{}`.", file.string());
+        return result;
+    }
+
+    if (!fout.good()) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to write `{}`.", file.string());
+        return result;
+    }
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
+dpf_result internal_read_split(binread& binr, const dpf_file_header& header, const dpf::FILE_PATH& file,
+    dpf_context_internal& context)
+{
+    dpf_result         result;
+    dpf_content_source content(binr, header);
+    uint64_t           size       = header.decompressed_size;
+    uint64_t           block_size = 0U;
+
+    auto read = [&](void* data, size_t size) {
+        for (size_t done = 0U; done < size;) {
+            size_t read_size = content.read((uint8_t*)data + done, size - done);
+
+            if (read_size == 0U)
+                return false;
+
+            done += read_size;
+        }
+
+        return true;
+    };
+
+    auto fail = [&] {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to decompress `{}`.", file.string());
+        return result;
+    };
+
+    if (!read(&block_size, sizeof(block_size)) || block_size == 0U || block_size > DPF_SPLIT_MAX_SIZE)
+        return fail();
+
+    // Blocks are written in place, so the file is sized up front
+
+    {
+        std::ofstream fout(file, std::ios::binary);
+
+        if (!fout.is_open()) {
+            result.status  = dpf_status::failure;
+            result.message = DPF_FORMAT("Failed to open `{}`.", file.string());
+            return result;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::resize_file(file, size, ec);
+
+    if (ec) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to write `{}`.", file.string());
+        return result;
+    }
+
+    // Compressed blocks are read in batches, then decompressed and written on worker threads
+
+    uint64_t              count        = (size + block_size - 1U) / block_size;
+    uint64_t              offset       = sizeof(block_size);
+    size_t                thread_count = context.get_thread_count();
+    size_t                window       = internal_get_split_window(context, block_size);
+    std::vector<uint64_t> offsets;
+
+    for (uint64_t first = 0U; first < count; first += window) {
+        std::vector<std::vector<uint8_t>> blocks((size_t)std::min<uint64_t>(window, count - first));
+
+        for (std::vector<uint8_t>& block : blocks) {
+            uint32_t compressed_size = 0U;
+
+            if (!read(&compressed_size, sizeof(compressed_size)) || compressed_size > mz_compressBound((mz_ulong)block_size))
+                return fail();
+
+            block.resize(compressed_size);
+
+            if (!read(block.data(), block.size()))
+                return fail();
+
+            offsets.push_back(offset);
+            offset += sizeof(compressed_size) + compressed_size;
+        }
+
+        if (context.is_cancelled()) {
+            result.status = dpf_status::cancelled;
+            return result;
+        }
+
+        bool failed = false;
+
+        parallel_ordered<uint8_t>(blocks.size(), thread_count, window,
+            [&](size_t index, uint8_t& ok) {
+                uint64_t position = (first + index) * block_size;
+                mz_ulong real_size = (mz_ulong)std::min<uint64_t>(block_size, size - position);
+
+                std::vector<uint8_t> decompressed((size_t)real_size);
+
+                int code = mz_uncompress(decompressed.data(), &real_size, blocks[index].data(), (mz_ulong)blocks[index].size());
+
+                if (code != MZ_OK || real_size != decompressed.size())
+                    return;
+
+                std::fstream fout(file, std::ios::binary | std::ios::in | std::ios::out);
+
+                fout.seekp(position, std::ios::beg);
+                fout.write((const char*)decompressed.data(), decompressed.size());
+
+                ok = fout.good() ? 1U : 0U;
+            },
+            [&](size_t index, uint8_t& ok) {
+                if (!ok) {
+                    failed = true;
+                    return false;
+                }
+
+                context.add_progress(std::min<uint64_t>(block_size, size - (first + index) * block_size), 0U, header.file_path);
+                return true;
+            }
+        );
+
+        if (failed)
+            return fail();
+    }
+
+    // Offsets of the blocks read have to match the table
+
+    for (uint64_t expected : offsets) {
+        uint64_t value = 0U;
+
+        if (!read(&value, sizeof(value)) || value != expected)
+            return fail();
+    }
+
+    uint64_t table_count = 0U;
+
+    if (!read(&table_count, sizeof(table_count)) || table_count != count || content.has_more())
+        return fail();
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
+dpf_result internal_read_delta(binread& binr, const dpf_file_header& header, const dpf::FILE_PATH& file,
+    const dpf::FILE_PATH& output)
+{
+    dpf_result           result;
+    std::vector<uint8_t> compressed((size_t)header.compressed_size);
+    std::vector<uint8_t> delta;
+
+    binr.read_bytes((char*)compressed.data(), compressed.size());
+
+    inflate_stream decompressor;
+
+    stream_write_fn_t sink = [&](const uint8_t* data, size_t size) {
+        delta.insert(delta.end(), data, data + size);
+    };
+
+    if (!decompressor.write(compressed.data(), compressed.size(), false, sink) || !decompressor.is_done()) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to decompress delta of `{}`.", file.string());
+        return result;
+    }
+
+    compressed = {};
+
+    std::vector<uint8_t> original;
+    std::vector<uint8_t> buffer;
+
+    if (!internal_read_file(file, original)) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to read `{}`.", file.string());
+        return result;
+    }
+
+    if (!bsdiff::apply(original.data(), original.size(), delta.data(), delta.size(), buffer) || 
+        buffer.size() != header.decompressed_size) 
+    {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to apply delta to `{}`. File doesn't match the original.", file.string());
+        return result;
+    }
+
+    std::ofstream fout(output, std::ios::binary);
+    if (!fout.is_open()) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to open `{}`.", file.string());
+        return result;
+    }
+
+    fout.write((const char*)buffer.data(), buffer.size());
+
+    if (!fout.good()) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to write `{}`.", file.string());
+        return result;
+    }
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
+dpf_result internal_read_reference(binread& binr, const dpf_file_header& header, const dpf::FILE_PATH& file,
+    const dpf::FILE_PATH& output, const std::vector<dpf::FILE_PATH>& targets)
+{
+    dpf_result result;
+    uint64_t   reference = binr.read_num<uint64_t>();
+
+    if (reference >= targets.size() || targets[reference].empty()) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Invalid reference for `{}`.", file.string());
+        return result;
+    }
+
+    std::error_code ec;
+    std::filesystem::copy_file(targets[reference], output, std::filesystem::copy_options::overwrite_existing, ec);
+
+    if (ec || std::filesystem::file_size(output, ec) != header.decompressed_size) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to copy `{}` to `{}`.", targets[reference].string(), file.string());
+        return result;
+    }
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
+dpf_result internal_read_solid(binread& binr, const dpf_file_header& header, dpf_solid_block& block) {
+    dpf_result           result;
+    std::vector<uint8_t> compressed((size_t)header.compressed_size);
+    uint64_t             member_count = 0U;
+
+    binr.read_bytes((char*)compressed.data(), compressed.size());
+
+    block.buffer.clear();
+    block.offsets.clear();
+    block.next = 0U;
+
+    if (compressed.size() >= sizeof(member_count))
+        std::memcpy(&member_count, compressed.data(), sizeof(member_count));
+
+    size_t table_size = sizeof(uint64_t) * (1U + (size_t)member_count);
+
+    if (member_count == 0U || member_count > compressed.size() / sizeof(uint64_t) || table_size > compressed.size()) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Invalid solid block at `{}`.", header.file_path);
+        return result;
+    }
+
+    block.offsets.resize((size_t)member_count);
+    std::memcpy(block.offsets.data(), compressed.data() + sizeof(member_count), sizeof(uint64_t) * block.offsets.size());
+
+    inflate_stream decompressor;
+
+    stream_write_fn_t sink = [&](const uint8_t* data, size_t size) {
+        block.buffer.insert(block.buffer.end(), data, data + size);
+    };
+
+    if (!decompressor.write(compressed.data() + table_size, compressed.size() - table_size, false, sink) ||
+        !decompressor.is_done())
+    {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to decompress solid block at `{}`.", header.file_path);
+        return result;
+    }
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
+dpf_result internal_read_member(const dpf_file_header& header, const dpf::FILE_PATH& file,
+    dpf_solid_block& block, dpf_context_internal& context)
+{
+    dpf_result result;
+
+    if (block.next >= block.offsets.size()) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("`{}` isn't part of a solid block.", file.string());
+        return result;
+    }
+
+    uint64_t offset = block.offsets[block.next++];
+    uint64_t end    = block.next < block.offsets.size() ? block.offsets[block.next] : block.buffer.size();
+
+    if (offset > end || end > block.buffer.size() || end - offset != header.decompressed_size) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Solid block size mismatch for `{}`.", file.string());
+        return result;
+    }
+
+    std::vector<uint8_t> buffer(block.buffer.begin() + offset, block.buffer.begin() + end);
+
+    dpf_file_mod file_mod;
+    file_mod.path = file;
+    file_mod.op   = header.op;
+
+    auto res = context.invoke_buf_process(file_mod, buffer);
+    if (res.status != dpf_status::ok) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to process buffer of `{}`. | {}", file.string(), res.message);
+        return result;
+    }
+
+    std::ofstream fout(file, std::ios::binary);
+    if (!fout.is_open()) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to open `{}`.", file.string());
+        return result;
+    }
+
+    fout.write((const char*)buffer.data(), buffer.size());
+
+    if (!fout.good()) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to write `{}`.", file.string());
+        return result;
+    }
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
+dpf_result internal_read_rsync(binread& binr, const dpf_file_header& header, const dpf::FILE_PATH& file,
+    const dpf::FILE_PATH& output)
+{
+    dpf_result result;
+
+    // Copies are read from the existing file, so the result is written to another one
+
+    {
+        std::ifstream fin(file, std::ios::binary);
+        std::ofstream fout(output, std::ios::binary);
+
+        if (!fin.is_open() || !fout.is_open()) {
+            result.status  = dpf_status::failure;
+            result.message = DPF_FORMAT("Failed to open `{}`.", file.string());
+            return result;
+        }
+
+        inflate_stream       decompressor;
+        rsync_apply          applier(fin, std::filesystem::file_size(file), fout);
+        std::vector<uint8_t> block(DPF_STREAM_BLOCK_SIZE);
+        dpf_content_source   content(binr, header);
+        bool                 applied = true;
+
+        stream_write_fn_t sink = [&](const uint8_t* data, size_t size) {
+            applied = applied && applier.write(data, size);
+        };
+
+        while (applied) {
+            size_t size = content.read(block.data(), block.size());
+            if (size == 0U)
+                break;
+
+            if (!decompressor.write(block.data(), size, content.has_more(), sink))
+                applied = false;
+        }
+
+        if (!applied || !decompressor.is_done() || !applier.is_done() || applier.size() != header.decompressed_size) {
+            result.status  = dpf_status::failure;
+            result.message = DPF_FORMAT("Failed to apply delta to `{}`. File doesn't match the original.", file.string());
+            return result;
+        }
+
+        if (!fout.good()) {
+            result.status  = dpf_status::failure;
+            result.message = DPF_FORMAT("Failed to write `{}`.", file.string());
+            return result;
+        }
+    }
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
+dpf_result internal_patch(const dpf::FILE_PATH dpf_file, const dpf::DIR_PATH patch_dir, dpf_context_internal& context) {
+    dpf_result result;
+    dpf_header header;
+
+    std::ifstream fin;
+    fin.open(dpf_file, std::ios::binary);
+
+    if (!fin.is_open()) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to open `{}` file.", dpf_file.string());
+
+        context.invoke_finish(result);
+        return result;
+    }
+
+    binread binr(fin);
+
+    result = internal_read_header(binr, header);
+    if (result.status != dpf_status::ok) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to parse `{}` header. | {}", dpf_file.string(), result.message);
+        return result;
+    }
+
+    // Paths and entry checksums are read from the index, entries are checked as they're read
+
+    dpf_path_table        paths;
+    std::vector<uint32_t> checksums;
+    uint64_t              bytes_total = 0U;
+
+    if (header.features & DPF_FEATURE_INDEX) {
+        dpf_tail             tail;
+        std::vector<uint8_t> index;
+        dpf_index_view       view(index);
+
+        result = internal_read_tail(binr, header, tail);
+
+        if (result.status == dpf_status::ok)
+            result = internal_read_index(binr, header, tail, index);
+
+        if (result.status == dpf_status::ok && !view.init()) {
+            result.status  = dpf_status::failure;
+            result.message = "Invalid index.";
+        }
+
+        if (result.status != dpf_status::ok) {
+            result.status  = dpf_status::failure;
+            result.message = DPF_FORMAT("Failed to parse `{}` header. | {}", dpf_file.string(), result.message);
+
+            context.invoke_finish(result);
+            return result;
+        }
+
+        for (size_t i = 0; i < view.count; i++) {
+            dpf_index_record record;
+
+            view.get_record(i, record);
+
+            if (header.features & DPF_FEATURE_CHECKSUMS)
+                checksums.push_back(record.checksum);
+
+            if (record.op == dpf_op::add || record.op == dpf_op::modify)
+                bytes_total += record.decompressed_size;
+        }
+
+        paths = std::move(view.paths);
+
+        binr.seek(internal_get_header_size(header), std::ios_base::beg);
+    }
+
+    // Without an index, content sizes are summed up front, so progress can be reported in bytes
+
+    if (context.has_progress()) {
+        if (!(header.features & DPF_FEATURE_INDEX))
+            internal_get_content_size(binr, header, bytes_total);
+
+        context.start_progress(header.file_count, bytes_total);
+    }
+
+    if (context.is_pipelined())
+        result = internal_patch_pipelined(binr, header, patch_dir, std::move(paths), std::move(checksums), context);
+    else
+        result = internal_patch_serial(binr, header, patch_dir, std::move(paths), std::move(checksums), context);
+
+    fin.close();
+
+    if (result.status == dpf_status::ok)
+        context.finish_progress();
+
+    context.invoke_finish(result);
+    return result;
+}
+
+dpf_result internal_patch_serial(binread& binr, const dpf_header& header, const dpf::DIR_PATH& patch_dir,
+    dpf_path_table paths, std::vector<uint32_t> checksums, dpf_context_internal& context)
+{
+    dpf_result      result;
+    dpf_patch_state state;
+
+    state.checksums = std::move(checksums);
+    state.paths     = std::move(paths);
+
+    for (size_t i = 0; i < header.file_count; i++) {
+        dpf_file_header file_header;
+
+        state.entry = i;
+        binr.start_crc();
+
+        internal_read_file_header(binr, header.dpf_version, file_header);
+        internal_set_path(state.paths, i, file_header);
+
+        result = internal_patch_entry(binr, header, file_header, patch_dir, state, context);
+        if (result.status != dpf_status::ok)
+            return result;
+    }
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
+dpf_result internal_patch_pipelined(binread& binr, const dpf_header& header, const dpf::DIR_PATH& patch_dir,
+    dpf_path_table paths, std::vector<uint32_t> checksums, dpf_context_internal& context)
+{
+    dpf_result      result;
+    dpf_result      write_result;
+    dpf_patch_state state;
+
+    state.checksums = std::move(checksums);
+    state.paths     = std::move(paths);
+
+    write_result.status = dpf_status::ok;
+
+    // Memory for buffered entries is acquired before reading them and released once written
+
+    memory_budget budget(context.get_memory_budget());
+
+    // Decoded content is written by a writer thread
+
+    pipeline_stage<dpf_patch_output> writer(DPF_PIPELINE_DEPTH, [&](dpf_patch_output& output) {
+        write_result = internal_write_output(output.file, output.content);
+
+        output.content = {};
+        budget.release(output.memory);
+
+        return write_result.status == dpf_status::ok;
+    });
+
+    // Entries are read ahead by a reader thread. Other entries need the DPF file and the
+    // patched files to themselves, so the reader waits until they're patched.
+
+    bounded_queue<dpf_patch_item> items(DPF_PIPELINE_DEPTH);
+    bounded_queue<bool>           resume(1U);
+    std::exception_ptr            reader_error = nullptr;
+
+    std::thread reader([&] {
+        try {
+            for (size_t i = 0; i < header.file_count; i++) {
+                dpf_patch_item item;
+
+                binr.start_crc();
+                internal_read_file_header(binr, header.dpf_version, item.header);
+                internal_set_path(state.paths, i, item.header);
+
+                item.buffered = internal_is_buffered(item.header, context);
+
+                if (item.buffered)
+                    item.memory = item.header.compressed_size + item.header.decompressed_size;
+
+                if (!budget.acquire(i, item.memory))
+                    return;
+
+                if (item.buffered) {
+                    item.content.resize((size_t)item.header.compressed_size);
+                    binr.read_bytes((char*)item.content.data(), item.content.size());
+
+                    item.corrupt = !state.checksums.empty() && binr.get_crc() != state.checksums[i];
+                }
+
+                bool buffered = item.buffered;
+                bool resumed  = false;
+
+                if (!items.push(std::move(item)))
+                    return;
+
+                if (!buffered && !resume.pop(resumed))
+                    return;
+            }
+        }
+        catch (...) {
+            reader_error = std::current_exception();
+        }
+
+        items.close();
+    });
+
+    auto stop = [&] {
+        budget.stop();
+        items.close();
+        resume.close();
+        reader.join();
+        writer.finish();
+    };
+
+    result.status = dpf_status::ok;
+
+    try {
+        dpf_patch_item       item;
+        std::vector<uint8_t> scratch;
+        size_t               entry = 0U;
+
+        for (; result.status == dpf_status::ok && items.pop(item); entry++) {
+            dpf::FILE_PATH filename = std::filesystem::path(patch_dir).append(item.header.file_path);
+
+            if (item.corrupt) {
+                result.status  = dpf_status::failure;
+                result.message = DPF_FORMAT("Entry `{}` is corrupt.", item.header.file_path);
+            }
+            else if (item.buffered) {
+                // Members only follow their solid block
+
+                state.solid_block = {};
+
+                result = internal_decode_entry(header, item.header, filename, item.content, scratch, context);
+
+                if (result.status == dpf_status::ok && !writer.push({ filename, std::move(item.content), item.memory }))
+                    result = write_result;
+
+                state.targets.push_back(filename);
+
+                if (result.status == dpf_status::ok)
+                    context.add_progress(item.header.decompressed_size, 1U, item.header.file_path);
+            }
+            else {
+                // Earlier content has to be on disk, the entry may read, move or remove it
+
+                state.entry = entry;
+
+                if (writer.flush())
+                    result = internal_patch_entry(binr, header, item.header, patch_dir, state, context);
+                else
+                    result = write_result;
+
+                resume.push(true);
+            }
+        }
+    }
+    catch (...) {
+        stop();
+        throw;
+    }
+
+    stop();
+
+    if (reader_error)
+        std::rethrow_exception(reader_error);
+
+    if (writer.get_error())
+        std::rethrow_exception(writer.get_error());
+
+    if (result.status == dpf_status::ok)
+        result = write_result;
+
+    return result;
+}
+
+dpf_result internal_patch_entry(binread& binr, const dpf_header& header, const dpf_file_header& file_header,
+    const dpf::DIR_PATH& patch_dir, dpf_patch_state& state, dpf_context_internal& context)
+{
+    dpf_result result;
+
+    std::filesystem::path filename = std::filesystem::path(patch_dir).append(file_header.file_path);
+    std::filesystem::path filedir  = std::filesystem::path(filename).remove_filename();
+    bool                  streamed = false;
+
+    auto corrupt = [&] {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Entry `{}` is corrupt.", file_header.file_path);
+        return result;
+    };
+
+    // Members only follow their solid block, any other entry ends it
+
+    if (file_header.encoding != dpf_encoding::member)
+        state.solid_block = {};
+
+    // Entries are checked before they change the patch directory
+
+    if (file_header.encoding == dpf_encoding::solid || file_header.encoding == dpf_encoding::member) {
+        // A solid block is decompressed once, then members are written in order
+
+        if (file_header.encoding == dpf_encoding::solid) {
+            result = internal_read_solid(binr, file_header, state.solid_block);
+            if (result.status != dpf_status::ok)
+                return result;
+        }
+
+        if (!internal_check_entry(binr, state))
+            return corrupt();
+
+        std::filesystem::create_directories(filedir);
+
+        result = internal_read_member(file_header, filename, state.solid_block, context);
+        if (result.status != dpf_status::ok)
+            return result;
+    }
+    else if (internal_is_buffered(file_header, context)) {
+        // Stored content is read straight into the output buffer
+
+        std::vector<uint8_t>& content = state.compressed_buffer;
+
+        content.resize((size_t)file_header.compressed_size);
+        binr.read_bytes((char*)content.data(), content.size());
+
+        if (!internal_check_entry(binr, state))
+            return corrupt();
+
+        result = internal_decode_entry(header, file_header, filename, content, state.decompressed_buffer, context);
+        if (result.status != dpf_status::ok)
+            return result;
+
+        result = internal_write_output(filename, content);
+        if (result.status != dpf_status::ok)
+            return result;
+    }
+    else if (file_header.op == dpf_op::add || file_header.op == dpf_op::modify) {
+        // Content too large to hold is written next to the target, and moved over it once checked
+
+        dpf::FILE_PATH temp_file = dpf::FILE_PATH(filename).concat(".dpf_tmp");
+
+        std::filesystem::create_directories(filedir);
+
+        if (file_header.encoding == dpf_encoding::reference)
+            result = internal_read_reference(binr, file_header, filename, temp_file, state.targets);
+        else if (file_header.op == dpf_op::modify && file_header.encoding == dpf_encoding::bsdiff)
+            result = internal_read_delta(binr, file_header, filename, temp_file);
+        else if (file_header.op == dpf_op::modify && file_header.encoding == dpf_encoding::rsync)
+            result = internal_read_rsync(binr, file_header, filename, temp_file);
+        else if (file_header.encoding == dpf_encoding::split)
+            result = internal_read_split(binr, file_header, temp_file, context);
+        else
+            result = internal_read_streamed(binr, file_header, temp_file, context);
+
+        // Split and streamed content was counted while it was written
+
+        streamed = file_header.encoding == dpf_encoding::split || file_header.encoding == dpf_encoding::deflated ||
+            file_header.encoding == dpf_encoding::stored;
+
+        if (result.status == dpf_status::ok && !internal_check_entry(binr, state))
+            corrupt();
+
+        std::error_code ec;
+
+        if (result.status == dpf_status::ok) {
+            std::filesystem::rename(temp_file, filename, ec);
+
+            if (ec) {
+                result.status  = dpf_status::failure;
+                result.message = DPF_FORMAT("Failed to write `{}`.", filename.string());
+            }
+        }
+
+        if (result.status != dpf_status::ok) {
+            std::filesystem::remove(temp_file, ec);
+            return result;
+        }
+    }
+    else {
+        if (!internal_check_entry(binr, state))
+            return corrupt();
+
+        if (file_header.op == dpf_op::move || file_header.op == dpf_op::copy) {
+            result = internal_read_transfer(file_header, patch_dir, filename);
+            if (result.status != dpf_status::ok)
+                return result;
+        }
+        else if (file_header.op == dpf_op::remove) {
+            if (!std::filesystem::remove(filename)) {
+                result.status  = dpf_status::failure;
+                result.message = DPF_FORMAT("Failed to remove `{}`.", filename.string());
+                return result;
+            }
+        }
+    }
+
+    // Remember where content was written for later references
+
+    state.targets.push_back(file_header.op == dpf_op::remove ? dpf::FILE_PATH() : filename);
+
+    // Streamed content was counted while it was written
+
+    bool has_content = file_header.op == dpf_op::add || file_header.op == dpf_op::modify;
+    context.add_progress(has_content && !streamed ? file_header.decompressed_size : 0U, 1U, file_header.file_path);
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
+void internal_get_content_size(binread& binr, const dpf_header& header, uint64_t& size) {
+    size_t start = binr.pos();
+
+    for (size_t i = 0; i < header.file_count; i++) {
+        dpf_file_header file_header;
+        internal_read_file_header(binr, header.dpf_version, file_header);
+
+        if (file_header.op == dpf_op::add || file_header.op == dpf_op::modify) {
+            size += file_header.decompressed_size;
+            dpf_content_source(binr, file_header).skip();
+        }
+    }
+
+    binr.seek(start, std::ios_base::beg);
+}
 
-    std::vector<uint8_t> buffer;
-    
-    for (dpf_file_mod& input_file : input_files.files) {
-        dpf_file_header file_header;
-        file_header.op = input_file.op;
+bool internal_is_buffered(const dpf_file_header& file_header, const dpf_context_internal& context) {
+    if (file_header.op != dpf_op::add && file_header.op != dpf_op::modify)
+        return false;
 
-        if (context.is_cancelled()) {
-            context.invoke_cancel();
+    if (file_header.encoding == dpf_encoding::dictionary)
+        return true;
 
-            result.status = dpf_status::cancelled;
+    return (file_header.encoding == dpf_encoding::deflated || file_header.encoding == dpf_encoding::stored) &&
+        file_header.compressed_size != DPF_CHUNKED_SIZE && !context.should_stream(file_header.decompressed_size);
+}
+
+dpf_result internal_decode_entry(const dpf_header& header, const dpf_file_header& file_header,
+    const dpf::FILE_PATH& file, std::vector<uint8_t>& content, std::vector<uint8_t>& scratch,
+    dpf_context_internal& context)
+{
+    dpf_result result;
+    mz_ulong   real_decompressed_size = static_cast<mz_ulong>(file_header.decompressed_size);
+    int        code                   = MZ_OK;
+
+    if (file_header.encoding == dpf_encoding::stored) {
+        if (file_header.compressed_size != file_header.decompressed_size) {
+            result.status  = dpf_status::failure;
+            result.message = DPF_FORMAT("Stored size mismatch for `{}`.", file.string());
             return result;
         }
+    }
+    else if (file_header.encoding == dpf_encoding::dictionary) {
+        inflate_stream decompressor(header.dictionary);
 
-        buffer.clear();
+        stream_write_fn_t sink = [&](const uint8_t* data, size_t size) {
+            scratch.insert(scratch.end(), data, data + size);
+        };
 
-        if (file_header.op == dpf_op::add || file_header.op == dpf_op::modify) {
-            std::ifstream fin(input_file.path, std::ios::binary);
-            
-            if (!fin.is_open()) {
-                result.status  = dpf_status::failure;
-                result.message = DPF_FORMAT("Failed to open input file `{}`.", input_file.path.string());
+        scratch.clear();
 
-                context.invoke_finish(result);
-                return result;
-            }
+        if (!decompressor.write(content.data(), content.size(), false, sink) || !decompressor.is_done())
+            code = MZ_DATA_ERROR;
 
-            fin.seekg(0, std::ios::end);
-            file_header.decompressed_size = fin.tellg();
-            fin.seekg(0, std::ios::beg);
+        real_decompressed_size = static_cast<mz_ulong>(scratch.size());
+        content.swap(scratch);
+    }
+    else {
+        scratch.resize((size_t)file_header.decompressed_size);
 
-            buffer.resize((size_t)file_header.decompressed_size);
-            fin.read((char*)buffer.data(), (size_t)file_header.decompressed_size);
+        code = mz_uncompress(scratch.data(), &real_decompressed_size, content.data(),
+            static_cast<mz_ulong>(file_header.compressed_size));
 
-            if (fin.bad()) {
-                result.status  = dpf_status::failure;
-                result.message = DPF_FORMAT("Failed to read input file `{}`.", input_file.path.string());
+        content.swap(scratch);
+    }
 
-                context.invoke_finish(result);
-                return result;
-            }
-        }
+    if (code != MZ_OK || file_header.decompressed_size != real_decompressed_size) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to decompress `{}`.", file.string());
+        return result;
+    }
 
-        auto res = context.invoke_buf_process(input_file, buffer);
-        if (res.status != dpf_status::ok) {
-            result.status  = dpf_status::failure;
-            result.message = DPF_FORMAT("Failed to process buffer of `{}`. | {}", input_file.path.string(), res.message);
+    dpf_file_mod file_mod;
+    file_mod.path = file;
+    file_mod.op   = file_header.op;
 
-            context.invoke_finish(result);
-            return result;
-        }
+    auto res = context.invoke_buf_process(file_mod, content);
+    if (res.status != dpf_status::ok) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to process buffer of `{}`. | {}", file.string(), res.message);
+        return result;
+    }
 
-        if (input_files.base_path != "")
-            internal_make_relative(input_file, input_files.base_path);
+    result.status = dpf_status::ok;
+    return result;
+}
+
+dpf_result internal_write_output(const dpf::FILE_PATH& file, const std::vector<uint8_t>& content) {
+    dpf_result result;
 
-        file_header.file_path      = input_file.path.string();
-        file_header.file_path_size = file_header.file_path.size();
+    std::filesystem::create_directories(std::filesystem::path(file).remove_filename());
 
-        fout.write((char*)&file_header.op, sizeof(file_header.op));
-        fout.write((char*)&file_header.file_path_size, sizeof(file_header.file_path_size));
-        fout.write(file_header.file_path.data(), file_header.file_path_size);
-        
-        if (file_header.op == dpf_op::add || file_header.op == dpf_op::modify) {
-            mz_ulong             max_compressed_size = mz_compressBound(static_cast<mz_ulong>(buffer.size()));
-            mz_ulong             compressed_size     = max_compressed_size;
-            std::vector<uint8_t> buffer_compress(max_compressed_size);
+    std::ofstream fout(file, std::ios::binary);
+    if (!fout.is_open()) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to open `{}`.", file.string());
+        return result;
+    }
 
-            int code = mz_compress(buffer_compress.data(), &compressed_size, buffer.data(), 
-                static_cast<mz_ulong>(buffer.size()));
+    fout.write((const char*)content.data(), content.size());
+    fout.close();
 
-            if (code != MZ_OK) {
-                result.status  = dpf_status::failure;
-                result.message = DPF_FORMAT("Failed to compress input file `{}`.", input_file.path.string());
+    if (fout.fail()) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to write `{}`.", file.string());
+        return result;
+    }
 
-                context.invoke_finish(result);
-                return result;
-            }
+    result.status = dpf_status::ok;
+    return result;
+}
 
-            file_header.compressed_size = compressed_size;
-            buffer_compress.resize(static_cast<size_t>(file_header.compressed_size));
-            
-            // Write decompressed size
+dpf_result internal_diff(const dpf::DIR_PATH& old_dir, const dpf::DIR_PATH& new_dir, dpf_inputs& input_files,
+    dpf_context_internal& context)
+{
+    dpf_result                  result;
+    dpf_result                  old_result;
+    std::vector<dpf_tree_entry> old_entries;
+    std::vector<dpf_tree_entry> new_entries;
 
-            fout.write((char*)&file_header.decompressed_size, sizeof(file_header.decompressed_size));
+    // Both trees are walked at the same time
 
-            // Write compressed size
+    std::thread old_walker([&] {
+        try {
+            old_result = internal_walk(old_dir, old_entries);
+        }
+        catch (const std::exception& e) {
+            old_result.status  = dpf_status::failure;
+            old_result.message = e.what();
+        }
+    });
+
+    try {
+        result = internal_walk(new_dir, new_entries);
+    }
+    catch (...) {
+        old_walker.join();
+        throw;
+    }
 
-            fout.write((char*)&file_header.compressed_size, sizeof(file_header.compressed_size));
+    old_walker.join();
 
-            // Write content
+    if (result.status != dpf_status::ok)
+        return result;
+
+    if (old_result.status != dpf_status::ok)
+        return old_result;
+
+    // Match files by path, both lists are sorted
+
+    std::vector<dpf_file_mod>                              files;
+    std::vector<std::pair<size_t, const std::string*>>     candidates;
+    std::vector<size_t>                                    removed(old_entries.size(), SIZE_MAX);
+    std::vector<std::pair<size_t, const dpf_tree_entry*>> added;
 
-            fout.write((char*)buffer_compress.data(), file_header.compressed_size);
+    size_t old_index = 0U;
+    size_t new_index = 0U;
+
+    while (old_index < old_entries.size() || new_index < new_entries.size()) {
+        const dpf_tree_entry* old_entry = old_index < old_entries.size() ? &old_entries[old_index] : nullptr;
+        const dpf_tree_entry* new_entry = new_index < new_entries.size() ? &new_entries[new_index] : nullptr;
+
+        if (!new_entry || (old_entry && old_entry->path < new_entry->path)) {
+            removed[old_index] = files.size();
+
+            files.push_back({ new_dir / old_entry->path, dpf_op::remove });
+            old_index++;
         }
+        else if (!old_entry || new_entry->path < old_entry->path) {
+            added.push_back({ files.size(), new_entry });
 
-        context.invoke_update(prog_change);
-    }
+            files.push_back({ new_dir / new_entry->path, dpf_op::add });
+            new_index++;
+        }
+        else {
+            if (old_entry->size != new_entry->size) {
+                files.push_back({ new_dir / new_entry->path, dpf_op::modify });
+            }
+            else if (old_entry->time != new_entry->time) {
+                // Same size, different time, decided by content below
 
-    fout.close();
+                candidates.push_back({ files.size(), &new_entry->path });
+                files.push_back({ new_dir / new_entry->path, dpf_op::undefined });
+            }
 
-    // Create checksum
+            old_index++;
+            new_index++;
+        }
+    }
 
-    internal_get_md5(dpf_file, (unsigned char*)header.checksum);
+    size_t thread_count = context.get_thread_count();
 
-    // Write checksum
+    parallel_ordered<uint8_t>(candidates.size(), thread_count, thread_count * 2,
+        [&](size_t index, uint8_t& equal) {
+            if (context.is_cancelled())
+                return;
 
-    std::fstream fstream; 
-    fstream.open(dpf_file, std::ios::binary | std::ios::in | std::ios::out);
+            const std::string& path = *candidates[index].second;
+            equal = internal_compare_content(old_dir / path, new_dir / path) ? 1U : 0U;
+        },
+        [&](size_t index, uint8_t& equal) {
+            if (context.is_cancelled())
+                return false;
 
-    if (!fstream.is_open()) {
-        result.status  = dpf_status::failure;
-        result.message = DPF_FORMAT("Failed to open `{}` file.", dpf_file.string());
+            files[candidates[index].first].op = equal ? dpf_op::undefined : dpf_op::modify;
+            return true;
+        }
+    );
 
-        context.invoke_finish(result);
+    internal_find_transfers(old_dir, new_dir, old_entries, removed, added, files, context);
+
+    if (context.is_cancelled()) {
+        result.status = dpf_status::cancelled;
         return result;
     }
 
-    fstream.seekp(sizeof(header.magic) + sizeof(header.dpf_version), std::ios::beg);
-    fstream.write(header.checksum, sizeof(header.checksum));
-    fstream.close();
+    // Unchanged files and removes replaced by moves are dropped
+
+    files.erase(std::remove_if(files.begin(), files.end(), [](const dpf_file_mod& file) {
+        return file.op == dpf_op::undefined;
+    }), files.end());
+
+    input_files.base_path     = new_dir;
+    input_files.original_path = old_dir;
+    input_files.files         = std::move(files);
 
     result.status = dpf_status::ok;
-    
-    context.invoke_finish(result);
     return result;
 }
 
-dpf_result internal_patch(const dpf::FILE_PATH dpf_file, const dpf::DIR_PATH patch_dir, dpf_context_internal& context) {
-    dpf_result result;
-    dpf_header header;
-
-    std::ifstream fin;
-    fin.open(dpf_file, std::ios::binary);
+void internal_find_transfers(const dpf::DIR_PATH& old_dir, const dpf::DIR_PATH& new_dir,
+    const std::vector<dpf_tree_entry>& old_entries, const std::vector<size_t>& removed,
+    const std::vector<std::pair<size_t, const dpf_tree_entry*>>& added, std::vector<dpf_file_mod>& files,
+    dpf_context_internal& context)
+{
+    // Only old files that share their size with an added file can be sources
 
-    if (!fin.is_open()) {
-        result.status  = dpf_status::failure;
-        result.message = DPF_FORMAT("Failed to open `{}` file.", dpf_file.string());
+    std::unordered_set<uint64_t> added_sizes;
+    std::unordered_set<uint64_t> source_sizes;
 
-        context.invoke_finish(result);
-        return result;
+    for (auto& [file, entry] : added) {
+        if (entry->size)
+            added_sizes.insert(entry->size);
     }
 
-    binread binr(fin);
-    
-    result = internal_read_header(binr, header);
-    if (result.status != dpf_status::ok) {
-        result.status  = dpf_status::failure;
-        result.message = DPF_FORMAT("Failed to parse `{}` header. | {}", dpf_file.string(), result.message);
-        return result;
+    std::vector<size_t> sources;
+
+    for (size_t i = 0; i < old_entries.size(); i++) {
+        if (added_sizes.count(old_entries[i].size)) {
+            sources.push_back(i);
+            source_sizes.insert(old_entries[i].size);
+        }
     }
 
-    float                prog_change = 100.0f / header.file_count;
-    std::vector<uint8_t> compressed_buffer;
-    std::vector<uint8_t> decompressed_buffer;
+    if (sources.empty())
+        return;
 
-    for (size_t i = 0; i < header.file_count; i++) {
-        dpf_file_header file_header;
-        internal_read_file_header(binr, file_header);
+    // Sources are hashed first, then added files
 
-        std::filesystem::path filename = std::filesystem::path(patch_dir).append(file_header.file_path);
-        std::filesystem::path filedir  = std::filesystem::path(filename).remove_filename();
+    std::unordered_map<dpf_md5, size_t, dpf_md5_hash> by_hash;
+    std::vector<bool>                                 moved(old_entries.size(), false);
+    size_t                                            thread_count = context.get_thread_count();
 
-        if (file_header.op == dpf_op::add || file_header.op == dpf_op::modify) {
-            mz_ulong real_decompressed_size = static_cast<mz_ulong>(file_header.decompressed_size);
+    parallel_ordered<std::optional<dpf_md5>>(sources.size() + added.size(), thread_count, thread_count * 2,
+        [&](size_t index, std::optional<dpf_md5>& hash) {
+            if (context.is_cancelled())
+                return;
 
-            compressed_buffer.resize((size_t)file_header.compressed_size);
-            binr.read_bytes((char*)compressed_buffer.data(), (size_t)file_header.compressed_size);
+            dpf::FILE_PATH path;
+            dpf_md5        value;
 
-            std::filesystem::create_directories(filedir);
+            if (index < sources.size()) {
+                path = old_dir / old_entries[sources[index]].path;
+            }
+            else if (source_sizes.count(added[index - sources.size()].second->size)) {
+                path = new_dir / added[index - sources.size()].second->path;
+            }
+            else {
+                return;
+            }
 
-            std::ofstream fout(filename, std::ios::binary);
-            if (!fout.is_open()) {
-                result.status  = dpf_status::failure;
-                result.message = DPF_FORMAT("Failed to open `{}`.", filename.string());
+            if (internal_get_md5(path, 0U, value.data()))
+                hash = value;
+        },
+        [&](size_t index, std::optional<dpf_md5>& hash) {
+            if (context.is_cancelled())
+                return false;
 
-                context.invoke_finish(result);
-                return result;
-            }
+            if (!hash)
+                return true;
 
-            decompressed_buffer.resize((size_t)file_header.decompressed_size);
+            if (index < sources.size()) {
+                // Removed files are preferred, so they can be moved
 
-            int code = mz_uncompress(decompressed_buffer.data(), &real_decompressed_size, compressed_buffer.data(), 
-                static_cast<mz_ulong>(file_header.compressed_size));
+                size_t source = sources[index];
+                auto   found  = by_hash.find(*hash);
 
-            if (code != MZ_OK || file_header.decompressed_size != real_decompressed_size) {
-                result.status  = dpf_status::failure;
-                result.message = DPF_FORMAT("Failed to decompress `{}`.", filename.string());
+                if (found == by_hash.end())
+                    by_hash.emplace(*hash, source);
+                else if (removed[found->second] == SIZE_MAX && removed[source] != SIZE_MAX)
+                    found->second = source;
 
-                context.invoke_finish(result);
-                return result;
+                return true;
             }
 
-            dpf_file_mod file_mod;
-            file_mod.path = filename;
-            file_mod.op   = file_header.op;
+            auto found = by_hash.find(*hash);
 
-            auto res = context.invoke_buf_process(file_mod, decompressed_buffer);
-            if (res.status != dpf_status::ok) {
-                result.status  = dpf_status::failure;
-                result.message = DPF_FORMAT("Failed to process buffer of `{}`. | {}", filename.string(), res.message);
+            if (found == by_hash.end())
+                return true;
 
-                context.invoke_finish(result);
-                return result;
-            }
+            size_t        source = found->second;
+            dpf_file_mod& file   = files[added[index - sources.size()].first];
 
-            fout.write((char*)decompressed_buffer.data(), decompressed_buffer.size());
-            fout.close();
-        }
-        else if (file_header.op == dpf_op::remove) {
-            if (!std::filesystem::remove(filename)) {
-                result.status  = dpf_status::failure;
-                result.message = DPF_FORMAT("Failed to remove `{}`.", filename.string());
+            file.source = new_dir / old_entries[source].path;
 
-                context.invoke_finish(result);
-                return result;
+            // The first file with a removed file's content takes its place, others copy it
+
+            if (removed[source] != SIZE_MAX && !moved[source]) {
+                file.op                   = dpf_op::move;
+                files[removed[source]].op = dpf_op::undefined;
+                moved[source]             = true;
+            }
+            else {
+                file.op = dpf_op::copy;
             }
+
+            return true;
         }
+    );
+}
+
+dpf_result internal_walk(const dpf::DIR_PATH& dir, std::vector<dpf_tree_entry>& entries) {
+    dpf_result      result;
+    std::error_code ec;
+
+    auto it = std::filesystem::recursive_directory_iterator(dir, ec);
+
+    for (; !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+        // A file that can't be checked would look removed, so it fails the walk
+
+        bool regular = it->is_regular_file(ec);
 
-        context.invoke_update(prog_change);
+        if (ec)
+            break;
+
+        if (!regular)
+            continue;
+
+        dpf_tree_entry entry;
+        entry.path = it->path().lexically_relative(dir).generic_string();
+        entry.size = it->file_size(ec);
+
+        if (!ec)
+            entry.time = it->last_write_time(ec);
+
+        if (ec)
+            break;
+
+        entries.push_back(std::move(entry));
     }
 
-    fin.close();
+    if (ec) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to read `{}`. | {}", dir.string(), ec.message());
+        return result;
+    }
 
-    result.status = dpf_status::ok;
+    std::sort(entries.begin(), entries.end(), [](const dpf_tree_entry& a, const dpf_tree_entry& b) {
+        return a.path < b.path;
+    });
 
-    context.invoke_finish(result);
+    result.status = dpf_status::ok;
     return result;
 }
 
+bool internal_compare_content(const dpf::FILE_PATH& file_1, const dpf::FILE_PATH& file_2) {
+    std::ifstream fin_1(file_1, std::ios::binary);
+    std::ifstream fin_2(file_2, std::ios::binary);
+
+    if (!fin_1.is_open() || !fin_2.is_open())
+        return false;
+
+    std::vector<char> block_1(DPF_STREAM_BLOCK_SIZE);
+    std::vector<char> block_2(DPF_STREAM_BLOCK_SIZE);
+
+    while (fin_1 && fin_2) {
+        fin_1.read(block_1.data(), block_1.size());
+        fin_2.read(block_2.data(), block_2.size());
+
+        if (fin_1.gcount() != fin_2.gcount() || !std::equal(block_1.begin(), block_1.begin() + fin_1.gcount(), block_2.begin()))
+            return false;
+    }
+
+    return !fin_1.bad() && !fin_2.bad() && fin_1.eof() == fin_2.eof();
+}
+
 dpf_result internal_read_header(binread& binr, dpf_header& header) {
     dpf_result result;
     result.status = dpf_status::failure;
     
-    if (binr.size() < sizeof(header)) {
+    if (binr.size() < dpf_header::size(DPF_VERSION_1)) {
         result.message = "Header size mismatch.";
         return result;
     }
@@ -536,29 +4653,127 @@ dpf_result internal_read_header(binread& binr, dpf_header& header) {
     }
 
     header.dpf_version = binr.read_num<uint16_t>();
-    if (header.dpf_version != DPF_VERSION) {
+    if (header.dpf_version != DPF_VERSION_1 && header.dpf_version != DPF_VERSION_2) {
         result.message = "Unsupported DPF version.";
         return result;
     }
 
+    if (binr.size() < dpf_header::size(header.dpf_version)) {
+        result.message = "Header size mismatch.";
+        return result;
+    }
+
     binr.read_bytes(header.checksum, sizeof(header.checksum));
     header.patch_version = binr.read_num<uint64_t>();
     header.file_count    = binr.read_num<uint64_t>();
 
+    if (header.dpf_version >= DPF_VERSION_2)
+        header.features = binr.read_num<uint32_t>();
+
+    if (header.features & ~DPF_FEATURES) {
+        result.message = "Unsupported DPF features.";
+        return result;
+    }
+
+    // Checksums and paths are kept in the index, which always has a path table
+
+    if ((header.features & (DPF_FEATURE_CHECKSUMS | DPF_FEATURE_PATH_TABLE)) && !(header.features & DPF_FEATURE_INDEX)) {
+        result.message = "Missing index.";
+        return result;
+    }
+
+    if ((header.features & DPF_FEATURE_INDEX) && !(header.features & DPF_FEATURE_PATH_TABLE)) {
+        result.message = "Missing path table.";
+        return result;
+    }
+
+    if (header.features & DPF_FEATURE_DICTIONARY) {
+        uint32_t size = binr.read_num<uint32_t>();
+
+        if (size == 0U || size > deflate_stream::max_dictionary_size) {
+            result.message = "Invalid dictionary size.";
+            return result;
+        }
+
+        header.dictionary.resize(size);
+        binr.read_bytes((char*)header.dictionary.data(), size);
+    }
+
+    result.status = dpf_status::ok;
+    return result;
+}
+
+dpf_result internal_read_transfer(const dpf_file_header& header, const dpf::DIR_PATH& patch_dir,
+    const dpf::FILE_PATH& file)
+{
+    dpf_result      result;
+    std::error_code ec;
+
+    dpf::FILE_PATH source = std::filesystem::path(patch_dir).append(header.source_path);
+
+    std::filesystem::create_directories(std::filesystem::path(file).remove_filename(), ec);
+
+    if (header.op == dpf_op::move) {
+        std::filesystem::rename(source, file, ec);
+
+        // Falls back to copy and remove across devices
+
+        if (ec && std::filesystem::copy_file(source, file, std::filesystem::copy_options::overwrite_existing, ec))
+            std::filesystem::remove(source, ec);
+    }
+    else {
+        std::filesystem::copy_file(source, file, std::filesystem::copy_options::overwrite_existing, ec);
+    }
+
+    if (ec) {
+        result.status  = dpf_status::failure;
+        result.message = DPF_FORMAT("Failed to {} `{}` to `{}`. | {}", header.op == dpf_op::move ? "move" : "copy",
+            source.string(), file.string(), ec.message());
+        return result;
+    }
+
     result.status = dpf_status::ok;
     return result;
 }
 
-dpf_result internal_read_file_header(binread& binr, dpf_file_header& header) {
+dpf_result internal_read_file_header(binread& binr, uint16_t version, dpf_file_header& header) {
     dpf_result result;
 
     header.op             = binr.read_num<dpf_op>();
     header.file_path_size = binr.read_num<uint64_t>();
     header.file_path      = binr.read_str((size_t)header.file_path_size);
+
+    if (header.op == dpf_op::move || header.op == dpf_op::copy) {
+        if (version < DPF_VERSION_2)
+            throw std::runtime_error(DPF_FORMAT("Unsupported operation for `{}`.", header.file_path));
+
+        header.source_path_size = binr.read_num<uint64_t>();
+        header.source_path      = binr.read_str((size_t)header.source_path_size);
+    }
     
     if (header.op == dpf_op::add || header.op == dpf_op::modify) {
+        if (version >= DPF_VERSION_2)
+            header.encoding = binr.read_num<dpf_encoding>();
+
+        // Deltas only apply to files being modified
+
+        bool is_delta = header.encoding == dpf_encoding::bsdiff || header.encoding == dpf_encoding::rsync;
+        bool is_full  = header.encoding == dpf_encoding::deflated || header.encoding == dpf_encoding::stored ||
+            header.encoding == dpf_encoding::reference || header.encoding == dpf_encoding::solid ||
+            header.encoding == dpf_encoding::member || header.encoding == dpf_encoding::dictionary ||
+            header.encoding == dpf_encoding::split;
+
+        if (!is_full && !(is_delta && header.op == dpf_op::modify))
+            throw std::runtime_error(DPF_FORMAT("Unsupported encoding for `{}`.", header.file_path));
+
         header.decompressed_size = binr.read_num<uint64_t>();
         header.compressed_size   = binr.read_num<uint64_t>();
+
+        bool can_chunk = header.encoding == dpf_encoding::deflated || header.encoding == dpf_encoding::rsync ||
+            header.encoding == dpf_encoding::split;
+
+        if (header.compressed_size == DPF_CHUNKED_SIZE && (!can_chunk || version < DPF_VERSION_2))
+            throw std::runtime_error(DPF_FORMAT("Unsupported encoding for `{}`.", header.file_path));
     }
 
     result.status = dpf_status::ok;
@@ -566,33 +4781,93 @@ dpf_result internal_read_file_header(binread& binr, dpf_file_header& header) {
 }
 
 void internal_make_relative(dpf_file_mod& file_mod, const dpf::DIR_PATH& root) {
-    file_mod.path = std::filesystem::relative(file_mod.path, root);
+    file_mod.path = internal_get_relative(file_mod.path, root);
+
+    if (file_mod.source != "")
+        file_mod.source = internal_get_relative(file_mod.source, root);
 }
 
-bool internal_get_md5(const dpf::FILE_PATH dpf_file, unsigned char* md5) {
-    std::ifstream fin;
-    fin.open(dpf_file, std::ios::binary);
+dpf::FILE_PATH internal_get_relative(const dpf::FILE_PATH& path, const dpf::DIR_PATH& root) {
+    // Paths under root in the same form are resolved without touching the filesystem
+
+    if (path.is_absolute() == root.is_absolute()) {
+        dpf::FILE_PATH relative = path.lexically_normal().lexically_relative(root.lexically_normal());
+
+        if (!relative.empty() && *relative.begin() != "..")
+            return relative;
+    }
+
+    return std::filesystem::relative(path, root);
+}
+
+void internal_prefetch(const dpf::FILE_PATH& file, uint64_t file_size, dpf_prefetch& content) {
+    std::ifstream fin(file, std::ios::binary);
+
+    if (!fin.is_open())
+        return;
+
+    std::vector<uint8_t> buffer((size_t)file_size);
+    fin.read((char*)buffer.data(), buffer.size());
+
+    // Left to the reading entry to report
+
+    if ((uint64_t)fin.gcount() != file_size || fin.peek() != std::ifstream::traits_type::eof())
+        return;
+
+    content = std::move(buffer);
+}
+
+bool internal_read_file(const dpf::FILE_PATH& file, std::vector<uint8_t>& buffer) {
+    std::ifstream fin(file, std::ios::binary | std::ios::ate);
 
     if (!fin.is_open())
         return false;
 
-    fin.seekg(0, std::ios::end);
-    size_t file_size = (size_t)fin.tellg();
+    buffer.resize((size_t)fin.tellg());
+
     fin.seekg(0, std::ios::beg);
+    fin.read((char*)buffer.data(), buffer.size());
 
-    if (file_size <= sizeof(dpf_header))
+    return !fin.bad() && (size_t)fin.gcount() == buffer.size();
+}
+
+bool internal_get_md5(const dpf::FILE_PATH file, size_t offset, unsigned char* md5, uint64_t file_size) {
+    std::ifstream fin;
+    fin.open(file, std::ios::binary);
+
+    if (!fin.is_open())
+        return false;
+
+    // Seeking is skipped when the size is already known
+
+    if (file_size == DPF_NO_SIZE) {
+        fin.seekg(0, std::ios::end);
+        file_size = (uint64_t)fin.tellg();
+        fin.seekg(0, std::ios::beg);
+    }
+
+    if (file_size <= offset)
         return false;
 
-    file_size -= 22;
-    fin.seekg(22, std::ios::beg);
+    file_size -= offset;
+
+    if (offset)
+        fin.seekg(offset, std::ios::beg);
 
-    std::vector<char> buffer;
-    buffer.resize(file_size);
+    std::vector<char> buffer((size_t)std::min<uint64_t>(file_size, DPF_STREAM_BLOCK_SIZE));
+    MD5               md5_digest;
 
-    fin.read(buffer.data(), file_size);
+    while (file_size) {
+        size_t size = (size_t)std::min<uint64_t>(file_size, buffer.size());
+
+        fin.read(buffer.data(), size);
+        if (!fin)
+            return false;
+
+        md5_digest.add(buffer.data(), size);
+        file_size -= size;
+    }
 
-    MD5 md5_digest;
-    md5_digest.add(buffer.data(), buffer.size());
     md5_digest.getHash(md5);
 
     return true;
@@ -1,9 +1,17 @@
 #include "dpf_context_internal.hpp"
+#include "dpf_format.hpp"
+
+#include <algorithm>
+#include <thread>
 
 using namespace libdpf;
 
 dpf_context_internal::dpf_context_internal(dpf_context* context)
-    : m_context(context) {}
+    : m_context(context) 
+{
+    if (m_context && m_context->cache_path != "")
+        m_cache = blob_cache(m_context->cache_path, m_context->cache_max_size);
+}
 
 void dpf_context_internal::invoke_start() const {
     if (m_context && m_context->start_callback)
@@ -20,6 +28,11 @@ void dpf_context_internal::invoke_update(float change) const {
         m_context->update_callback(change);
 }
 
+void dpf_context_internal::invoke_progress(const dpf_progress& progress) const {
+    if (m_context && m_context->progress_callback)
+        m_context->progress_callback(progress);
+}
+
 dpf_result dpf_context_internal::invoke_buf_process(const dpf_file_mod& file, std::vector<uint8_t>& buffer) const {
     dpf_result result;
 
@@ -42,3 +55,80 @@ void dpf_context_internal::invoke_cancel() const {
 
     invoke_finish(result);
 }
+
+size_t dpf_context_internal::get_thread_count() const {
+    if (!m_context || m_context->thread_count == 1U)
+        return 1U;
+
+    if (m_context->thread_count == 0U) {
+        size_t count = std::thread::hardware_concurrency();
+        return count == 0U ? 1U : count;
+    }
+
+    return m_context->thread_count;
+}
+
+bool dpf_context_internal::should_stream(uint64_t size) const {
+    if (!m_context)
+        return size > dpf_context().streaming_threshold;
+
+    if (m_context->buf_process_fn)
+        return false;
+
+    // Buffered entries hold both their compressed and decompressed content
+
+    if (m_context->memory_budget && size > m_context->memory_budget / 2U)
+        return true;
+
+    return size > m_context->streaming_threshold;
+}
+
+bool dpf_context_internal::should_split(uint64_t size) const {
+    uint64_t split_size = get_split_size();
+    return split_size && size > split_size;
+}
+
+uint64_t dpf_context_internal::get_split_size() const {
+    uint64_t split_size = m_context ? m_context->split_size : dpf_context().split_size;
+    return std::min<uint64_t>(split_size, DPF_SPLIT_MAX_SIZE);
+}
+
+bool dpf_context_internal::has_buf_process() const {
+    return m_context && m_context->buf_process_fn;
+}
+
+bool dpf_context_internal::is_pipelined() const {
+    return m_context && m_context->pipelined;
+}
+
+uint64_t dpf_context_internal::get_memory_budget() const {
+    return m_context ? m_context->memory_budget : 0U;
+}
+
+bool dpf_context_internal::has_progress() const {
+    return m_context && (m_context->update_callback || m_context->progress_callback);
+}
+
+void dpf_context_internal::start_progress(uint64_t entries_total, uint64_t bytes_total) {
+    if (!has_progress())
+        return;
+
+    m_progress.start(entries_total, bytes_total, m_context->progress_interval, [this](const dpf_progress& progress, float change) {
+        if (change > 0.0f)
+            invoke_update(change);
+
+        invoke_progress(progress);
+    });
+}
+
+void dpf_context_internal::add_progress(uint64_t bytes, uint64_t entries, const std::string& entry) {
+    m_progress.add(bytes, entries, entry);
+}
+
+void dpf_context_internal::finish_progress() {
+    m_progress.finish();
+}
+
+const blob_cache& dpf_context_internal::get_cache() const {
+    return m_cache;
+}
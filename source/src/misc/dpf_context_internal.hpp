@@ -1,6 +1,8 @@
 #pragma once
 
 #include "libdpf/dpf_context.hpp"
+#include "utilities/blob_cache.hpp"
+#include "utilities/progress_tracker.hpp"
 
 namespace libdpf {
     class dpf_context_internal {
@@ -12,12 +14,31 @@ namespace libdpf {
         void       invoke_start() const;
         void       invoke_finish(dpf_result& result) const;
         void       invoke_update(float change) const;
+        void       invoke_progress(const dpf_progress& progress) const;
         dpf_result invoke_buf_process(const dpf_file_mod& file, std::vector<uint8_t>& buffer) const;
 
         bool is_cancelled() const;
         void invoke_cancel() const;
 
+        size_t get_thread_count() const;
+        bool   should_stream(uint64_t size) const;
+        bool   should_split(uint64_t size) const;
+        uint64_t get_split_size() const;
+        bool   has_buf_process() const;
+        bool   is_pipelined() const;
+
+        uint64_t get_memory_budget() const;
+
+        bool has_progress() const;
+        void start_progress(uint64_t entries_total, uint64_t bytes_total);
+        void add_progress(uint64_t bytes, uint64_t entries, const std::string& entry);
+        void finish_progress();
+
+        const blob_cache& get_cache() const;
+
     private:
-        dpf_context* m_context = nullptr;
+        dpf_context*     m_context = nullptr;
+        blob_cache       m_cache;
+        progress_tracker m_progress;
     };
 }
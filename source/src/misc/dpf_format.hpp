@@ -0,0 +1,177 @@
+#pragma once
+
+#include "libdpf/enums.hpp"
+#include "libdpf/misc/dpf_format_info.hpp"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#define DPF_VERSION_1 0x0001
+#define DPF_VERSION_2 0x0002
+#define DPF_VERSION   DPF_VERSION_2
+
+// Size of the header fields that aren't covered by the checksum (magic, version, checksum)
+#define DPF_CHECKSUM_OFFSET 22U
+
+// V2+ feature flags
+#define DPF_FEATURE_DICTIONARY 0x00000001U
+#define DPF_FEATURE_TRAILER    0x00000002U
+#define DPF_FEATURE_SEGMENTS   0x00000004U
+#define DPF_FEATURE_INDEX      0x00000008U
+#define DPF_FEATURE_CHECKSUMS  0x00000010U
+#define DPF_FEATURE_PATH_TABLE 0x00000020U
+#define DPF_FEATURES           (DPF_FEATURE_DICTIONARY | DPF_FEATURE_TRAILER | DPF_FEATURE_SEGMENTS | DPF_FEATURE_INDEX | \
+    DPF_FEATURE_CHECKSUMS | DPF_FEATURE_PATH_TABLE)
+
+// Features that creates can leave out, see dpf_inputs::format_features
+#define DPF_OPTIONAL_FEATURES  (DPF_FEATURE_INDEX | DPF_FEATURE_CHECKSUMS | DPF_FEATURE_PATH_TABLE)
+
+static_assert(DPF_FEATURE_DICTIONARY == libdpf::dpf_format_info::dictionary && DPF_FEATURE_TRAILER == libdpf::dpf_format_info::trailer &&
+    DPF_FEATURE_SEGMENTS == libdpf::dpf_format_info::segments && DPF_FEATURE_INDEX == libdpf::dpf_format_info::index &&
+    DPF_FEATURE_CHECKSUMS == libdpf::dpf_format_info::checksums && DPF_FEATURE_PATH_TABLE == libdpf::dpf_format_info::path_table &&
+    DPF_FEATURES == libdpf::dpf_format_info::all, "Public feature flags don't match the format.");
+
+// Size of the checksum trailer of DPF_FEATURE_TRAILER files
+#define DPF_TRAILER_SIZE 16U
+
+// Compressed size of entries whose content is split in chunks
+#define DPF_CHUNKED_SIZE UINT64_MAX
+
+// Largest block size of split entries
+#define DPF_SPLIT_MAX_SIZE (256U * 1024U * 1024U)
+
+namespace libdpf {
+    /*
+        How an entry's content is stored.
+        V1 files only contain deflate entries.
+
+        Deflated, rsync and split entries with DPF_CHUNKED_SIZE as compressed size have their
+        content split in chunks, written when the size isn't known up front (all streamed V2 entries):
+            repeated until a chunk of size 0:
+                uint32_t size
+                uint8_t  content[size]
+
+        Solid block content:
+            uint64_t member_count
+            uint64_t offsets[member_count]  -> member offsets in the decompressed block
+            deflated concatenation of all members
+
+        Split content, blocks are deflated on their own so they can be decompressed in parallel:
+            uint64_t block_size              -> decompressed size of every block but the last
+            repeated for every block:
+                uint32_t size
+                uint8_t  content[size]
+            uint64_t offsets[block_count]    -> of each block's size, from the start of the content
+            uint64_t block_count
+    */
+    enum class dpf_encoding : uint8_t {
+        deflated   = 0,
+        stored     = 1,
+        bsdiff     = 2,  // Deflated bsdiff delta against the file being modified
+        rsync      = 3,  // Deflated rsync_delta against the file being modified
+        reference  = 4,  // uint64_t index of an earlier entry with identical content
+        solid      = 5,  // First member of a solid block, see below
+        member     = 6,  // Next member of the current solid block, no content
+        dictionary = 7,  // Raw deflate with the preset dictionary from the header
+        split      = 8   // Deflated in independent blocks, see below
+    };
+
+    struct dpf_header {
+        char     magic[4]      = { 0, 0, 0, 0 };
+        uint16_t dpf_version   = DPF_VERSION;
+        char     checksum[16]  = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+        uint64_t patch_version = 0U;
+        uint64_t file_count    = 0U;
+
+        // V2+, DPF_FEATURE_* flags
+        // With DPF_FEATURE_TRAILER, checksum is 0 and the checksum of everything between
+        // the header checksum and the trailer is the last DPF_TRAILER_SIZE bytes of the file.
+        // With DPF_FEATURE_SEGMENTS, checksum covers the header and everything after the last entry.
+        uint32_t features      = 0U;
+
+        // DPF_FEATURE_DICTIONARY, stored after the header as uint32_t size + content
+        std::vector<uint8_t> dictionary;
+
+        /*
+            Size of the header on disk.
+        */
+        static size_t size(uint16_t version) {
+            return version == DPF_VERSION_1 ? 38U : 42U;
+        }
+    };
+
+    /*
+        Run of entries written at once, by a create or an append.
+
+        With DPF_FEATURE_SEGMENTS the file ends with a segment table:
+            dpf_segment segments[count]  -> in file order, the first starts after the header
+            uint64_t    count
+
+        Appending only hashes the new segment, earlier ones keep their checksum.
+    */
+    struct dpf_segment {
+        uint64_t end          = 0U;  // Offset after the last entry
+        char     checksum[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+        static constexpr size_t size = 24U;
+    };
+
+    /*
+        Index entry, with DPF_FEATURE_INDEX the index follows the last entry:
+            records, in entry order:
+                uint8_t  op
+                uint8_t  encoding
+                uint64_t decompressed_size
+                uint64_t compressed_size
+                uint64_t offset          -> of the entry
+                uint32_t checksum        -> DPF_FEATURE_CHECKSUMS, else 0
+            path table
+            uint64_t sorted[count]       -> record numbers, sorted by path
+            uint64_t index_offset
+            uint64_t count
+
+        The index comes before the segment table and trailer, when present.
+        DPF_FEATURE_INDEX and DPF_FEATURE_PATH_TABLE are always set together.
+
+        Entry checksums are CRC-32s of everything from the entry's offset to the next
+        entry or the index, so entries can be verified on their own.
+
+        Path table, paths in entry order, each sharing a prefix with the one before it:
+            uint64_t size                -> of the decoded table
+            uint64_t stored_size         -> deflated when smaller than size
+            uint8_t  table[stored_size]
+        Decoded table, for every path:
+            uint32_t prefix_size         -> leading characters of the previous path
+            uint32_t suffix_size
+            char     suffix[suffix_size]
+
+        With DPF_FEATURE_PATH_TABLE, entries written by this version leave their path empty.
+    */
+    struct dpf_index_record {
+        dpf_op       op                = dpf_op::undefined;
+        dpf_encoding encoding          = dpf_encoding::deflated;
+        uint64_t     decompressed_size = 0U;
+        uint64_t     compressed_size   = 0U;
+        uint64_t     offset            = 0U;
+        uint32_t     checksum          = 0U;
+        std::string  file_path         = "";
+
+        // Size on disk, without the path
+        static constexpr size_t size = 30U;
+    };
+
+    struct dpf_file_header {
+        dpf_op       op                = dpf_op::undefined;
+        uint64_t     file_path_size    = 0U;
+        std::string  file_path         = "";
+
+        // V2+, move and copy only
+        uint64_t     source_path_size  = 0U;
+        std::string  source_path       = "";
+
+        dpf_encoding encoding          = dpf_encoding::deflated;
+        uint64_t     decompressed_size = 0U;
+        uint64_t     compressed_size   = 0U;
+    };
+}
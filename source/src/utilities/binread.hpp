@@ -2,9 +2,15 @@
 
 #include "utilities/string.hpp"
 
+#include <miniz\miniz.h>
+
 #include <fstream>
 
 namespace libdpf {
+    /*
+        Binary reader that can keep a CRC-32 of everything read since start_crc.
+        Seeking skips bytes, they aren't part of the CRC.
+    */
     class binread {
     public:
         binread()               = delete;
@@ -42,6 +48,7 @@ namespace libdpf {
             m_stream.read((char*)&value, sizeof(T));
             m_pos = pos();
 
+            update_crc(&value, sizeof(T));
             return value;
         }
 
@@ -50,6 +57,8 @@ namespace libdpf {
 
             m_stream.read(ptr, size);
             m_pos = pos();
+
+            update_crc(ptr, size);
         }
 
         std::string read_str(std::size_t len) {
@@ -59,15 +68,32 @@ namespace libdpf {
             m_stream.read(value.data(), len);
             m_pos = pos();
 
+            update_crc(value.data(), len);
             return value;
         }
 
+        void start_crc() {
+            m_crc_enabled = true;
+            m_crc         = (uint32_t)MZ_CRC32_INIT;
+        }
+
+        uint32_t get_crc() const {
+            return m_crc;
+        }
+
     private:
         std::ifstream& m_stream;
-        size_t         m_size = 0U;
-        size_t         m_pos  = 0U;
+        size_t         m_size        = 0U;
+        size_t         m_pos         = 0U;
+        uint32_t       m_crc         = 0U;
+        bool           m_crc_enabled = false;
 
     private:
+        void update_crc(const void* ptr, size_t size) {
+            if (m_crc_enabled)
+                m_crc = (uint32_t)mz_crc32(m_crc, (const uint8_t*)ptr, size);
+        }
+
         void assert_can_read(std::size_t len) {
             auto pos = this->pos();
 
@@ -0,0 +1,185 @@
+#pragma once
+
+#include "libdpf/misc/dpf_output.hpp"
+#include "utilities/string.hpp"
+
+#include <md5\md5.hpp>
+#include <miniz\miniz.h>
+
+#include <fstream>
+#include <vector>
+#include <algorithm>
+
+namespace libdpf {
+    /*
+        Binary writer that keeps an MD5 digest of everything written past `hash_offset`,
+        and a CRC-32 of what's hashed since the last reset_crc.
+
+        Hashing can be suspended while a region is written out of order (back-patched).
+        On resume, the suspended region is read back and hashed, so keep it small.
+
+        Writing to a dpf_output is forward only, output is buffered until flush.
+    */
+    class binwrite {
+    public:
+        binwrite()                = delete;
+        binwrite(const binwrite&) = delete;
+        binwrite(binwrite&&)      = default;
+
+        /*
+            @param pos -> offset the stream is at, for writing past existing content
+        */
+        binwrite(std::fstream& stream, size_t hash_offset = 0U, size_t pos = 0U)
+            : m_stream(&stream), m_pos(pos), m_hash_pos(std::max(hash_offset, pos)) {}
+
+        binwrite(dpf_output& output, size_t hash_offset = 0U)
+            : m_output(&output), m_hash_pos(hash_offset) {}
+
+        binwrite& operator=(const binwrite&) = delete;
+        binwrite& operator=(binwrite&&)      = default;
+
+    public:
+        size_t pos() const {
+            return m_pos;
+        }
+
+        bool good() const {
+            return m_stream ? m_stream->good() : !m_failed;
+        }
+
+        template<typename T>
+        void write_num(const T& value) {
+            write_bytes(&value, sizeof(T));
+        }
+
+        void write_bytes(const void* ptr, size_t size) {
+            if (m_stream)
+                m_stream->write((const char*)ptr, size);
+            else
+                write_output(ptr, size);
+
+            if (!m_suspended && m_pos + size > m_hash_pos) {
+                size_t skip = m_hash_pos > m_pos ? m_hash_pos - m_pos : 0U;
+
+                m_md5.add((const char*)ptr + skip, size - skip);
+                m_crc      = (uint32_t)mz_crc32(m_crc, (const uint8_t*)ptr + skip, size - skip);
+                m_hash_pos = m_pos + size;
+            }
+
+            m_pos += size;
+        }
+
+        void write_str(const std::string& value) {
+            write_bytes(value.data(), value.size());
+        }
+
+        /*
+            Overwrite already written bytes without moving the write position.
+            Only allowed while hashing is suspended or before the hashed region.
+        */
+        void overwrite(size_t offset, const void* ptr, size_t size) {
+            if (!m_stream)
+                throw std::runtime_error("Tried to overwrite a forward only output.");
+
+            if (!m_suspended && offset + size > m_hash_pos)
+                throw std::runtime_error(DPF_FORMAT("Tried to overwrite hashed bytes. | Offset: {:x} Len: {}", offset, size));
+
+            m_stream->seekp(offset, std::ios::beg);
+            m_stream->write((const char*)ptr, size);
+            m_stream->seekp(m_pos, std::ios::beg);
+        }
+
+        void suspend_hash() {
+            m_suspended = true;
+        }
+
+        /*
+            Resume hashing, reading back anything written while suspended.
+        */
+        void resume_hash() {
+            m_suspended = false;
+
+            if (m_hash_pos >= m_pos)
+                return;
+
+            if (!m_stream)
+                throw std::runtime_error("Tried to read back a forward only output.");
+
+            std::vector<char> block(std::min<size_t>(m_pos - m_hash_pos, 1024U * 1024U));
+
+            m_stream->flush();
+            m_stream->seekg(m_hash_pos, std::ios::beg);
+
+            while (m_hash_pos < m_pos) {
+                size_t size = std::min<size_t>(m_pos - m_hash_pos, block.size());
+
+                m_stream->read(block.data(), size);
+
+                if ((size_t)m_stream->gcount() != size)
+                    throw std::runtime_error(DPF_FORMAT("Failed to read back written bytes. | Offset: {:x} Len: {}", m_hash_pos, size));
+
+                m_md5.add(block.data(), size);
+                m_crc       = (uint32_t)mz_crc32(m_crc, (const uint8_t*)block.data(), size);
+                m_hash_pos += size;
+            }
+
+            m_stream->seekp(m_pos, std::ios::beg);
+        }
+
+        /*
+            Hand buffered bytes to the output.
+        */
+        bool flush() {
+            if (m_stream) {
+                m_stream->flush();
+                return m_stream->good();
+            }
+
+            if (!m_buffer.empty()) {
+                m_failed = m_failed || !m_output->write(m_buffer.data(), m_buffer.size());
+                m_buffer.clear();
+            }
+
+            return !m_failed;
+        }
+
+        void get_hash(unsigned char* md5) {
+            m_md5.getHash(md5);
+        }
+
+        void reset_crc() {
+            m_crc = (uint32_t)MZ_CRC32_INIT;
+        }
+
+        /*
+            Only complete once hashing is resumed.
+        */
+        uint32_t get_crc() const {
+            return m_crc;
+        }
+
+    private:
+        static constexpr size_t buffer_size = 1024U * 1024U;
+
+        std::fstream*        m_stream    = nullptr;
+        dpf_output*          m_output    = nullptr;
+        std::vector<uint8_t> m_buffer;
+        MD5                  m_md5;
+        uint32_t             m_crc       = 0U;
+        size_t               m_pos       = 0U;
+        size_t               m_hash_pos  = 0U;
+        bool                 m_suspended = false;
+        bool                 m_failed    = false;
+
+    private:
+        void write_output(const void* ptr, size_t size) {
+            if (m_buffer.size() + size > buffer_size)
+                flush();
+
+            if (size >= buffer_size)
+                m_failed = m_failed || !m_output->write((const uint8_t*)ptr, size);
+            else
+                m_buffer.insert(m_buffer.end(), (const uint8_t*)ptr, (const uint8_t*)ptr + size);
+        }
+    };
+}
@@ -0,0 +1,279 @@
+#include "utilities/blob_cache.hpp"
+
+#include <md5\md5.hpp>
+#include <miniz\miniz.h>
+
+#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <random>
+
+// Bumped when the blob layout or compressor output changes
+#define BLOB_CACHE_VERSION 2U
+#define BLOB_EXTENSION     ".blob"
+
+// u64 size, u32 CRC-32 after the content
+#define BLOB_FOOTER_SIZE   (sizeof(uint64_t) + sizeof(uint32_t))
+#define BLOB_BLOCK_SIZE    (64U * 1024U)
+
+using namespace libdpf;
+
+///////////////////////////////////////////////////////////////////////////////
+// INTERNAL
+
+static std::string internal_to_hex(const unsigned char* data, size_t size) {
+    static const char digits[] = "0123456789abcdef";
+
+    std::string hex;
+    hex.reserve(size * 2U);
+
+    for (size_t i = 0; i < size; i++) {
+        hex.push_back(digits[data[i] >> 4]);
+        hex.push_back(digits[data[i] & 0x0F]);
+    }
+
+    return hex;
+}
+
+static bool internal_read_footer(std::ifstream& fin, uint64_t file_size, uint64_t& size, uint32_t& crc) {
+    if (file_size < BLOB_FOOTER_SIZE)
+        return false;
+
+    fin.seekg(file_size - BLOB_FOOTER_SIZE, std::ios::beg);
+    fin.read((char*)&size, sizeof(size));
+    fin.read((char*)&crc, sizeof(crc));
+
+    return fin.good() && size == file_size - BLOB_FOOTER_SIZE;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// PUBLIC
+
+blob_cache::blob_cache(const std::filesystem::path& dir, uint64_t max_size)
+    : m_dir(dir), m_max_size(max_size) {}
+
+bool blob_cache::is_enabled() const {
+    return m_dir != "";
+}
+
+std::string blob_cache::get_key(const unsigned char* content_md5, uint8_t encoding,
+    const dpf_compression& compression, const std::vector<uint8_t>& dictionary)
+{
+    uint8_t settings[] = {
+        BLOB_CACHE_VERSION,
+        encoding,
+        (uint8_t)compression.level,
+        (uint8_t)compression.strategy
+    };
+
+    MD5 md5;
+    md5.add(content_md5, 16U);
+    md5.add(settings, sizeof(settings));
+
+    if (!dictionary.empty())
+        md5.add(dictionary.data(), dictionary.size());
+
+    unsigned char key[16];
+    md5.getHash(key);
+
+    return internal_to_hex(key, sizeof(key));
+}
+
+bool blob_cache::load(const std::string& key, std::vector<uint8_t>& data) const {
+    std::filesystem::path path = find(key);
+
+    if (path == "")
+        return false;
+
+    std::ifstream fin(path, std::ios::binary);
+
+    if (!fin.is_open())
+        return false;
+
+    fin.seekg(0, std::ios::end);
+
+    uint64_t size = 0U;
+    uint32_t crc  = 0U;
+
+    if (!internal_read_footer(fin, (uint64_t)fin.tellg(), size, crc))
+        return false;
+
+    data.resize((size_t)size);
+
+    fin.seekg(0, std::ios::beg);
+    fin.read((char*)data.data(), data.size());
+
+    return (size_t)fin.gcount() == data.size() && get_crc(0U, data.data(), data.size()) == crc;
+}
+
+bool blob_cache::open(const std::string& key, std::ifstream& fin, uint64_t& size) const {
+    std::filesystem::path path = find(key);
+
+    if (path == "")
+        return false;
+
+    fin.open(path, std::ios::binary);
+
+    if (!fin.is_open())
+        return false;
+
+    fin.seekg(0, std::ios::end);
+
+    uint32_t crc = 0U;
+
+    if (!internal_read_footer(fin, (uint64_t)fin.tellg(), size, crc)) {
+        fin.close();
+        return false;
+    }
+
+    // Verified before anything is copied out of it
+
+    std::vector<uint8_t> block(BLOB_BLOCK_SIZE);
+    uint32_t             real_crc = 0U;
+
+    fin.seekg(0, std::ios::beg);
+
+    for (uint64_t remaining = size; remaining;) {
+        size_t block_size = (size_t)std::min<uint64_t>(remaining, block.size());
+
+        fin.read((char*)block.data(), block_size);
+
+        if ((size_t)fin.gcount() != block_size) {
+            fin.close();
+            return false;
+        }
+
+        real_crc   = get_crc(real_crc, block.data(), block_size);
+        remaining -= block_size;
+    }
+
+    if (real_crc != crc) {
+        fin.close();
+        return false;
+    }
+
+    fin.seekg(0, std::ios::beg);
+    return true;
+}
+
+std::filesystem::path blob_cache::find(const std::string& key) const {
+    std::error_code       ec;
+    std::filesystem::path path = get_path(key);
+
+    if (!std::filesystem::is_regular_file(path, ec))
+        return "";
+
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+
+    return path;
+}
+
+void blob_cache::store(const std::string& key, const uint8_t* data, size_t size) const {
+    std::filesystem::path temp_path = get_temp_path(key);
+
+    {
+        std::ofstream fout(temp_path, std::ios::binary);
+        fout.write((const char*)data, size);
+
+        if (!fout.good()) {
+            fout.close();
+
+            std::error_code ec;
+            std::filesystem::remove(temp_path, ec);
+            return;
+        }
+    }
+
+    commit(temp_path, key, size, get_crc(0U, data, size));
+}
+
+std::filesystem::path blob_cache::get_temp_path(const std::string& key) const {
+    static std::atomic_uint64_t counter = 0U;
+    static const uint64_t       process = std::random_device()();
+
+    std::error_code ec;
+    std::filesystem::create_directories(get_path(key).parent_path(), ec);
+
+    return get_path(key).replace_extension(internal_to_hex((const unsigned char*)&process, sizeof(process)) + "_" +
+        std::to_string(counter++) + ".tmp");
+}
+
+void blob_cache::commit(const std::filesystem::path& temp_path, const std::string& key, uint64_t size, uint32_t crc) const {
+    std::error_code ec;
+
+    {
+        std::ofstream fout(temp_path, std::ios::binary | std::ios::app);
+        fout.write((const char*)&size, sizeof(size));
+        fout.write((const char*)&crc, sizeof(crc));
+
+        if (!fout.good()) {
+            fout.close();
+            std::filesystem::remove(temp_path, ec);
+            return;
+        }
+    }
+
+    std::filesystem::rename(temp_path, get_path(key), ec);
+
+    if (ec)
+        std::filesystem::remove(temp_path, ec);
+}
+
+uint32_t blob_cache::get_crc(uint32_t crc, const uint8_t* data, size_t size) {
+    return (uint32_t)mz_crc32(crc, data, size);
+}
+
+void blob_cache::trim() const {
+    struct blob_t {
+        std::filesystem::path           path;
+        uint64_t                        size;
+        std::filesystem::file_time_type time;
+    };
+
+    std::vector<blob_t> blobs;
+    uint64_t            total_size = 0U;
+    std::error_code     ec;
+
+    auto it = std::filesystem::recursive_directory_iterator(m_dir, ec);
+
+    for (; !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+        if (!it->is_regular_file(ec) || it->path().extension() != BLOB_EXTENSION)
+            continue;
+
+        blob_t blob;
+        blob.path = it->path();
+        blob.size = it->file_size(ec);
+        blob.time = it->last_write_time(ec);
+
+        if (ec) {
+            ec.clear();
+            continue;
+        }
+
+        total_size += blob.size;
+        blobs.push_back(std::move(blob));
+    }
+
+    if (total_size <= m_max_size)
+        return;
+
+    std::sort(blobs.begin(), blobs.end(), [](const blob_t& a, const blob_t& b) {
+        return a.time < b.time;
+    });
+
+    for (const blob_t& blob : blobs) {
+        if (total_size <= m_max_size)
+            break;
+
+        if (std::filesystem::remove(blob.path, ec))
+            total_size -= blob.size;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// PRIVATE
+
+std::filesystem::path blob_cache::get_path(const std::string& key) const {
+    // Spread over 256 directories
+    return m_dir / key.substr(0, 2) / (key + BLOB_EXTENSION);
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "libdpf/misc/dpf_compression.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+namespace libdpf {
+    /*
+        On-disk cache of compressed content shared between create calls.
+
+        Blobs are keyed by the MD5 of the uncompressed content together with everything
+        that affects the compressed bytes (encoding, level, strategy, dictionary).
+        Blobs are written to a temporary file and renamed, so concurrent creates sharing
+        a directory never see partial blobs. Last write time marks the last use.
+        Blobs end with their size and CRC-32, damaged blobs are treated as missing.
+    */
+    class blob_cache {
+    public:
+        blob_cache() = default;
+        blob_cache(const std::filesystem::path& dir, uint64_t max_size);
+
+    public:
+        bool is_enabled() const;
+
+        /*
+            Get the key of content compressed with the given settings.
+        */
+        static std::string get_key(const unsigned char* content_md5, uint8_t encoding,
+            const dpf_compression& compression, const std::vector<uint8_t>& dictionary);
+
+        /*
+            Load a blob and mark it as used.
+
+            @returns TRUE if found, FALSE otherwise
+        */
+        bool load(const std::string& key, std::vector<uint8_t>& data) const;
+
+        /*
+            Open a blob for reading and mark it as used.
+            The blob is verified first, fin is left at its start.
+
+            Once open, the blob stays readable even if another create evicts it.
+
+            @returns TRUE if found, FALSE otherwise
+        */
+        bool open(const std::string& key, std::ifstream& fin, uint64_t& size) const;
+
+        /*
+            Store a blob. Failures are ignored, the cache is only an optimization.
+        */
+        void store(const std::string& key, const uint8_t* data, size_t size) const;
+
+        /*
+            Get a unique temporary path to write a blob to, see commit.
+        */
+        std::filesystem::path get_temp_path(const std::string& key) const;
+
+        /*
+            Move a blob written to a temporary path into the cache.
+            size and crc are of what was written, see get_crc.
+        */
+        void commit(const std::filesystem::path& temp_path, const std::string& key, uint64_t size, uint32_t crc) const;
+
+        /*
+            Update the CRC-32 of a blob being written, starting from 0.
+        */
+        static uint32_t get_crc(uint32_t crc, const uint8_t* data, size_t size);
+
+        /*
+            Remove least recently used blobs until the cache fits into max_size.
+        */
+        void trim() const;
+
+    private:
+        std::filesystem::path m_dir      = "";
+        uint64_t              m_max_size = 0U;
+
+    private:
+        std::filesystem::path get_path(const std::string& key) const;
+        std::filesystem::path find(const std::string& key) const;
+    };
+}
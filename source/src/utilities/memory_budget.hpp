@@ -0,0 +1,92 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+namespace libdpf {
+    /*
+        Byte budget shared by everything that buffers content at the same time.
+
+        Buffers are acquired in ticket order, so the lowest ticket still waiting
+        always gets memory first and ordered consumers can't starve it.
+        Every ticket in [0, n) has to be acquired once, even with 0 bytes.
+        Requests larger than the limit are clamped to it and wait until nothing else is held.
+        A limit of 0 disables the budget.
+    */
+    class memory_budget {
+    public:
+        memory_budget(uint64_t limit)
+            : m_limit(limit) {}
+
+        memory_budget(const memory_budget&) = delete;
+        memory_budget& operator=(const memory_budget&) = delete;
+
+    public:
+        bool is_enabled() const {
+            return m_limit != 0U;
+        }
+
+        /*
+            Wait for the turn of `ticket` and for `bytes` to be available.
+
+            @returns TRUE once acquired, FALSE if the budget was stopped
+        */
+        bool acquire(size_t ticket, uint64_t bytes) {
+            if (!is_enabled())
+                return true;
+
+            bytes = std::min(bytes, m_limit);
+
+            {
+                std::unique_lock lock(m_mutex);
+                m_cv.wait(lock, [&] { return m_stop || (m_next == ticket && m_used + bytes <= m_limit); });
+
+                if (m_stop)
+                    return false;
+
+                m_used += bytes;
+                m_next++;
+            }
+
+            m_cv.notify_all();
+            return true;
+        }
+
+        /*
+            Return bytes acquired earlier.
+        */
+        void release(uint64_t bytes) {
+            if (!is_enabled())
+                return;
+
+            {
+                std::lock_guard lock(m_mutex);
+                m_used -= std::min({ bytes, m_limit, m_used });
+            }
+
+            m_cv.notify_all();
+        }
+
+        /*
+            Fail current and future acquires, used when work stops early.
+        */
+        void stop() {
+            {
+                std::lock_guard lock(m_mutex);
+                m_stop = true;
+            }
+
+            m_cv.notify_all();
+        }
+
+    private:
+        std::mutex              m_mutex;
+        std::condition_variable m_cv;
+        uint64_t                m_limit = 0U;
+        uint64_t                m_used  = 0U;
+        size_t                  m_next  = 0U;
+        bool                    m_stop  = false;
+    };
+}
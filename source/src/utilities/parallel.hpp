@@ -0,0 +1,130 @@
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace libdpf {
+    /*
+        Run `work(index, value)` for every index in [0, count) on `threads` workers
+        and hand the results to `consume(index, value)` on the calling thread in index order.
+
+        At most `window` results are in flight at once.
+        Consuming stops early when `consume` returns false.
+        Exceptions thrown by `work` are rethrown on the calling thread in index order.
+    */
+    template<typename T, typename Work, typename Consume>
+    void parallel_ordered(size_t count, size_t threads, size_t window, Work&& work, Consume&& consume) {
+        if (threads <= 1 || count <= 1) {
+            for (size_t i = 0; i < count; i++) {
+                T value{};
+                work(i, value);
+
+                if (!consume(i, value))
+                    return;
+            }
+
+            return;
+        }
+
+        struct slot_t {
+            std::optional<T>   value;
+            std::exception_ptr error = nullptr;
+        };
+
+        window = window < threads ? threads : window;
+
+        std::mutex              mutex;
+        std::condition_variable cv_ready;
+        std::condition_variable cv_space;
+        std::vector<slot_t>     slots(window);
+        size_t                  next     = 0U;
+        size_t                  consumed = 0U;
+        bool                    stop     = false;
+
+        auto worker = [&] {
+            while (true) {
+                size_t index = 0U;
+
+                {
+                    std::unique_lock lock(mutex);
+                    cv_space.wait(lock, [&] { return stop || next >= count || next < consumed + window; });
+
+                    if (stop || next >= count)
+                        return;
+
+                    index = next++;
+                }
+
+                slot_t slot;
+
+                try {
+                    T value{};
+                    work(index, value);
+                    slot.value = std::move(value);
+                }
+                catch (...) {
+                    slot.error = std::current_exception();
+                }
+
+                {
+                    std::lock_guard lock(mutex);
+                    slots[index % window] = std::move(slot);
+                }
+
+                cv_ready.notify_all();
+            }
+        };
+
+        std::vector<std::thread> workers;
+
+        auto join = [&] {
+            {
+                std::lock_guard lock(mutex);
+                stop = true;
+            }
+
+            cv_space.notify_all();
+
+            for (auto& t : workers)
+                t.join();
+
+            workers.clear();
+        };
+
+        try {
+            for (size_t i = 0; i < threads; i++)
+                workers.emplace_back(worker);
+
+            for (size_t i = 0; i < count; i++) {
+                slot_t slot;
+
+                {
+                    std::unique_lock lock(mutex);
+                    cv_ready.wait(lock, [&] { return slots[i % window].value.has_value() || slots[i % window].error; });
+
+                    slot = std::move(slots[i % window]);
+                    slots[i % window] = slot_t();
+                    consumed++;
+                }
+
+                cv_space.notify_all();
+
+                if (slot.error)
+                    std::rethrow_exception(slot.error);
+
+                if (!consume(i, *slot.value))
+                    break;
+            }
+        }
+        catch (...) {
+            join();
+            throw;
+        }
+
+        join();
+    }
+}
@@ -0,0 +1,277 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace libdpf {
+    /*
+        FIFO queue that blocks producers while full and consumers while empty.
+        Once closed, push fails and pop drains what's left.
+    */
+    template<typename T>
+    class bounded_queue {
+    public:
+        bounded_queue(size_t capacity)
+            : m_capacity(capacity ? capacity : 1U) {}
+
+    public:
+        bool push(T value) {
+            {
+                std::unique_lock lock(m_mutex);
+                m_cv_space.wait(lock, [&] { return m_closed || m_items.size() < m_capacity; });
+
+                if (m_closed)
+                    return false;
+
+                m_items.push_back(std::move(value));
+            }
+
+            m_cv_ready.notify_one();
+            return true;
+        }
+
+        bool pop(T& value) {
+            {
+                std::unique_lock lock(m_mutex);
+                m_cv_ready.wait(lock, [&] { return m_closed || !m_items.empty(); });
+
+                if (m_items.empty())
+                    return false;
+
+                value = std::move(m_items.front());
+                m_items.pop_front();
+            }
+
+            m_cv_space.notify_one();
+            return true;
+        }
+
+        void close() {
+            {
+                std::lock_guard lock(m_mutex);
+                m_closed = true;
+            }
+
+            m_cv_ready.notify_all();
+            m_cv_space.notify_all();
+        }
+
+    private:
+        std::mutex              m_mutex;
+        std::condition_variable m_cv_ready;
+        std::condition_variable m_cv_space;
+        std::deque<T>           m_items;
+        size_t                  m_capacity = 1U;
+        bool                    m_closed   = false;
+    };
+
+    /*
+        Thread that runs `process(value)` for every pushed value, in push order.
+
+        At most `capacity` values wait to be processed.
+        Processing stops when `process` returns false or throws, later values are dropped.
+        Values still queued on destruction are dropped, use finish to process them.
+    */
+    template<typename T>
+    class pipeline_stage {
+    public:
+        template<typename Process>
+        pipeline_stage(size_t capacity, Process&& process)
+            : m_queue(capacity)
+        {
+            m_thread = std::thread([this, process = std::forward<Process>(process)]() mutable {
+                T value;
+
+                while (m_queue.pop(value)) {
+                    bool keep = false;
+
+                    if (!m_aborted) {
+                        try {
+                            keep = process(value);
+                        }
+                        catch (...) {
+                            m_error = std::current_exception();
+                        }
+                    }
+
+                    {
+                        std::lock_guard lock(m_mutex);
+                        m_processed++;
+                        m_stopped |= !keep;
+                    }
+
+                    m_cv_processed.notify_all();
+
+                    if (!keep) {
+                        m_queue.close();
+                        break;
+                    }
+                }
+            });
+        }
+
+        pipeline_stage(const pipeline_stage&) = delete;
+        pipeline_stage& operator=(const pipeline_stage&) = delete;
+
+        ~pipeline_stage() {
+            m_aborted = true;
+            finish();
+        }
+
+    public:
+        /*
+            @returns TRUE if queued, FALSE if processing stopped
+        */
+        bool push(T value) {
+            if (!m_queue.push(std::move(value)))
+                return false;
+
+            std::lock_guard lock(m_mutex);
+            m_pushed++;
+
+            return true;
+        }
+
+        /*
+            Wait until everything pushed so far is processed.
+
+            @returns TRUE if processing is still running, FALSE if it stopped
+        */
+        bool flush() {
+            std::unique_lock lock(m_mutex);
+            m_cv_processed.wait(lock, [&] { return m_stopped || m_processed >= m_pushed; });
+
+            return !m_stopped;
+        }
+
+        /*
+            Process what's queued and stop the thread.
+        */
+        void finish() {
+            m_queue.close();
+
+            if (m_thread.joinable())
+                m_thread.join();
+        }
+
+        /*
+            Exception thrown by `process`, if any. Only safe to check after finish.
+        */
+        std::exception_ptr get_error() const {
+            return m_error;
+        }
+
+    private:
+        bounded_queue<T>        m_queue;
+        std::mutex              m_mutex;
+        std::condition_variable m_cv_processed;
+        size_t                  m_pushed    = 0U;
+        size_t                  m_processed = 0U;
+        bool                    m_stopped   = false;
+        std::atomic_bool        m_aborted   = false;
+        std::exception_ptr      m_error     = nullptr;
+        std::thread             m_thread;
+    };
+
+    /*
+        Thread that runs `load(index, value)` for indices [0, count) in order,
+        at most `depth` ahead of the values taken with take.
+
+        Every index has to be taken at most once, in any order.
+        Values that fail to load are left default constructed.
+    */
+    template<typename T>
+    class ordered_prefetch {
+    public:
+        template<typename Load>
+        ordered_prefetch(size_t count, size_t depth, Load&& load)
+            : m_slots(depth ? depth : 1U)
+        {
+            m_thread = std::thread([this, count, load = std::forward<Load>(load)]() mutable {
+                for (size_t i = 0; i < count; i++) {
+                    slot_t& slot = m_slots[i % m_slots.size()];
+
+                    {
+                        std::unique_lock lock(m_mutex);
+                        m_cv.wait(lock, [&] { return m_stop || !slot.value; });
+
+                        if (m_stop)
+                            return;
+                    }
+
+                    T value{};
+
+                    try {
+                        load(i, value);
+                    }
+                    catch (...) {
+                        value = T{};
+                    }
+
+                    {
+                        std::lock_guard lock(m_mutex);
+                        slot.index = i;
+                        slot.value = std::move(value);
+                    }
+
+                    m_cv.notify_all();
+                }
+            });
+        }
+
+        ordered_prefetch(const ordered_prefetch&) = delete;
+        ordered_prefetch& operator=(const ordered_prefetch&) = delete;
+
+        ~ordered_prefetch() {
+            {
+                std::lock_guard lock(m_mutex);
+                m_stop = true;
+            }
+
+            m_cv.notify_all();
+            m_thread.join();
+        }
+
+    public:
+        /*
+            Wait for the value of `index` and take it.
+        */
+        T take(size_t index) {
+            T value{};
+
+            {
+                slot_t& slot = m_slots[index % m_slots.size()];
+
+                std::unique_lock lock(m_mutex);
+                m_cv.wait(lock, [&] { return m_stop || (slot.value && slot.index == index); });
+
+                if (m_stop)
+                    return value;
+
+                value = std::move(*slot.value);
+                slot.value.reset();
+            }
+
+            m_cv.notify_all();
+            return value;
+        }
+
+    private:
+        struct slot_t {
+            size_t           index = 0U;
+            std::optional<T> value;
+        };
+
+        std::mutex              m_mutex;
+        std::condition_variable m_cv;
+        std::vector<slot_t>     m_slots;
+        bool                    m_stop = false;
+        std::thread             m_thread;
+    };
+}
@@ -0,0 +1,98 @@
+#include "utilities/progress_tracker.hpp"
+
+#include <algorithm>
+
+using namespace libdpf;
+
+///////////////////////////////////////////////////////////////////////////////
+// PUBLIC
+
+void progress_tracker::start(uint64_t entries_total, uint64_t bytes_total, uint32_t interval_ms, report_fn_t report) {
+    m_bytes         = 0U;
+    m_entries       = 0U;
+    m_bytes_total   = bytes_total;
+    m_entries_total = entries_total;
+    m_interval      = std::chrono::duration_cast<clock_t::duration>(std::chrono::milliseconds(interval_ms)).count();
+    m_report        = std::move(report);
+
+    std::lock_guard lock(m_report_mutex);
+
+    m_progress      = {};
+    m_last_time     = clock_t::now();
+    m_percent       = 0.0f;
+    m_next_report   = m_last_time.time_since_epoch().count() + m_interval;
+}
+
+void progress_tracker::add(uint64_t bytes, uint64_t entries, const std::string& entry) {
+    m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    m_entries.fetch_add(entries, std::memory_order_relaxed);
+
+    if (!m_report)
+        return;
+
+    // The first thread past the deadline moves it and reports, others carry on
+
+    int64_t now  = clock_t::now().time_since_epoch().count();
+    int64_t next = m_next_report.load(std::memory_order_relaxed);
+
+    if (now < next || !m_next_report.compare_exchange_strong(next, now + m_interval, std::memory_order_relaxed))
+        return;
+
+    report(entry, false);
+}
+
+void progress_tracker::finish() {
+    if (m_report)
+        report(m_progress.current_entry, true);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// PRIVATE
+
+void progress_tracker::report(const std::string& entry, bool force) {
+    std::unique_lock lock(m_report_mutex, std::defer_lock);
+
+    if (force)
+        lock.lock();
+    else if (!lock.try_lock())
+        return;
+
+    clock_t::time_point now     = clock_t::now();
+    double              elapsed = std::chrono::duration<double>(now - m_last_time).count();
+    uint64_t            bytes   = m_bytes.load(std::memory_order_relaxed);
+    uint64_t            entries = m_entries.load(std::memory_order_relaxed);
+
+    // Throughput is smoothed over reports so short stalls don't swing the estimate
+
+    if (elapsed > 0.0 && bytes >= m_progress.bytes_processed) {
+        double rate = (double)(bytes - m_progress.bytes_processed) / elapsed;
+
+        m_progress.bytes_per_second = m_progress.entries_processed || m_progress.bytes_processed ?
+            m_progress.bytes_per_second * 0.7 + rate * 0.3 : rate;
+    }
+
+    m_progress.bytes_processed   = bytes;
+    m_progress.bytes_total       = std::max(m_bytes_total, bytes);
+    m_progress.entries_processed = entries;
+    m_progress.entries_total     = m_entries_total;
+    m_progress.current_entry     = entry;
+    m_progress.eta_seconds       = m_progress.bytes_per_second > 0.0 ?
+        (double)(m_progress.bytes_total - bytes) / m_progress.bytes_per_second : -1.0;
+
+    m_last_time = now;
+
+    // Percent counts every entry as one byte, so entries without content still move it
+
+    float percent = 100.0f;
+
+    if (m_progress.bytes_total + m_entries_total)
+        percent = (float)(100.0 * (double)(bytes + entries) / (double)(m_progress.bytes_total + m_entries_total));
+
+    if (force)
+        percent = 100.0f;
+
+    float change = std::max(percent - m_percent, 0.0f);
+    m_percent   += change;
+
+    m_report(m_progress, change);
+}
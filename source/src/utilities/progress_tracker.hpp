@@ -0,0 +1,66 @@
+#pragma once
+
+#include "libdpf/misc/dpf_progress.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <cstdint>
+
+namespace libdpf {
+    /*
+        Byte and entry counters that report at most once per interval.
+
+        Counters are atomic, so work on any thread can add to them without locking.
+        Only the thread that crosses the interval reports, reports never overlap.
+    */
+    class progress_tracker {
+    public:
+        using report_fn_t = std::function<void(const dpf_progress& progress, float change)>;
+
+    public:
+        progress_tracker() = default;
+
+        progress_tracker(const progress_tracker&) = delete;
+        progress_tracker& operator=(const progress_tracker&) = delete;
+
+    public:
+        /*
+            Reset counters and start reporting to `report`.
+            `change` passed to it is the progress change in percent, weighted by bytes.
+
+            @param interval_ms -> minimum time between reports, 0 reports every change
+        */
+        void start(uint64_t entries_total, uint64_t bytes_total, uint32_t interval_ms, report_fn_t report);
+
+        void add(uint64_t bytes, uint64_t entries, const std::string& entry);
+
+        /*
+            Report final counters regardless of the interval.
+        */
+        void finish();
+
+    private:
+        using clock_t = std::chrono::steady_clock;
+
+        std::atomic<uint64_t> m_bytes       = 0U;
+        std::atomic<uint64_t> m_entries     = 0U;
+        std::atomic<int64_t>  m_next_report = 0;
+
+        uint64_t              m_bytes_total   = 0U;
+        uint64_t              m_entries_total = 0U;
+        int64_t               m_interval      = 0;
+        report_fn_t           m_report        = nullptr;
+
+        // Guarded by m_report_mutex
+        std::mutex            m_report_mutex;
+        dpf_progress          m_progress;
+        clock_t::time_point   m_last_time;
+        float                 m_percent = 0.0f;
+
+    private:
+        void report(const std::string& entry, bool force);
+    };
+}
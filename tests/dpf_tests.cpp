@@ -2,10 +2,15 @@
 
 #include <gtest/gtest.h>
 #include <fstream>
+#include <iostream>
 #include <string>
+#include <chrono>
 #include <algorithm>
 #include <filesystem>
 #include <vector>
+#include <cstring>
+#include <atomic>
+#include <thread>
 
 using namespace libdpf;
 
@@ -30,8 +35,7 @@ static bool compare_files(const std::string& p1, const std::string& p2) {
         std::istreambuf_iterator<char>(f2.rdbuf()));
 }
 
-static bool create_patch_file(const std::string& base) {
-    dpf        dpf;
+static dpf_inputs get_patch_inputs(const std::string& base) {
     dpf_inputs inputs;
 
     inputs.base_path = std::string(base) + std::string("/resources/patch");
@@ -48,11 +52,61 @@ static bool create_patch_file(const std::string& base) {
         { std::string(base) + std::string("/resources/patch/subfolder/3.txt"), dpf_op::remove }
     );
 
-    auto result = dpf.create(inputs, "./patch.dpf");
+    return inputs;
+}
+
+static bool create_patch_file(dpf_inputs& inputs, const std::string& file = PATCH_FILE, dpf_context* context = nullptr) {
+    dpf dpf;
+
+    auto result = dpf.create(inputs, file, context);
 
     return result.status == dpf_status::ok;
 }
 
+static bool create_patch_file(const std::string& base, const std::string& file = PATCH_FILE, dpf_context* context = nullptr) {
+    dpf_inputs inputs = get_patch_inputs(base);
+    return create_patch_file(inputs, file, context);
+}
+
+static bool write_file(const std::filesystem::path& file, const std::vector<uint8_t>& buffer) {
+    std::filesystem::create_directories(std::filesystem::path(file).remove_filename());
+
+    std::ofstream fout(file, std::ios::binary);
+    fout.write((const char*)buffer.data(), buffer.size());
+
+    return fout.good();
+}
+
+// Write file content and add it to inputs
+static bool add_file(dpf_inputs& inputs, const std::filesystem::path& file, const std::vector<uint8_t>& buffer) {
+    inputs.files.push_back({ file, dpf_op::add });
+    return write_file(file, buffer);
+}
+
+// Added files of inputs match the ones patched into dir
+static bool compare_patched(const dpf_inputs& inputs, const std::filesystem::path& dir) {
+    for (auto& file : inputs.files) {
+        auto relative = std::filesystem::relative(file.path, inputs.base_path);
+
+        if (file.op == dpf_op::add && !compare_files((dir / relative).string(), file.path.string()))
+            return false;
+    }
+
+    return true;
+}
+
+// Deterministic pseudo random byte
+static uint8_t next_random(uint32_t& seed) {
+    seed = seed * 1664525U + 1013904223U;
+    return (uint8_t)(seed >> 24);
+}
+
+// Pseudo random bytes, or letters from 'a' when alphabet isn't 0
+static void fill_random(std::vector<uint8_t>& buffer, uint32_t& seed, uint32_t alphabet = 0U) {
+    for (auto& byte : buffer)
+        byte = alphabet ? (uint8_t)('a' + next_random(seed) % alphabet) : next_random(seed);
+}
+
 static bool copy_directory(const std::filesystem::path& source, const std::filesystem::path& destination) {
     try {
         if (std::filesystem::exists(source) && std::filesystem::is_directory(source)) {
@@ -82,6 +136,61 @@ static bool copy_directory(const std::filesystem::path& source, const std::files
     return true;
 }
 
+static bool apply_patch_file(const std::string& file, const std::string& dir, dpf_context* context = nullptr) {
+    dpf dpf;
+
+    std::filesystem::remove_all(dir);
+
+    if (!copy_directory(std::string(BASE_PATH) + std::string("/resources/original/"), dir))
+        return false;
+
+    auto result = dpf.patch(file, dir, context);
+
+    return result.status == dpf_status::ok &&
+        compare_files(dir + "/1.txt", std::string(BASE_PATH) + std::string("/resources/patch/1.txt")) &&
+        compare_files(dir + "/subfolder/2.txt", std::string(BASE_PATH) + std::string("/resources/patch/subfolder/2.txt")) &&
+        !std::filesystem::exists(dir + "/subfolder/3.txt");
+}
+
+// Large random file with a few edits, so that a delta is much smaller than the file
+static dpf_inputs get_delta_inputs() {
+    dpf_inputs           inputs;
+    std::vector<uint8_t> original(256U * 1024U);
+    uint32_t             seed = 12345U;
+
+    fill_random(original, seed);
+
+    std::vector<uint8_t> modified = original;
+
+    modified[1000] ^= 0xFF;
+    modified.erase(modified.begin() + 5000, modified.begin() + 5100);
+    modified.insert(modified.begin() + 100000, 64, 'x');
+
+    std::filesystem::remove_all("./delta/");
+
+    write_file("./delta/original/file.bin", original);
+    write_file("./delta/modified/file.bin", modified);
+
+    inputs.base_path     = "./delta/modified";
+    inputs.original_path = "./delta/original";
+    inputs.files.push_back({ "./delta/modified/file.bin", dpf_op::modify });
+
+    return inputs;
+}
+
+static bool apply_delta_patch_file(const std::string& file) {
+    dpf dpf;
+
+    std::filesystem::remove_all("./delta/to_patch/");
+    std::filesystem::create_directories("./delta/to_patch/");
+    std::filesystem::copy_file("./delta/original/file.bin", "./delta/to_patch/file.bin");
+
+    auto result = dpf.patch(file, "./delta/to_patch/");
+
+    return result.status == dpf_status::ok &&
+        compare_files("./delta/to_patch/file.bin", "./delta/modified/file.bin");
+}
+
 TEST(dpf, patching) {
     dpf dpf;
 
@@ -123,3 +232,1222 @@ TEST(dpf, is_dpf_file) {
     ASSERT_TRUE(dpf.is_dpf_file(PATCH_FILE));
     ASSERT_FALSE(dpf.is_dpf_file(std::string(BASE_PATH) + std::string("/resources/patch/1.txt")));
 }
+
+TEST(dpf, parallel_create) {
+    dpf_context context;
+
+    context.thread_count = 4U;
+
+    ASSERT_TRUE(create_patch_file(BASE_PATH));
+    ASSERT_TRUE(create_patch_file(BASE_PATH, "./patch_parallel.dpf", &context));
+    ASSERT_TRUE(compare_files(PATCH_FILE, "./patch_parallel.dpf"));
+}
+
+TEST(dpf, streaming) {
+    dpf         dpf;
+    dpf_context context;
+
+    context.streaming_threshold = 0U;
+
+    // Streamed content is written in chunks, so it's hashed as it's written
+
+    ASSERT_TRUE(create_patch_file(BASE_PATH, "./patch_streamed.dpf", &context));
+    ASSERT_TRUE(dpf.check_checksum("./patch_streamed.dpf"));
+    ASSERT_TRUE(apply_patch_file("./patch_streamed.dpf", "./to_patch_streamed/", &context));
+}
+
+TEST(dpf, compression_settings) {
+    dpf_inputs inputs = get_patch_inputs(BASE_PATH);
+
+    inputs.compression.level    = 1;
+    inputs.compression.strategy = dpf_deflate_strategy::rle;
+
+    inputs.files[0].compression = dpf_compression{ 10, dpf_deflate_strategy::huffman_only };
+
+    ASSERT_TRUE(create_patch_file(inputs, "./patch_compression.dpf"));
+    ASSERT_TRUE(apply_patch_file("./patch_compression.dpf", "./to_patch_compression/"));
+
+    // Level and strategy reach the compressor
+
+    std::vector<uint8_t> content;
+    uint32_t             seed = 3U;
+
+    const std::string words[] = { "patch ", "file ", "entry ", "block ", "stream ", "index ", "\n" };
+
+    while (content.size() < 256U * 1024U) {
+        const std::string& word = words[next_random(seed) % std::size(words)];
+        content.insert(content.end(), word.begin(), word.end());
+    }
+
+    ASSERT_TRUE(write_file("./compression/source/words.txt", content));
+
+    auto get_size = [&](dpf_compression compression) {
+        dpf_inputs inputs;
+        inputs.base_path   = "./compression/source";
+        inputs.compression = compression;
+        inputs.files.push_back({ "./compression/source/words.txt", dpf_op::add });
+
+        if (!create_patch_file(inputs, "./patch_compression_words.dpf"))
+            return (uintmax_t)0U;
+
+        return std::filesystem::file_size("./patch_compression_words.dpf");
+    };
+
+    uintmax_t fastest = get_size({ 1, dpf_deflate_strategy::normal });
+    uintmax_t best    = get_size({ 9, dpf_deflate_strategy::normal });
+    uintmax_t huffman = get_size({ 9, dpf_deflate_strategy::huffman_only });
+
+    ASSERT_TRUE(fastest != 0U && best != 0U && huffman != 0U);
+    ASSERT_LT(best, fastest);
+    ASSERT_LT(best, huffman);
+}
+
+TEST(dpf, stored_entries) {
+    dpf_inputs inputs = get_patch_inputs(BASE_PATH);
+
+    inputs.store_extensions = { ".TXT" };
+
+    ASSERT_TRUE(create_patch_file(inputs, "./patch_stored.dpf"));
+    ASSERT_TRUE(apply_patch_file("./patch_stored.dpf", "./to_patch_stored/"));
+    ASSERT_TRUE(std::filesystem::file_size("./patch_stored.dpf") > std::filesystem::file_size(PATCH_FILE));
+}
+
+TEST(dpf, v1_compatibility) {
+    dpf                      dpf;
+    std::vector<std::string> files;
+    uint16_t                 major = 0U, minor = 0U, rev = 0U;
+    std::string              file  = std::string(BASE_PATH) + std::string("/resources/patch_v1.dpf");
+
+    ASSERT_TRUE(dpf.is_dpf_file(file));
+    ASSERT_TRUE(dpf.check_checksum(file));
+    ASSERT_TRUE(dpf.get_files(file, files).status == dpf_status::ok);
+    ASSERT_TRUE(files.size() == 3);
+    ASSERT_TRUE(dpf.get_patch_version(file, major, minor, rev).status == dpf_status::ok);
+    ASSERT_TRUE(major == 1U && minor == 2U && rev == 3U);
+    ASSERT_TRUE(apply_patch_file(file, "./to_patch_v1/"));
+}
+
+TEST(dpf, delta_entries) {
+    dpf        dpf;
+    dpf_inputs inputs = get_delta_inputs();
+
+    ASSERT_TRUE(create_patch_file(inputs, "./patch_delta.dpf"));
+    ASSERT_TRUE(std::filesystem::file_size("./patch_delta.dpf") < 4096U);
+    ASSERT_TRUE(apply_delta_patch_file("./patch_delta.dpf"));
+
+    // Patching a file that isn't the original fails
+
+    ASSERT_FALSE(dpf.patch("./patch_delta.dpf", "./delta/to_patch/").status == dpf_status::ok);
+}
+
+TEST(dpf, rsync_delta_entries) {
+    dpf        dpf;
+    dpf_inputs inputs = get_delta_inputs();
+
+    inputs.delta_max_size = 0U;
+
+    ASSERT_TRUE(create_patch_file(inputs, "./patch_rsync.dpf"));
+    ASSERT_TRUE(std::filesystem::file_size("./patch_rsync.dpf") < 16384U);
+    ASSERT_TRUE(apply_delta_patch_file("./patch_rsync.dpf"));
+
+    ASSERT_FALSE(dpf.patch("./patch_rsync.dpf", "./delta/to_patch/").status == dpf_status::ok);
+    ASSERT_TRUE(compare_files("./delta/to_patch/file.bin", "./delta/modified/file.bin"));
+}
+
+TEST(dpf, deduplication) {
+    dpf                  dpf;
+    dpf_inputs           inputs;
+    std::vector<uint8_t> content(64U * 1024U);
+    uint32_t             seed = 54321U;
+
+    fill_random(content, seed);
+
+    std::filesystem::remove_all("./dedup/");
+
+    ASSERT_TRUE(write_file("./dedup/source/a.bin", content));
+    ASSERT_TRUE(write_file("./dedup/source/sub/b.bin", content));
+    ASSERT_TRUE(write_file("./dedup/source/sub/c.bin", content));
+
+    content[0] ^= 0xFF;
+
+    ASSERT_TRUE(write_file("./dedup/source/d.bin", content));
+
+    inputs.base_path = "./dedup/source";
+
+    for (const char* file : { "a.bin", "sub/b.bin", "sub/c.bin", "d.bin" })
+        inputs.files.push_back({ std::string("./dedup/source/") + file, dpf_op::add });
+
+    ASSERT_TRUE(create_patch_file(inputs, "./patch_dedup.dpf"));
+
+    inputs.deduplicate = false;
+
+    ASSERT_TRUE(create_patch_file(inputs, "./patch_no_dedup.dpf"));
+    ASSERT_TRUE(std::filesystem::file_size("./patch_dedup.dpf") * 3U < std::filesystem::file_size("./patch_no_dedup.dpf") * 2U);
+
+    ASSERT_TRUE(dpf.patch("./patch_dedup.dpf", "./dedup/patched/").status == dpf_status::ok);
+
+    for (const char* file : { "a.bin", "sub/b.bin", "sub/c.bin", "d.bin" })
+        ASSERT_TRUE(compare_files(std::string("./dedup/patched/") + file, std::string("./dedup/source/") + file));
+}
+
+TEST(dpf, solid_blocks) {
+    dpf        dpf;
+    dpf_inputs inputs;
+
+    std::filesystem::remove_all("./solid/");
+
+    for (size_t i = 0; i < 20; i++) {
+        std::string          id   = std::to_string(i);
+        std::string          text = "[settings]\nid = " + id + "\nname = file_" + id + "\nenabled = true\nscale = 1.0\n";
+        std::vector<uint8_t> content(text.begin(), text.end());
+        std::string          file = std::string(i % 2 ? "a" : "b") + "/file_" + id + (i % 3 ? ".ini" : ".cfg");
+
+        ASSERT_TRUE(add_file(inputs, "./solid/source/" + file, content));
+    }
+
+    inputs.base_path = "./solid/source";
+
+    ASSERT_TRUE(create_patch_file(inputs, "./patch_no_solid.dpf"));
+
+    for (auto group : { dpf_solid_group::extension, dpf_solid_group::directory }) {
+        inputs.solid_group = group;
+
+        ASSERT_TRUE(create_patch_file(inputs, "./patch_solid.dpf"));
+        ASSERT_TRUE(std::filesystem::file_size("./patch_solid.dpf") < std::filesystem::file_size("./patch_no_solid.dpf"));
+
+        std::filesystem::remove_all("./solid/patched/");
+        ASSERT_TRUE(dpf.patch("./patch_solid.dpf", "./solid/patched/").status == dpf_status::ok);
+
+        ASSERT_TRUE(compare_patched(inputs, "./solid/patched"));
+    }
+}
+
+TEST(dpf, preset_dictionary) {
+    dpf                  dpf;
+    dpf_inputs           inputs;
+    std::vector<uint8_t> dictionary;
+
+    std::filesystem::remove_all("./dictionary/");
+
+    for (size_t i = 0; i < 30; i++) {
+        std::string          id   = std::to_string(i * 7919U);
+        std::string          text = "{\n    \"$schema\": \"https://example.com/schemas/item.json\",\n    \"id\": " + id + 
+            ",\n    \"display_name\": \"item_" + id + "\",\n    \"properties\": { \"stackable\": true, \"max_stack\": 64 }\n}\n";
+        std::vector<uint8_t> content(text.begin(), text.end());
+        std::string          file = "./dictionary/source/item_" + std::to_string(i) + ".json";
+
+        ASSERT_TRUE(add_file(inputs, file, content));
+    }
+
+    inputs.base_path = "./dictionary/source";
+
+    ASSERT_TRUE(create_patch_file(inputs, "./patch_no_dictionary.dpf"));
+    ASSERT_TRUE(dpf.train_dictionary(inputs, dictionary).status == dpf_status::ok);
+    ASSERT_FALSE(dictionary.empty());
+
+    inputs.dictionary = dictionary;
+
+    ASSERT_TRUE(create_patch_file(inputs, "./patch_dictionary.dpf"));
+    ASSERT_TRUE(std::filesystem::file_size("./patch_dictionary.dpf") < std::filesystem::file_size("./patch_no_dictionary.dpf"));
+    ASSERT_TRUE(dpf.check_checksum("./patch_dictionary.dpf"));
+    ASSERT_TRUE(dpf.patch("./patch_dictionary.dpf", "./dictionary/patched/").status == dpf_status::ok);
+
+    ASSERT_TRUE(compare_patched(inputs, "./dictionary/patched"));
+}
+
+TEST(dpf, tree_diff) {
+    dpf         dpf;
+    dpf_inputs  inputs;
+    dpf_context context;
+    std::string original = std::string(BASE_PATH) + std::string("/resources/original");
+    std::string patch    = std::string(BASE_PATH) + std::string("/resources/patch");
+
+    context.thread_count = 2U;
+
+    ASSERT_TRUE(dpf.diff(original, patch, inputs, &context).status == dpf_status::ok);
+    ASSERT_TRUE(inputs.files.size() == 3);
+    ASSERT_TRUE(create_patch_file(inputs, "./patch_diff.dpf"));
+    ASSERT_TRUE(apply_patch_file("./patch_diff.dpf", "./to_patch_diff/"));
+
+    // Files that only differ in modification time are dropped
+
+    std::filesystem::remove_all("./diff_copy/");
+    ASSERT_TRUE(copy_directory(original, "./diff_copy/"));
+
+    std::filesystem::last_write_time("./diff_copy/subfolder/2.txt",
+        std::filesystem::last_write_time("./diff_copy/subfolder/2.txt") + std::chrono::hours(1));
+
+    ASSERT_TRUE(dpf.diff(original, "./diff_copy/", inputs, &context).status == dpf_status::ok);
+    ASSERT_TRUE(inputs.files.empty());
+}
+
+TEST(dpf, blob_cache) {
+    dpf_context context;
+
+    auto count_blobs = [] {
+        size_t count = 0U;
+
+        for (auto& entry : std::filesystem::recursive_directory_iterator("./cache/"))
+            count += entry.path().extension() == ".blob";
+
+        return count;
+    };
+
+    std::filesystem::remove_all("./cache/");
+    context.cache_path = "./cache/";
+
+    ASSERT_TRUE(create_patch_file(BASE_PATH));
+    ASSERT_TRUE(create_patch_file(BASE_PATH, "./patch_cached.dpf", &context));
+    ASSERT_TRUE(compare_files(PATCH_FILE, "./patch_cached.dpf"));
+
+    size_t blobs = count_blobs();
+    ASSERT_TRUE(blobs > 0U);
+
+    // Second run is built from the cache
+
+    ASSERT_TRUE(create_patch_file(BASE_PATH, "./patch_cached.dpf", &context));
+    ASSERT_TRUE(compare_files(PATCH_FILE, "./patch_cached.dpf"));
+    ASSERT_TRUE(count_blobs() == blobs);
+
+    // Streamed entries are chunked, they're compared to an uncached streamed file
+
+    dpf_context streamed;
+    streamed.streaming_threshold = 0U;
+
+    ASSERT_TRUE(create_patch_file(BASE_PATH, "./patch_streamed_uncached.dpf", &streamed));
+
+    context.streaming_threshold = 0U;
+
+    ASSERT_TRUE(create_patch_file(BASE_PATH, "./patch_cached.dpf", &context));
+    ASSERT_TRUE(compare_files("./patch_streamed_uncached.dpf", "./patch_cached.dpf"));
+    ASSERT_TRUE(apply_patch_file("./patch_cached.dpf", "./to_patch_cached/"));
+
+    // Damaged blobs are compressed again, whether streamed or buffered
+
+    for (uint64_t threshold : { (uint64_t)0U, UINT64_MAX }) {
+        for (auto& entry : std::filesystem::recursive_directory_iterator("./cache/")) {
+            if (entry.path().extension() != ".blob")
+                continue;
+
+            std::fstream blob(entry.path(), std::ios::binary | std::ios::in | std::ios::out);
+            blob.put('x');
+        }
+
+        context.streaming_threshold = threshold;
+
+        ASSERT_TRUE(create_patch_file(BASE_PATH, "./patch_cached.dpf", &context));
+        ASSERT_TRUE(compare_files(threshold ? PATCH_FILE : "./patch_streamed_uncached.dpf", "./patch_cached.dpf"));
+    }
+
+    // Everything is evicted when nothing fits
+
+    context.cache_max_size = 0U;
+
+    ASSERT_TRUE(create_patch_file(BASE_PATH, "./patch_cached.dpf", &context));
+    ASSERT_TRUE(count_blobs() == 0U);
+}
+
+TEST(dpf, move_and_copy) {
+    dpf                  dpf;
+    dpf_inputs           inputs;
+    std::vector<uint8_t> content(64U * 1024U);
+    uint32_t             seed = 777U;
+
+    fill_random(content, seed);
+
+    std::filesystem::remove_all("./moves/");
+
+    write_file("./moves/old/a.bin", content);
+    write_file("./moves/new/moved/a.bin", content);
+
+    content[0] ^= 0xFF;
+
+    write_file("./moves/old/b.bin", content);
+    write_file("./moves/new/b.bin", content);
+    write_file("./moves/new/b_copy.bin", content);
+
+    ASSERT_TRUE(dpf.diff("./moves/old/", "./moves/new/", inputs).status == dpf_status::ok);
+    ASSERT_TRUE(inputs.files.size() == 2);
+    ASSERT_TRUE(inputs.files[0].op == dpf_op::copy);
+    ASSERT_TRUE(inputs.files[1].op == dpf_op::move);
+    ASSERT_TRUE(create_patch_file(inputs, "./patch_moves.dpf"));
+
+    // No content is carried for either file
+
+    ASSERT_TRUE(std::filesystem::file_size("./patch_moves.dpf") < 1024U);
+
+    ASSERT_TRUE(copy_directory("./moves/old/", "./moves/to_patch/"));
+    ASSERT_TRUE(dpf.patch("./patch_moves.dpf", "./moves/to_patch/").status == dpf_status::ok);
+    ASSERT_TRUE(compare_files("./moves/to_patch/moved/a.bin", "./moves/new/moved/a.bin"));
+    ASSERT_TRUE(compare_files("./moves/to_patch/b_copy.bin", "./moves/new/b.bin"));
+    ASSERT_TRUE(compare_files("./moves/to_patch/b.bin", "./moves/new/b.bin"));
+    ASSERT_TRUE(!std::filesystem::exists("./moves/to_patch/a.bin"));
+}
+
+TEST(dpf, pipelined) {
+    dpf         dpf;
+    dpf_inputs  inputs;
+    dpf_context context;
+
+    context.pipelined = true;
+
+    ASSERT_TRUE(create_patch_file(BASE_PATH));
+    ASSERT_TRUE(create_patch_file(BASE_PATH, "./patch_pipelined.dpf", &context));
+    ASSERT_TRUE(compare_files(PATCH_FILE, "./patch_pipelined.dpf"));
+    ASSERT_TRUE(apply_patch_file("./patch_pipelined.dpf", "./to_patch_pipelined/", &context));
+
+    // Mix of buffered, streamed, solid and referencing entries
+
+    std::filesystem::remove_all("./pipelined/");
+
+    uint32_t seed = 99U;
+
+    for (size_t i = 0; i < 40; i++) {
+        std::vector<uint8_t> content(i == 7 ? 300U * 1024U : 100U + i * 50U);
+
+        fill_random(content, seed, 8U);
+
+        std::string file = "./pipelined/source/" + std::to_string(i % 4) + "/" + std::to_string(i) + (i % 2 ? ".txt" : ".bin");
+
+        ASSERT_TRUE(add_file(inputs, file, content));
+
+        if (i % 10 == 0) {
+            ASSERT_TRUE(add_file(inputs, file + ".copy", content));
+        }
+    }
+
+    inputs.base_path   = "./pipelined/source";
+    inputs.solid_group = dpf_solid_group::extension;
+
+    dpf_context serial;
+    serial.streaming_threshold  = 128U * 1024U;
+    context.streaming_threshold = 128U * 1024U;
+
+    for (unsigned int threads : { 1U, 2U }) {
+        context.thread_count = threads;
+
+        ASSERT_TRUE(create_patch_file(inputs, "./patch_serial.dpf", &serial));
+        ASSERT_TRUE(create_patch_file(inputs, "./patch_pipelined.dpf", &context));
+        ASSERT_TRUE(compare_files("./patch_serial.dpf", "./patch_pipelined.dpf"));
+
+        std::filesystem::remove_all("./pipelined/patched/");
+        ASSERT_TRUE(dpf.patch("./patch_pipelined.dpf", "./pipelined/patched/", &context).status == dpf_status::ok);
+
+        ASSERT_TRUE(compare_patched(inputs, "./pipelined/patched"));
+    }
+}
+
+TEST(dpf, memory_budget) {
+    dpf        dpf;
+    dpf_inputs inputs;
+
+    std::filesystem::remove_all("./budget/");
+
+    uint32_t seed = 7U;
+
+    for (size_t i = 0; i < 30; i++) {
+        std::vector<uint8_t> content(i % 10 == 3 ? 300U * 1024U : 1000U + i * 900U);
+
+        fill_random(content, seed, 8U);
+
+        std::string file = "./budget/source/" + std::to_string(i % 3) + "/" + std::to_string(i) + (i % 2 ? ".txt" : ".bin");
+
+        ASSERT_TRUE(add_file(inputs, file, content));
+    }
+
+    inputs.base_path   = "./budget/source";
+    inputs.solid_group = dpf_solid_group::extension;
+
+    // Without a budget, the same limits give the same file
+
+    dpf_context unlimited;
+    unlimited.streaming_threshold = 64U * 1024U;
+    inputs.solid_block_size       = 64U * 1024U;
+
+    ASSERT_TRUE(create_patch_file(inputs, "./patch_unlimited.dpf", &unlimited));
+
+    inputs.solid_block_size = dpf_inputs().solid_block_size;
+
+    for (bool pipelined : { false, true }) {
+        for (unsigned int threads : { 1U, 0U }) {
+            dpf_context context;
+            context.memory_budget = 128U * 1024U;
+            context.thread_count  = threads;
+            context.pipelined     = pipelined;
+
+            ASSERT_TRUE(create_patch_file(inputs, "./patch_budget.dpf", &context));
+            ASSERT_TRUE(compare_files("./patch_unlimited.dpf", "./patch_budget.dpf"));
+
+            std::filesystem::remove_all("./budget/patched/");
+            ASSERT_TRUE(dpf.patch("./patch_budget.dpf", "./budget/patched/", &context).status == dpf_status::ok);
+
+            ASSERT_TRUE(compare_patched(inputs, "./budget/patched"));
+        }
+    }
+
+    // Entries hold twice their size until written, so only one of them fits at a time
+
+    std::atomic_size_t in_flight     = 0U;
+    std::atomic_size_t max_in_flight = 0U;
+
+    dpf_context context;
+    context.memory_budget  = 128U * 1024U;
+    context.thread_count   = 4U;
+    context.buf_process_fn = [&](const dpf_file_mod&, std::vector<uint8_t>&) {
+        size_t current = ++in_flight;
+        size_t max     = max_in_flight;
+
+        while (current > max && !max_in_flight.compare_exchange_weak(max, current));
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        in_flight--;
+
+        dpf_result result;
+        result.status = dpf_status::ok;
+        return result;
+    };
+
+    inputs = dpf_inputs();
+    inputs.base_path = "./budget/source";
+
+    for (size_t i = 0; i < 8; i++) {
+        std::string file = "./budget/source/even/" + std::to_string(i) + ".bin";
+
+        ASSERT_TRUE(add_file(inputs, file, std::vector<uint8_t>(40U * 1024U, (uint8_t)i)));
+    }
+
+    ASSERT_TRUE(create_patch_file(inputs, "./patch_budget.dpf", &context));
+    ASSERT_EQ(max_in_flight.load(), 1U);
+}
+
+TEST(dpf, progress) {
+    dpf        dpf;
+    dpf_inputs inputs;
+
+    std::filesystem::remove_all("./progress/");
+
+    uint32_t seed        = 5U;
+    uint64_t bytes_total = 0U;
+
+    for (size_t i = 0; i < 10; i++) {
+        std::vector<uint8_t> content(i == 4 ? 3U * 1024U * 1024U : 100U + i * 10U);
+
+        fill_random(content, seed);
+
+        std::string file = "./progress/source/" + std::to_string(i) + ".bin";
+
+        ASSERT_TRUE(add_file(inputs, file, content));
+
+        bytes_total += content.size();
+    }
+
+    inputs.base_path = "./progress/source";
+
+    dpf_context               context;
+    std::vector<dpf_progress> reports;
+    float                     percent = 0.0f;
+
+    context.streaming_threshold = 1024U * 1024U;
+    context.progress_interval   = 0U;
+    context.thread_count        = 2U;
+    context.progress_callback   = [&](const dpf_progress& progress) { reports.push_back(progress); };
+    context.update_callback     = [&](float change) { percent += change; };
+
+    auto check = [&] {
+        ASSERT_FALSE(reports.empty());
+        ASSERT_EQ(reports.back().bytes_processed, bytes_total);
+        ASSERT_EQ(reports.back().bytes_total, bytes_total);
+        ASSERT_EQ(reports.back().entries_processed, inputs.files.size());
+        ASSERT_EQ(reports.back().entries_total, inputs.files.size());
+        ASSERT_NEAR(percent, 100.0f, 0.01f);
+
+        // The large file is reported block by block
+
+        size_t partial = 0U;
+
+        for (size_t i = 1; i < reports.size(); i++) {
+            ASSERT_GE(reports[i].bytes_processed, reports[i - 1].bytes_processed);
+
+            if (reports[i].current_entry == "4.bin" && reports[i].bytes_processed < bytes_total)
+                partial++;
+        }
+
+        ASSERT_GE(partial, 2U);
+    };
+
+    ASSERT_TRUE(create_patch_file(inputs, "./patch_progress.dpf", &context));
+    check();
+
+    reports.clear();
+    percent = 0.0f;
+
+    std::filesystem::remove_all("./progress/patched/");
+    ASSERT_TRUE(dpf.patch("./patch_progress.dpf", "./progress/patched/", &context).status == dpf_status::ok);
+    check();
+
+    // Throttled, only the final report is left within a long interval
+
+    reports.clear();
+    percent = 0.0f;
+
+    context.progress_interval = 60000U;
+
+    ASSERT_TRUE(create_patch_file(inputs, "./patch_progress.dpf", &context));
+    ASSERT_EQ(reports.size(), 1U);
+    ASSERT_NEAR(percent, 100.0f, 0.01f);
+}
+
+TEST(dpf, writer) {
+    dpf         dpf;
+    dpf_writer  writer;
+    dpf_context context;
+
+    context.streaming_threshold = 256U * 1024U;
+
+    std::filesystem::remove_all("./writer/");
+
+    uint32_t             seed = 3U;
+    std::vector<uint8_t> text(100U * 1024U);
+    std::vector<uint8_t> large(1536U * 1024U);
+    std::vector<uint8_t> noise(2500U * 1024U);
+
+    fill_random(text, seed, 8U);
+
+    for (size_t i = 0; i < large.size(); i++)
+        large[i] = text[i % text.size()];
+
+    fill_random(noise, seed);
+
+    ASSERT_TRUE(write_file("./writer/patched/removed.txt", text));
+    ASSERT_TRUE(write_file("./writer/patched/modified.txt", noise));
+
+    size_t offset = 0U;
+
+    auto noise_reader = [&](uint8_t* buffer, size_t size) {
+        size = std::min<size_t>({ size, 100000U, noise.size() - offset });
+
+        std::memcpy(buffer, noise.data() + offset, size);
+        offset += size;
+
+        return size;
+    };
+
+    ASSERT_TRUE(writer.open("./patch_writer.dpf", 7U, {}, &context).status == dpf_status::ok);
+    ASSERT_TRUE(writer.add("text.txt", text).status == dpf_status::ok);
+    ASSERT_TRUE(writer.add("sub/large.txt", large).status == dpf_status::ok);
+    ASSERT_TRUE(writer.add("sub/empty.txt", std::span<const uint8_t>()).status == dpf_status::ok);
+    ASSERT_TRUE(writer.add("noise.bin", noise_reader).status == dpf_status::ok);
+    ASSERT_TRUE(writer.add("modified.txt", text, dpf_op::modify, dpf_compression{ 9 }).status == dpf_status::ok);
+    ASSERT_TRUE(writer.remove("removed.txt").status == dpf_status::ok);
+    ASSERT_TRUE(writer.add("invalid.txt", text, dpf_op::remove).status == dpf_status::failure);
+    ASSERT_TRUE(writer.close().status == dpf_status::ok);
+    ASSERT_FALSE(writer.is_open());
+
+    std::vector<std::string> files;
+    uint64_t                 version = 0U;
+
+    ASSERT_TRUE(dpf.check_checksum("./patch_writer.dpf"));
+    ASSERT_TRUE(dpf.get_files("./patch_writer.dpf", files).status == dpf_status::ok);
+    ASSERT_TRUE(dpf.get_patch_version("./patch_writer.dpf", version).status == dpf_status::ok);
+    ASSERT_EQ(files.size(), 6U);
+    ASSERT_EQ(version, 7U);
+
+    ASSERT_TRUE(dpf.patch("./patch_writer.dpf", "./writer/patched/").status == dpf_status::ok);
+
+    ASSERT_TRUE(write_file("./writer/expected/text.txt", text));
+    ASSERT_TRUE(write_file("./writer/expected/large.txt", large));
+    ASSERT_TRUE(write_file("./writer/expected/noise.bin", noise));
+    ASSERT_TRUE(write_file("./writer/expected/empty.txt", {}));
+
+    ASSERT_TRUE(compare_files("./writer/patched/text.txt", "./writer/expected/text.txt"));
+    ASSERT_TRUE(compare_files("./writer/patched/sub/large.txt", "./writer/expected/large.txt"));
+    ASSERT_TRUE(compare_files("./writer/patched/sub/empty.txt", "./writer/expected/empty.txt"));
+    ASSERT_TRUE(compare_files("./writer/patched/noise.bin", "./writer/expected/noise.bin"));
+    ASSERT_TRUE(compare_files("./writer/patched/modified.txt", "./writer/expected/text.txt"));
+    ASSERT_FALSE(std::filesystem::exists("./writer/patched/removed.txt"));
+
+    // A failed entry leaves the file incomplete, it's removed on close
+
+    auto failing_reader = [](uint8_t*, size_t) -> size_t {
+        throw std::runtime_error("Generator failed.");
+    };
+
+    ASSERT_TRUE(writer.open("./patch_writer_failed.dpf").status == dpf_status::ok);
+    ASSERT_TRUE(writer.add("text.txt", text).status == dpf_status::ok);
+    ASSERT_TRUE(writer.add("failed.txt", failing_reader).status == dpf_status::failure);
+    ASSERT_TRUE(writer.add("text_2.txt", text).status == dpf_status::failure);
+    ASSERT_TRUE(writer.close().status == dpf_status::failure);
+    ASSERT_FALSE(std::filesystem::exists("./patch_writer_failed.dpf"));
+}
+
+// Files per second for a tree of many small files.
+// Run with --gtest_also_run_disabled_tests --gtest_filter=*small_file_throughput
+TEST(dpf, output_sink) {
+    dpf        dpf;
+    dpf_inputs inputs = get_delta_inputs();
+
+    inputs.delta_max_size = 0U;
+
+    // Streamed add and rsync entries are written in chunks
+
+    std::vector<uint8_t> large(3U * 1024U * 1024U);
+    uint32_t             seed = 7U;
+
+    fill_random(large, seed, 8U);
+
+    ASSERT_TRUE(add_file(inputs, "./delta/modified/large.txt", large));
+
+    dpf_context context;
+    context.streaming_threshold = 64U * 1024U;
+
+    for (bool pipelined : { false, true }) {
+        context.pipelined    = pipelined;
+        context.thread_count = pipelined ? 2U : 1U;
+
+        dpf_memory_output output;
+        ASSERT_TRUE(dpf.create(inputs, output, &context).status == dpf_status::ok);
+        ASSERT_TRUE(write_file("./patch_sink.dpf", output.buffer));
+
+        std::ofstream fout("./patch_sink_stream.dpf", std::ios::binary);
+        dpf_stream_output stream_output(fout);
+
+        ASSERT_TRUE(dpf.create(inputs, stream_output, &context).status == dpf_status::ok);
+        fout.close();
+
+        ASSERT_TRUE(compare_files("./patch_sink.dpf", "./patch_sink_stream.dpf"));
+
+        std::vector<std::string> files;
+
+        ASSERT_TRUE(dpf.check_checksum("./patch_sink.dpf"));
+        ASSERT_TRUE(dpf.get_files("./patch_sink.dpf", files).status == dpf_status::ok);
+        ASSERT_EQ(files.size(), 2U);
+
+        std::filesystem::remove_all("./delta/to_patch/");
+        std::filesystem::create_directories("./delta/to_patch/");
+        std::filesystem::copy_file("./delta/original/file.bin", "./delta/to_patch/file.bin");
+
+        ASSERT_TRUE(dpf.patch("./patch_sink.dpf", "./delta/to_patch/", &context).status == dpf_status::ok);
+        ASSERT_TRUE(compare_files("./delta/to_patch/file.bin", "./delta/modified/file.bin"));
+        ASSERT_TRUE(compare_files("./delta/to_patch/large.txt", "./delta/modified/large.txt"));
+    }
+
+    // A damaged trailer fails the checksum
+
+    std::vector<uint8_t> damaged(std::filesystem::file_size("./patch_sink.dpf"));
+    std::ifstream("./patch_sink.dpf", std::ios::binary).read((char*)damaged.data(), damaged.size());
+
+    damaged.back() ^= 0xFF;
+
+    ASSERT_TRUE(write_file("./patch_sink.dpf", damaged));
+    ASSERT_FALSE(dpf.check_checksum("./patch_sink.dpf"));
+}
+
+TEST(dpf, append) {
+    dpf        dpf;
+    dpf_inputs inputs = get_patch_inputs(BASE_PATH);
+
+    std::filesystem::remove_all("./append/");
+
+    ASSERT_TRUE(create_patch_file(inputs, "./patch_append.dpf"));
+
+    // Identical appended files reference each other past the existing entries
+
+    std::vector<uint8_t> text(400U * 1024U);
+    uint32_t             seed = 5U;
+
+    fill_random(text, seed, 8U);
+
+    ASSERT_TRUE(write_file("./append/source/extra/large.txt", text));
+    ASSERT_TRUE(write_file("./append/source/extra/copy.txt", text));
+    ASSERT_TRUE(write_file("./append/source/small.txt", { 's', 'm', 'a', 'l', 'l' }));
+
+    dpf_inputs appended;
+    appended.base_path = "./append/source";
+    appended.files.push_back({ "./append/source/extra/large.txt", dpf_op::add });
+    appended.files.push_back({ "./append/source/extra/copy.txt", dpf_op::add });
+
+    dpf_context context;
+    context.streaming_threshold = 128U * 1024U;
+
+    dpf_inputs small;
+    small.base_path = "./append/source";
+    small.files.push_back({ "./append/source/small.txt", dpf_op::add });
+
+    ASSERT_TRUE(dpf.append(appended, "./patch_append.dpf", &context).status == dpf_status::ok);
+    ASSERT_TRUE(dpf.append(small, "./patch_append.dpf").status == dpf_status::ok);
+
+    std::vector<std::string> files;
+
+    ASSERT_TRUE(dpf.check_checksum("./patch_append.dpf"));
+    ASSERT_TRUE(dpf.get_files("./patch_append.dpf", files).status == dpf_status::ok);
+    ASSERT_EQ(files.size(), 6U);
+    ASSERT_TRUE(apply_patch_file("./patch_append.dpf", "./append/patched/"));
+    ASSERT_TRUE(compare_files("./append/patched/extra/large.txt", "./append/source/extra/large.txt"));
+    ASSERT_TRUE(compare_files("./append/patched/extra/copy.txt", "./append/source/extra/large.txt"));
+    ASSERT_TRUE(compare_files("./append/patched/small.txt", "./append/source/small.txt"));
+
+    // A failed append leaves the file as it was
+
+    std::filesystem::copy_file("./patch_append.dpf", "./append/before.dpf");
+
+    dpf_inputs missing;
+    missing.base_path = "./append/source";
+    missing.files.push_back({ "./append/source/missing.txt", dpf_op::add });
+
+    ASSERT_FALSE(dpf.append(missing, "./patch_append.dpf").status == dpf_status::ok);
+    ASSERT_TRUE(compare_files("./patch_append.dpf", "./append/before.dpf"));
+
+    // Files with a checksum trailer get a segment table on their first append
+
+    dpf_memory_output output;
+    ASSERT_TRUE(dpf.create(inputs, output).status == dpf_status::ok);
+    ASSERT_TRUE(write_file("./append/sink.dpf", output.buffer));
+
+    ASSERT_TRUE(dpf.append(small, "./append/sink.dpf").status == dpf_status::ok);
+    ASSERT_TRUE(dpf.check_checksum("./append/sink.dpf"));
+    ASSERT_TRUE(apply_patch_file("./append/sink.dpf", "./append/patched/"));
+    ASSERT_TRUE(compare_files("./append/patched/small.txt", "./append/source/small.txt"));
+
+    // Earlier segments are still checked, byte 50 is in the first entry
+
+    std::vector<uint8_t> damaged(std::filesystem::file_size("./patch_append.dpf"));
+    std::ifstream("./patch_append.dpf", std::ios::binary).read((char*)damaged.data(), damaged.size());
+
+    damaged[50] ^= 0xFF;
+
+    ASSERT_TRUE(write_file("./append/damaged.dpf", damaged));
+    ASSERT_FALSE(dpf.check_checksum("./append/damaged.dpf"));
+}
+
+TEST(dpf, index) {
+    dpf        dpf;
+    dpf_inputs inputs;
+
+    std::filesystem::remove_all("./index/");
+
+    for (size_t i = 0; i < 30; i++) {
+        std::string          id = std::to_string(i);
+        std::vector<uint8_t> content(i == 5 ? 300U * 1024U : 50U + i, (uint8_t)('a' + i % 8U));
+        std::string          file = "./index/source/" + std::string(i % 2 ? "a" : "b") + "/file_" + id + ".txt";
+
+        ASSERT_TRUE(add_file(inputs, file, content));
+    }
+
+    inputs.base_path   = "./index/source";
+    inputs.solid_group = dpf_solid_group::directory;
+
+    dpf_context context;
+    context.streaming_threshold = 128U * 1024U;
+
+    auto check_index = [&](const std::string& file, size_t count) {
+        std::vector<std::string>   paths;
+        std::vector<dpf_file_info> infos;
+
+        ASSERT_TRUE(dpf.get_files(file, paths).status == dpf_status::ok);
+        ASSERT_TRUE(dpf.get_files(file, infos).status == dpf_status::ok);
+        ASSERT_EQ(paths.size(), count);
+        ASSERT_EQ(infos.size(), count);
+
+        std::ifstream fin(file, std::ios::binary);
+
+        for (size_t i = 0; i < infos.size(); i++) {
+            dpf_file_info info;
+
+            ASSERT_EQ(infos[i].path, paths[i]);
+            ASSERT_TRUE(dpf.find_file(file, infos[i].path, info).status == dpf_status::ok);
+            ASSERT_EQ(info.offset, infos[i].offset);
+            ASSERT_EQ(info.size, infos[i].size);
+
+            // Offsets point at the entry, which starts with its op
+
+            char op = 0;
+            fin.seekg(infos[i].offset, std::ios::beg);
+            fin.read(&op, 1);
+
+            ASSERT_EQ((dpf_op)op, infos[i].op);
+        }
+
+        dpf_file_info info;
+        ASSERT_FALSE(dpf.find_file(file, "missing.txt", info).status == dpf_status::ok);
+    };
+
+    ASSERT_TRUE(create_patch_file(inputs, "./patch_index.dpf", &context));
+    check_index("./patch_index.dpf", 30U);
+
+    // Later entries for the same path are found
+
+    dpf_inputs modified;
+    modified.base_path = "./index/source";
+    modified.files.push_back({ "./index/source/a/file_1.txt", dpf_op::modify });
+
+    dpf_file_info before;
+    dpf_file_info after;
+    std::string   path = std::filesystem::path("a/file_1.txt").make_preferred().string();
+
+    ASSERT_TRUE(dpf.find_file("./patch_index.dpf", path, before).status == dpf_status::ok);
+    ASSERT_TRUE(dpf.append(modified, "./patch_index.dpf").status == dpf_status::ok);
+    ASSERT_TRUE(dpf.find_file("./patch_index.dpf", path, after).status == dpf_status::ok);
+    ASSERT_TRUE(dpf.check_checksum("./patch_index.dpf"));
+    ASSERT_EQ(after.op, dpf_op::modify);
+    ASSERT_TRUE(after.offset > before.offset);
+
+    // Output sinks write an index too, files without one are scanned
+
+    dpf_memory_output output;
+    ASSERT_TRUE(dpf.create(inputs, output, &context).status == dpf_status::ok);
+    ASSERT_TRUE(write_file("./index/sink.dpf", output.buffer));
+
+    check_index("./index/sink.dpf", 30U);
+    check_index(std::string(BASE_PATH) + std::string("/resources/patch_v1.dpf"), 3U);
+}
+
+TEST(dpf, entry_checksums) {
+    dpf        dpf;
+    dpf_inputs inputs;
+
+    std::filesystem::remove_all("./entry_checksums/");
+
+    for (size_t i = 0; i < 3; i++) {
+        std::string file = "./entry_checksums/source/" + std::to_string(i) + ".txt";
+
+        ASSERT_TRUE(add_file(inputs, file, std::vector<uint8_t>(1000U + i, (uint8_t)('a' + i))));
+    }
+
+    inputs.base_path = "./entry_checksums/source";
+
+    ASSERT_TRUE(create_patch_file(inputs, "./patch_entry_checksums.dpf"));
+    ASSERT_TRUE(dpf.check_checksum("./patch_entry_checksums.dpf"));
+
+    // Damage the last content byte of the middle entry
+
+    std::vector<dpf_file_info> infos;
+    ASSERT_TRUE(dpf.get_files("./patch_entry_checksums.dpf", infos).status == dpf_status::ok);
+    ASSERT_EQ(infos.size(), 3U);
+
+    {
+        std::fstream file("./patch_entry_checksums.dpf", std::ios::binary | std::ios::in | std::ios::out);
+        char         byte = 0;
+
+        file.seekg(infos[2].offset - 1U, std::ios::beg);
+        file.read(&byte, 1);
+
+        byte ^= 0x01;
+
+        file.seekp(infos[2].offset - 1U, std::ios::beg);
+        file.write(&byte, 1);
+    }
+
+    ASSERT_FALSE(dpf.check_checksum("./patch_entry_checksums.dpf"));
+
+    // The damaged entry is rejected before its file is written
+
+    for (bool pipelined : { false, true }) {
+        dpf_context context;
+        context.pipelined = pipelined;
+
+        std::filesystem::remove_all("./entry_checksums/patched/");
+
+        auto result = dpf.patch("./patch_entry_checksums.dpf", "./entry_checksums/patched/", &context);
+
+        ASSERT_FALSE(result.status == dpf_status::ok);
+        ASSERT_TRUE(result.message.find("corrupt") != std::string::npos);
+        ASSERT_TRUE(std::filesystem::exists("./entry_checksums/patched/" + infos[0].path));
+        ASSERT_FALSE(std::filesystem::exists("./entry_checksums/patched/" + infos[1].path));
+    }
+
+    // Streamed entries are decoded next to the target, which is kept when they're damaged
+
+    dpf_context context;
+    context.streaming_threshold = 0U;
+
+    std::filesystem::remove_all("./entry_checksums/patched/");
+    ASSERT_TRUE(write_file("./entry_checksums/patched/" + infos[1].path, { 'o', 'l', 'd' }));
+
+    auto result = dpf.patch("./patch_entry_checksums.dpf", "./entry_checksums/patched/", &context);
+
+    ASSERT_FALSE(result.status == dpf_status::ok);
+    ASSERT_EQ(std::filesystem::file_size("./entry_checksums/patched/" + infos[1].path), 3U);
+    ASSERT_FALSE(std::filesystem::exists("./entry_checksums/patched/" + infos[1].path + ".dpf_tmp"));
+}
+
+TEST(dpf, split_entries) {
+    dpf        dpf;
+    dpf_inputs inputs;
+
+    std::filesystem::remove_all("./split/");
+
+    // Last block is shorter than the others
+
+    std::vector<uint8_t> content(10U * 256U * 1024U + 1000U);
+    uint32_t             seed = 17U;
+
+    fill_random(content, seed, 8U);
+
+    inputs.base_path = "./split/source";
+
+    ASSERT_TRUE(add_file(inputs, "./split/source/large.txt", content));
+    ASSERT_TRUE(add_file(inputs, "./split/source/small.txt", { 's', 'm', 'a', 'l', 'l' }));
+
+    dpf_context context;
+    context.streaming_threshold = 128U * 1024U;
+    context.split_size          = 256U * 1024U;
+
+    // Blocks are compressed the same way regardless of the thread count
+
+    ASSERT_TRUE(create_patch_file(inputs, "./patch_split_serial.dpf", &context));
+
+    context.thread_count = 4U;
+
+    ASSERT_TRUE(create_patch_file(inputs, "./patch_split.dpf", &context));
+    ASSERT_TRUE(compare_files("./patch_split_serial.dpf", "./patch_split.dpf"));
+    ASSERT_TRUE(dpf.check_checksum("./patch_split.dpf"));
+
+    dpf_memory_output output;
+    ASSERT_TRUE(dpf.create(inputs, output, &context).status == dpf_status::ok);
+    ASSERT_TRUE(write_file("./split/sink.dpf", output.buffer));
+
+    for (const std::string file : { "./patch_split.dpf", "./split/sink.dpf" }) {
+        for (bool pipelined : { false, true }) {
+            context.pipelined = pipelined;
+
+            std::filesystem::remove_all("./split/patched/");
+
+            ASSERT_TRUE(dpf.patch(file, "./split/patched/", &context).status == dpf_status::ok);
+            ASSERT_TRUE(compare_patched(inputs, "./split/patched"));
+        }
+    }
+
+    // Patching uses the block size of the file, not the one of the context
+
+    context.split_size    = 0U;
+    context.memory_budget = 1024U * 1024U;
+
+    std::filesystem::remove_all("./split/patched/");
+
+    ASSERT_TRUE(dpf.patch("./patch_split.dpf", "./split/patched/", &context).status == dpf_status::ok);
+    ASSERT_TRUE(compare_files("./split/patched/large.txt", "./split/source/large.txt"));
+
+    // Splitting can be turned off
+
+    context.memory_budget = 0U;
+
+    ASSERT_TRUE(create_patch_file(inputs, "./patch_split_off.dpf", &context));
+    ASSERT_TRUE(std::filesystem::file_size("./patch_split_off.dpf") < std::filesystem::file_size("./patch_split.dpf"));
+}
+
+TEST(dpf, path_table) {
+    dpf        dpf;
+    dpf_inputs inputs;
+
+    std::filesystem::remove_all("./path_table/");
+
+    // Deep paths sharing long prefixes
+
+    for (size_t i = 0; i < 200; i++) {
+        std::string dir  = "./path_table/source/assets/textures/characters/" + std::string(i % 3 ? "hero" : "enemy");
+        std::string file = dir + "/diffuse_variant_" + std::to_string(i) + ".txt";
+
+        ASSERT_TRUE(add_file(inputs, file, std::vector<uint8_t>(10U + i % 7U, (uint8_t)('a' + i % 8U))));
+    }
+
+    inputs.base_path   = "./path_table/source";
+    inputs.solid_group = dpf_solid_group::directory;
+
+    ASSERT_TRUE(create_patch_file(inputs, "./patch_path_table.dpf"));
+    ASSERT_TRUE(dpf.check_checksum("./patch_path_table.dpf"));
+
+    // Entries don't repeat their paths, the path table is deflated
+
+    std::vector<uint8_t> content(std::filesystem::file_size("./patch_path_table.dpf"));
+    std::ifstream("./patch_path_table.dpf", std::ios::binary).read((char*)content.data(), content.size());
+
+    std::string needle = "diffuse_variant_";
+    ASSERT_TRUE(std::search(content.begin(), content.end(), needle.begin(), needle.end()) == content.end());
+
+    std::vector<dpf_file_info> infos;
+    ASSERT_TRUE(dpf.get_files("./patch_path_table.dpf", infos).status == dpf_status::ok);
+    ASSERT_EQ(infos.size(), inputs.files.size());
+
+    for (auto& file : inputs.files) {
+        auto          relative = std::filesystem::relative(file.path, inputs.base_path);
+        dpf_file_info info;
+
+        ASSERT_TRUE(dpf.find_file("./patch_path_table.dpf", relative.string(), info).status == dpf_status::ok);
+        ASSERT_EQ(info.path, relative.string());
+    }
+
+    for (bool pipelined : { false, true }) {
+        dpf_context context;
+        context.pipelined = pipelined;
+
+        std::filesystem::remove_all("./path_table/patched/");
+        ASSERT_TRUE(dpf.patch("./patch_path_table.dpf", "./path_table/patched/", &context).status == dpf_status::ok);
+
+        ASSERT_TRUE(compare_patched(inputs, "./path_table/patched"));
+    }
+}
+
+TEST(dpf, format_versions) {
+    dpf             dpf;
+    dpf_format_info format;
+
+    // Latest format by default
+
+    ASSERT_TRUE(create_patch_file(BASE_PATH, "./patch_format_latest.dpf"));
+    ASSERT_TRUE(dpf.get_format("./patch_format_latest.dpf", format).status == dpf_status::ok);
+    ASSERT_EQ(format.version, 2U);
+    ASSERT_TRUE(format.has(dpf_format_info::segments | dpf_format_info::index | dpf_format_info::checksums | dpf_format_info::path_table));
+
+    // V1 files are still written and read
+
+    dpf_inputs inputs = get_patch_inputs(BASE_PATH);
+    inputs.format_version = 1U;
+    inputs.solid_group    = dpf_solid_group::directory;
+
+    ASSERT_TRUE(create_patch_file(inputs, "./patch_format_v1.dpf"));
+    ASSERT_TRUE(dpf.get_format("./patch_format_v1.dpf", format).status == dpf_status::ok);
+    ASSERT_EQ(format.version, 1U);
+    ASSERT_EQ(format.features, 0U);
+    ASSERT_TRUE(dpf.check_checksum("./patch_format_v1.dpf"));
+    ASSERT_TRUE(apply_patch_file("./patch_format_v1.dpf", "./format_v1/"));
+
+    // V1 files can't hold chunks, streamed entries are back-patched
+
+    dpf_context streamed;
+    streamed.streaming_threshold = 0U;
+
+    ASSERT_TRUE(create_patch_file(inputs, "./patch_format_v1_streamed.dpf", &streamed));
+    ASSERT_TRUE(compare_files("./patch_format_v1.dpf", "./patch_format_v1_streamed.dpf"));
+    ASSERT_TRUE(dpf.check_checksum("./patch_format_v1_streamed.dpf"));
+
+    std::vector<dpf_file_info> infos;
+    ASSERT_TRUE(dpf.get_files("./patch_format_v1.dpf", infos).status == dpf_status::ok);
+    ASSERT_EQ(infos.size(), inputs.files.size());
+
+    // Optional features are left out, checksums and paths need the index
+
+    inputs = get_patch_inputs(BASE_PATH);
+    inputs.format_features = dpf_format_info::checksums;
+
+    ASSERT_TRUE(create_patch_file(inputs, "./patch_format_no_index.dpf"));
+    ASSERT_TRUE(dpf.get_format("./patch_format_no_index.dpf", format).status == dpf_status::ok);
+    ASSERT_EQ(format.version, 2U);
+    ASSERT_FALSE(format.has(dpf_format_info::index));
+    ASSERT_FALSE(format.has(dpf_format_info::checksums));
+    ASSERT_FALSE(format.has(dpf_format_info::path_table));
+    ASSERT_TRUE(dpf.check_checksum("./patch_format_no_index.dpf"));
+    ASSERT_TRUE(apply_patch_file("./patch_format_no_index.dpf", "./format_no_index/"));
+
+    infos.clear();
+    ASSERT_TRUE(dpf.get_files("./patch_format_no_index.dpf", infos).status == dpf_status::ok);
+    ASSERT_EQ(infos.size(), inputs.files.size());
+
+    // Files without an index are walked entry by entry, damaged entries fail the listing
+
+    std::filesystem::copy_file("./patch_format_no_index.dpf", "./patch_format_no_index_damaged.dpf",
+        std::filesystem::copy_options::overwrite_existing);
+
+    {
+        std::fstream file("./patch_format_no_index_damaged.dpf", std::ios::binary | std::ios::in | std::ios::out);
+        char         byte = (char)0xFF;
+
+        // Encoding follows the op and the path of the first entry
+
+        file.seekp(infos[0].offset + 1U + sizeof(uint64_t) + infos[0].path.size(), std::ios::beg);
+        file.write(&byte, 1);
+    }
+
+    std::vector<std::string> paths;
+    auto result = dpf.get_files("./patch_format_no_index_damaged.dpf", paths);
+
+    ASSERT_TRUE(result.status == dpf_status::failure);
+    ASSERT_TRUE(result.message.find("patch_format_no_index_damaged.dpf") != std::string::npos);
+    ASSERT_TRUE(result.message.find("Unsupported encoding") != std::string::npos);
+
+    infos.clear();
+    result = dpf.get_files("./patch_format_no_index_damaged.dpf", infos);
+
+    ASSERT_TRUE(result.status == dpf_status::failure);
+    ASSERT_TRUE(result.message.find("Unsupported encoding") != std::string::npos);
+
+    inputs = get_patch_inputs(BASE_PATH);
+    inputs.format_features = dpf_format_info::index;
+
+    ASSERT_TRUE(create_patch_file(inputs, "./patch_format_index.dpf"));
+    ASSERT_TRUE(dpf.get_format("./patch_format_index.dpf", format).status == dpf_status::ok);
+    ASSERT_TRUE(format.has(dpf_format_info::index | dpf_format_info::path_table));
+    ASSERT_FALSE(format.has(dpf_format_info::checksums));
+    ASSERT_TRUE(dpf.check_checksum("./patch_format_index.dpf"));
+    ASSERT_TRUE(apply_patch_file("./patch_format_index.dpf", "./format_index/"));
+
+    // The index is only read with its path table
+
+    std::filesystem::copy_file("./patch_format_index.dpf", "./patch_format_index_only.dpf",
+        std::filesystem::copy_options::overwrite_existing);
+
+    {
+        std::fstream file("./patch_format_index_only.dpf", std::ios::binary | std::ios::in | std::ios::out);
+        uint32_t     features = format.features & ~dpf_format_info::path_table;
+
+        // Features follow the magic, version, checksum, patch version and file count
+
+        file.seekp(4U + sizeof(uint16_t) + 16U + 2U * sizeof(uint64_t), std::ios::beg);
+        file.write((const char*)&features, sizeof(features));
+    }
+
+    result = dpf.get_format("./patch_format_index_only.dpf", format);
+
+    ASSERT_TRUE(result.status == dpf_status::failure);
+    ASSERT_TRUE(result.message.find("Missing path table.") != std::string::npos);
+
+    // V1 can't hold moves and is only written into files
+
+    inputs = get_patch_inputs(BASE_PATH);
+    inputs.format_version = 1U;
+    inputs.files.push_back({ std::string(BASE_PATH) + "/resources/patch/1.txt", dpf_op::move, std::nullopt, "0.txt" });
+
+    ASSERT_FALSE(create_patch_file(inputs, "./patch_format_v1_move.dpf"));
+
+    inputs = get_patch_inputs(BASE_PATH);
+    inputs.format_version = 1U;
+
+    dpf_memory_output output;
+    ASSERT_TRUE(dpf.create(inputs, output).status == dpf_status::failure);
+
+    inputs.format_version = 3U;
+    ASSERT_FALSE(create_patch_file(inputs, "./patch_format_v3.dpf"));
+}
+
+TEST(dpf, DISABLED_small_file_throughput) {
+    dpf        dpf;
+    dpf_inputs inputs;
+    size_t     file_count = 20000U;
+    uint32_t   seed       = 1U;
+
+    std::filesystem::remove_all("./small/");
+
+    inputs.base_path = "./small/";
+
+    for (size_t i = 0; i < file_count; i++) {
+        std::vector<uint8_t> content(256U + i % 1792U);
+
+        fill_random(content, seed, 16U);
+
+        std::filesystem::path file = "./small/" + std::to_string(i % 100U) + "/" + std::to_string(i) + ".txt";
+
+        ASSERT_TRUE(add_file(inputs, file, content));
+    }
+
+    for (unsigned int threads : { 1U, 0U }) {
+        dpf_context context;
+        context.thread_count = threads;
+
+        auto start = std::chrono::steady_clock::now();
+
+        ASSERT_TRUE(dpf.create(inputs, "./patch_small.dpf", &context).status == dpf_status::ok);
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        std::cout << "threads " << threads << ": " << (size_t)(file_count / elapsed.count()) << " files/s" << std::endl;
+    }
+}